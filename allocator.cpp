@@ -37,7 +37,7 @@ size_t FreeListMultiLevelAllocator::GetUpperLog2(size_t number) {
 void FreeListMultiLevelAllocator::Attach(FrontControl* front_control) {
     size_t layer = std::min(static_cast<size_t>(front_control->Get<FCSourceLayer>()), GetLowerLog2(front_control->Get<FCDataSize>()));
     front_control->Set<FCLocalPrev>(nullptr);
-    front_control->Set<FCLocalNext>(nullptr);
+    front_control->Set<FCLocalNext>(layers[layer]);
     if (layers[layer] != nullptr) {
         layers[layer]->Set<FCLocalPrev>(front_control);
     }
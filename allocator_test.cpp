@@ -117,12 +117,44 @@ void RandomAllocationTest() {
     }
 }
 
+// Live blocks are filled with their own byte and checked before they are
+// freed, so a block handed out twice shows up as overwritten.
+void FreeListIntegrityTest() {
+    std::vector<std::pair<char*, size_t>> blocks;
+    size_t overwritten_count = 0;
+    for (int i = 0; i < 100000; ++i) {
+        if (!blocks.empty() && rand() % 2 == 0) {
+            size_t index = rand() % blocks.size();
+            auto [pointer, size] = blocks[index];
+            for (size_t j = 0; j < size; ++j) {
+                if (pointer[j] != static_cast<char>(reinterpret_cast<uintptr_t>(pointer) % 251)) {
+                    ++overwritten_count;
+                    break;
+                }
+            }
+            FixedFreeListMultiLevelAllocator<char>().deallocate(pointer, size);
+            blocks[index] = blocks.back();
+            blocks.pop_back();
+        } else {
+            size_t size = rand() % 300 + 1;
+            char* pointer = FixedFreeListMultiLevelAllocator<char>().allocate(size);
+            memset(pointer, static_cast<char>(reinterpret_cast<uintptr_t>(pointer) % 251), size);
+            blocks.emplace_back(pointer, size);
+        }
+    }
+    for (auto [pointer, size] : blocks) {
+        FixedFreeListMultiLevelAllocator<char>().deallocate(pointer, size);
+    }
+    std::cout << "Overwritten blocks = " << overwritten_count << "\n";
+}
+
 int main() {
     TestWith16Alignment();
     TestWithStdStructs();
     SimpleTest();
     srand(0);
     RandomAllocationTest();
+    FreeListIntegrityTest();
     CrossReferenceTest1();
     CrossReferenceTest2();
     return 0;
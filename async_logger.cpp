@@ -0,0 +1,249 @@
+#include <algorithm>
+#include <chrono>
+#include <utility>
+
+#include "async_logger.h"
+
+const size_t AsyncLogger::default_ring_capacity = 1024;
+const uint64_t AsyncLogger::drain_period = 1e4; // 10ms
+std::atomic<uint64_t> AsyncLogger::loggers_count(0);
+
+AsyncLogger global_logger;
+
+namespace {
+
+// Rings of the current thread, one per logger, abandoned when it exits.
+struct ThreadRings {
+    ~ThreadRings() {
+        for (const auto& thread_ring : rings) {
+            thread_ring.second->Abandon();
+        }
+    }
+
+    std::vector<std::pair<uint64_t, std::shared_ptr<LogRing>>> rings;
+};
+
+thread_local ThreadRings thread_rings;
+
+}
+
+LogRing::LogRing(const size_t capacity)
+    : records(new LogRecord[capacity]),
+      capacity(capacity),
+      head(0),
+      tail(0),
+      dropped_count(0),
+      is_abandoned(false)
+{
+}
+
+LogRecord* LogRing::GetFreeRecord() noexcept {
+    uint64_t current_tail = tail.load(std::memory_order_relaxed);
+    if (current_tail - head.load(std::memory_order_acquire) == capacity) {
+        return nullptr;
+    }
+    return &records[current_tail % capacity];
+}
+
+void LogRing::Push() noexcept {
+    tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+LogRecord* LogRing::GetFront() noexcept {
+    uint64_t current_head = head.load(std::memory_order_relaxed);
+    if (current_head == tail.load(std::memory_order_acquire)) {
+        return nullptr;
+    }
+    return &records[current_head % capacity];
+}
+
+void LogRing::Pop() noexcept {
+    head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+void LogRing::CountDropped() noexcept {
+    dropped_count.fetch_add(1, std::memory_order_relaxed);
+}
+
+uint64_t LogRing::GetDroppedCount() const noexcept {
+    return dropped_count.load(std::memory_order_relaxed);
+}
+
+void LogRing::Abandon() noexcept {
+    is_abandoned.store(true, std::memory_order_release);
+}
+
+bool LogRing::IsAbandoned() const noexcept {
+    return is_abandoned.load(std::memory_order_acquire);
+}
+
+AsyncLogger::AsyncLogger(std::ostream& output, const size_t ring_capacity)
+    : id(++loggers_count),
+      output(output),
+      ring_capacity(std::max(ring_capacity, size_t(1))),
+      rings_mutex(),
+      rings(),
+      retired_dropped_count(0),
+      names_mutex(),
+      names(),
+      name_ids(),
+      drain_mutex(),
+      drained_records(),
+      reported_dropped_count(0),
+      stop_mutex(),
+      stop_cv(),
+      is_stopped(false),
+      drain_thread()
+{
+}
+
+AsyncLogger::~AsyncLogger() {
+    {
+        std::lock_guard<std::mutex> lock(stop_mutex);
+        is_stopped = true;
+    }
+    stop_cv.notify_all();
+    if (drain_thread.joinable()) {
+        drain_thread.join();
+    }
+    Drain();
+}
+
+LogRing* AsyncLogger::GetThreadRing() {
+    for (const auto& thread_ring : thread_rings.rings) {
+        if (thread_ring.first == id) {
+            return thread_ring.second.get();
+        }
+    }
+    try {
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        rings.push_back(std::make_shared<LogRing>(ring_capacity));
+        thread_rings.rings.emplace_back(id, rings.back());
+        if (!drain_thread.joinable()) {
+            drain_thread = std::thread(&AsyncLogger::DrainAction, this);
+        }
+        return rings.back().get();
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void AsyncLogger::DrainAction() noexcept {
+    std::unique_lock<std::mutex> lock(stop_mutex);
+    while (!is_stopped) {
+        stop_cv.wait_for(lock, std::chrono::microseconds(drain_period));
+        lock.unlock();
+        try {
+            Drain();
+        } catch (...) {
+        }
+        lock.lock();
+    }
+}
+
+void AsyncLogger::Drain() {
+    std::lock_guard<std::mutex> drain_lock(drain_mutex);
+    std::vector<LogRing*> current_rings;
+    {
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        for (const auto& ring : rings) {
+            current_rings.push_back(ring.get());
+        }
+    }
+    // A ring abandoned before it is drained gets no records after that.
+    std::vector<LogRing*> drained_abandoned_rings;
+    for (LogRing* ring : current_rings) {
+        bool is_abandoned = ring->IsAbandoned();
+        while (LogRecord* record = ring->GetFront()) {
+            drained_records.push_back(*record);
+            ring->Pop();
+        }
+        if (is_abandoned) {
+            drained_abandoned_rings.push_back(ring);
+        }
+    }
+    uint64_t dropped_count = 0;
+    {
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        for (LogRing* ring : drained_abandoned_rings) {
+            auto retired_ring = std::find_if(rings.begin(), rings.end(),
+                    [ring](const std::shared_ptr<LogRing>& other_ring) { return other_ring.get() == ring; });
+            retired_dropped_count += ring->GetDroppedCount();
+            rings.erase(retired_ring);
+        }
+        dropped_count = retired_dropped_count;
+        for (const auto& ring : rings) {
+            dropped_count += ring->GetDroppedCount();
+        }
+    }
+    std::stable_sort(drained_records.begin(), drained_records.end(), [](const LogRecord& first, const LogRecord& second) {
+        return first.timestamp < second.timestamp;
+    });
+    for (const auto& record : drained_records) {
+        WriteRecord(record);
+    }
+    drained_records.clear();
+    if (dropped_count != reported_dropped_count) {
+        output << "[Logger] : " << dropped_count - reported_dropped_count << " records dropped" << std::endl;
+        reported_dropped_count = dropped_count;
+    }
+    output.flush();
+}
+
+void AsyncLogger::WriteRecord(const LogRecord& record) {
+    size_t argument_index = 0;
+    for (const char* symbol = record.format; *symbol != '\0'; ++symbol) {
+        if (symbol[0] == '{' && symbol[1] == '}' && argument_index < record.arguments_count) {
+            const LogArgument& argument = record.arguments[argument_index++];
+            switch (argument.type) {
+                case LogArgument::Type::Integer:
+                    output << argument.integer;
+                    break;
+                case LogArgument::Type::Real:
+                    output << argument.real;
+                    break;
+                case LogArgument::Type::String:
+                    output << argument.string;
+                    break;
+                case LogArgument::Type::Name: {
+                    std::lock_guard<std::mutex> lock(names_mutex);
+                    output << names[argument.integer];
+                    break;
+                }
+            }
+            ++symbol;
+        } else {
+            output << *symbol;
+        }
+    }
+    output << '\n';
+}
+
+void AsyncLogger::Flush() {
+    Drain();
+}
+
+uint64_t AsyncLogger::GetDroppedCount() const {
+    std::lock_guard<std::mutex> lock(rings_mutex);
+    uint64_t dropped_count = retired_dropped_count;
+    for (const auto& ring : rings) {
+        dropped_count += ring->GetDroppedCount();
+    }
+    return dropped_count;
+}
+
+size_t AsyncLogger::GetRingsCount() const {
+    std::lock_guard<std::mutex> lock(rings_mutex);
+    return rings.size();
+}
+
+LogName AsyncLogger::RegisterName(const std::string& name) {
+    std::lock_guard<std::mutex> lock(names_mutex);
+    auto name_id = name_ids.find(name);
+    if (name_id != name_ids.end()) {
+        return LogName{name_id->second};
+    }
+    names.push_back(name);
+    name_ids.emplace(name, names.size() - 1);
+    return LogName{static_cast<uint32_t>(names.size() - 1)};
+}
@@ -0,0 +1,178 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include "timers.h"
+
+// Name registered with AsyncLogger::RegisterName, looked up only when the
+// record is written out.
+struct LogName {
+    uint32_t id;
+};
+
+struct LogArgument {
+    enum class Type : uint8_t {
+        Integer,
+        Real,
+        String,
+        Name
+    };
+
+    static const size_t max_string_size = 31;
+
+    Type type;
+    union {
+        int64_t integer;
+        double real;
+        char string[max_string_size + 1];
+    };
+};
+
+// Arguments are kept unformatted, longer strings are truncated.
+template <typename T>
+typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type
+SetLogArgument(LogArgument& argument, const T value) noexcept {
+    argument.type = LogArgument::Type::Integer;
+    argument.integer = static_cast<int64_t>(value);
+}
+
+template <typename T>
+typename std::enable_if<std::is_floating_point<T>::value>::type
+SetLogArgument(LogArgument& argument, const T value) noexcept {
+    argument.type = LogArgument::Type::Real;
+    argument.real = value;
+}
+
+inline void SetLogArgument(LogArgument& argument, const char* value) noexcept {
+    argument.type = LogArgument::Type::String;
+    std::strncpy(argument.string, value, LogArgument::max_string_size);
+    argument.string[LogArgument::max_string_size] = '\0';
+}
+
+inline void SetLogArgument(LogArgument& argument, const std::string& value) noexcept {
+    SetLogArgument(argument, value.c_str());
+}
+
+inline void SetLogArgument(LogArgument& argument, const LogName value) noexcept {
+    argument.type = LogArgument::Type::Name;
+    argument.integer = value.id;
+}
+
+struct LogRecord {
+    static const size_t max_arguments_count = 6;
+
+    int64_t timestamp;
+    // Must outlive the logger, string literals are expected.
+    const char* format;
+    size_t arguments_count;
+    LogArgument arguments[max_arguments_count];
+};
+
+// Single producer single consumer ring of records. The producer abandons
+// the ring when its thread exits.
+class LogRing {
+public:
+    explicit LogRing(const size_t capacity);
+    LogRing(const LogRing&) = delete;
+    LogRing& operator=(const LogRing&) = delete;
+
+    // Returns nullptr if the ring is full, the record is published by Push.
+    LogRecord* GetFreeRecord() noexcept;
+    void Push() noexcept;
+    LogRecord* GetFront() noexcept;
+    void Pop() noexcept;
+
+    void CountDropped() noexcept;
+    uint64_t GetDroppedCount() const noexcept;
+    void Abandon() noexcept;
+    bool IsAbandoned() const noexcept;
+private:
+    std::unique_ptr<LogRecord[]> records;
+    size_t capacity;
+    alignas(64) std::atomic<uint64_t> head;
+    alignas(64) std::atomic<uint64_t> tail;
+    std::atomic<uint64_t> dropped_count;
+    std::atomic<bool> is_abandoned;
+};
+
+// Every logging thread writes binary records to a ring of its own, a
+// background thread started with the first record formats them and writes
+// them out in timestamp order. Rings of exited threads are freed once they
+// are drained. Records which do not fit into a full ring are dropped and
+// counted. "{}" in a format is replaced by the next argument.
+class AsyncLogger {
+private:
+    LogRing* GetThreadRing();
+    void DrainAction() noexcept;
+    void Drain();
+    void WriteRecord(const LogRecord& record);
+public:
+    explicit AsyncLogger(std::ostream& output = std::cout, const size_t ring_capacity = default_ring_capacity);
+    AsyncLogger(const AsyncLogger&) = delete;
+    AsyncLogger& operator=(const AsyncLogger&) = delete;
+    ~AsyncLogger();
+
+    template <typename ... Args>
+    void Log(const char* format, const Args& ... args) noexcept {
+        static_assert(sizeof...(Args) <= LogRecord::max_arguments_count, "Too many log arguments");
+        LogRing* ring = GetThreadRing();
+        if (ring == nullptr) {
+            return;
+        }
+        LogRecord* record = ring->GetFreeRecord();
+        if (record == nullptr) {
+            ring->CountDropped();
+            return;
+        }
+        record->timestamp = GetMonotonicTime();
+        record->format = format;
+        record->arguments_count = 0;
+        (SetLogArgument(record->arguments[record->arguments_count++], args), ...);
+        ring->Push();
+    }
+
+    // Registered names are kept as long as the logger, so a name may be
+    // logged by id at the cost of an integer. Registering a name again gives
+    // the same id.
+    LogName RegisterName(const std::string& name);
+
+    // Writes out every record logged before the call.
+    void Flush();
+    uint64_t GetDroppedCount() const;
+    size_t GetRingsCount() const;
+public:
+    static const size_t default_ring_capacity;
+private:
+    static const uint64_t drain_period;
+    static std::atomic<uint64_t> loggers_count;
+    uint64_t id;
+    std::ostream& output;
+    size_t ring_capacity;
+    mutable std::mutex rings_mutex;
+    // Shared with the threads, which abandon their rings on exit.
+    std::vector<std::shared_ptr<LogRing>> rings;
+    uint64_t retired_dropped_count;
+    mutable std::mutex names_mutex;
+    std::vector<std::string> names;
+    std::unordered_map<std::string, uint32_t> name_ids;
+    std::mutex drain_mutex;
+    std::vector<LogRecord> drained_records;
+    uint64_t reported_dropped_count;
+    std::mutex stop_mutex;
+    std::condition_variable stop_cv;
+    bool is_stopped;
+    std::thread drain_thread;
+};
+
+extern AsyncLogger global_logger;
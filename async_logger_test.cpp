@@ -0,0 +1,71 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "async_logger.h"
+
+void TestFormat() {
+    std::ostringstream output;
+    {
+        AsyncLogger logger(output);
+        logger.Log("[Thread {}] : {} = {}, missing {}", 3, std::string("utilization"), 0.5);
+        logger.Log("{}{}", "no gap", 'x' == 'x');
+        logger.Flush();
+        std::cout << output.str();
+    }
+}
+
+void TestThreads() {
+    std::ostringstream output;
+    AsyncLogger logger(output);
+    std::vector<std::thread> threads;
+    for (int thread_num = 0; thread_num < 4; ++thread_num) {
+        threads.emplace_back([&logger, thread_num]() {
+            for (int i = 0; i < 100; ++i) {
+                logger.Log("[Thread {}] : record {}", thread_num, i);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    logger.Flush();
+    std::istringstream lines(output.str());
+    std::string line;
+    size_t lines_count = 0;
+    while (std::getline(lines, line)) {
+        ++lines_count;
+    }
+    std::cout << "Lines from threads = " << lines_count << ", dropped = " << logger.GetDroppedCount()
+        << ", rings left = " << logger.GetRingsCount() << std::endl;
+}
+
+void TestNames() {
+    std::ostringstream output;
+    AsyncLogger logger(output);
+    LogName name = logger.RegisterName("MessageProcessorA#1");
+    logger.Log("taking {} from {}", name, logger.RegisterName("thread"));
+    logger.Flush();
+    std::cout << output.str() << "Same id on registering again = " << (logger.RegisterName("MessageProcessorA#1").id == name.id) << std::endl;
+}
+
+void TestDropped() {
+    std::ostringstream output;
+    AsyncLogger logger(output, 10);
+    for (int i = 0; i < 1000; ++i) {
+        logger.Log("record {}", i);
+    }
+    logger.Flush();
+    std::cout << "Dropped from a small ring = " << (logger.GetDroppedCount() > 0)
+        << ", reported = " << (output.str().find("records dropped") != std::string::npos) << std::endl;
+}
+
+int main() {
+    TestFormat();
+    TestThreads();
+    TestNames();
+    TestDropped();
+    return 0;
+}
@@ -0,0 +1,213 @@
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "checkpoint.h"
+
+namespace {
+
+const char checkpoint_magic[8] = {'R', 'A', 'S', 'T', 'C', 'K', 'P', '1'};
+
+struct CheckpointHeader {
+    char magic[8];
+    uint64_t message_processors_count;
+    uint64_t edges_count;
+};
+
+// Sections of message processors go first, then sections of edges.
+struct SectionEntry {
+    uint64_t offset;
+    uint64_t size;
+};
+
+size_t GetAlignedSize(const size_t size) noexcept {
+    return (size + 7) / 8 * 8;
+}
+
+void ThrowSystemError(const std::string& what) {
+    throw std::system_error(errno, std::generic_category(), what);
+}
+
+void ThrowInvalidCheckpoint(const std::string& what) {
+    throw std::system_error(std::make_error_code(std::errc::invalid_argument), what);
+}
+
+}
+
+void CheckpointWriter::Write(const void* data, const size_t size) {
+    this->data.append(static_cast<const char*>(data), size);
+}
+
+void CheckpointWriter::WriteString(const std::string& value) {
+    Write(static_cast<uint64_t>(value.size()));
+    Write(value.data(), value.size());
+}
+
+const std::string& CheckpointWriter::GetData() const noexcept {
+    return data;
+}
+
+CheckpointReader::CheckpointReader(const char* data, const size_t size) noexcept
+    : data(data),
+      size(size),
+      offset(0)
+{
+}
+
+bool CheckpointReader::Read(void* output, const size_t size) noexcept {
+    if (this->size - offset < size) {
+        return false;
+    }
+    std::memcpy(output, data + offset, size);
+    offset += size;
+    return true;
+}
+
+bool CheckpointReader::ReadString(std::string& value) {
+    uint64_t value_size = 0;
+    size_t start_offset = offset;
+    if (!Read(value_size) || size - offset < value_size) {
+        offset = start_offset;
+        return false;
+    }
+    value.assign(data + offset, value_size);
+    offset += value_size;
+    return true;
+}
+
+bool CheckpointReader::IsFinished() const noexcept {
+    return offset == size;
+}
+
+CheckpointFileWriter::CheckpointFileWriter(const size_t message_processors_count, const size_t edges_count)
+    : message_processor_sections(message_processors_count),
+      edge_sections(edges_count)
+{
+}
+
+CheckpointWriter& CheckpointFileWriter::GetMessageProcessorSection(const int message_processor_index) noexcept {
+    return message_processor_sections[message_processor_index];
+}
+
+CheckpointWriter& CheckpointFileWriter::GetEdgeSection(const int edge_index) noexcept {
+    return edge_sections[edge_index];
+}
+
+void CheckpointFileWriter::Save(const std::string& file_name) const {
+    std::vector<const CheckpointWriter*> sections;
+    for (const auto& section : message_processor_sections) {
+        sections.push_back(&section);
+    }
+    for (const auto& section : edge_sections) {
+        sections.push_back(&section);
+    }
+    size_t size = sizeof(CheckpointHeader) + sections.size() * sizeof(SectionEntry);
+    for (const auto* section : sections) {
+        size += GetAlignedSize(section->GetData().size());
+    }
+    std::string temporary_file_name = file_name + ".tmp";
+    int file_descriptor = open(temporary_file_name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (file_descriptor == -1) {
+        ThrowSystemError("Cannot open checkpoint " + temporary_file_name);
+    }
+    if (ftruncate(file_descriptor, size) == -1) {
+        close(file_descriptor);
+        ThrowSystemError("Cannot resize checkpoint " + temporary_file_name);
+    }
+    void* mapped_data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, file_descriptor, 0);
+    if (mapped_data == MAP_FAILED) {
+        close(file_descriptor);
+        ThrowSystemError("Cannot map checkpoint " + temporary_file_name);
+    }
+    char* data = static_cast<char*>(mapped_data);
+    CheckpointHeader header;
+    std::memcpy(header.magic, checkpoint_magic, sizeof(header.magic));
+    header.message_processors_count = message_processor_sections.size();
+    header.edges_count = edge_sections.size();
+    std::memcpy(data, &header, sizeof(header));
+    size_t offset = sizeof(CheckpointHeader) + sections.size() * sizeof(SectionEntry);
+    for (size_t i = 0; i < sections.size(); ++i) {
+        const std::string& section_data = sections[i]->GetData();
+        SectionEntry entry{offset, section_data.size()};
+        std::memcpy(data + sizeof(CheckpointHeader) + i * sizeof(SectionEntry), &entry, sizeof(entry));
+        std::memcpy(data + offset, section_data.data(), section_data.size());
+        offset += GetAlignedSize(section_data.size());
+    }
+    bool is_synced = msync(data, size, MS_SYNC) == 0;
+    munmap(data, size);
+    close(file_descriptor);
+    if (!is_synced) {
+        ThrowSystemError("Cannot write checkpoint " + temporary_file_name);
+    }
+    if (std::rename(temporary_file_name.c_str(), file_name.c_str()) != 0) {
+        ThrowSystemError("Cannot rename checkpoint to " + file_name);
+    }
+}
+
+CheckpointFile::CheckpointFile(const std::string& file_name) {
+    file_descriptor = open(file_name.c_str(), O_RDONLY);
+    if (file_descriptor == -1) {
+        ThrowSystemError("Cannot open checkpoint " + file_name);
+    }
+    struct stat file_stat;
+    if (fstat(file_descriptor, &file_stat) == -1) {
+        close(file_descriptor);
+        ThrowSystemError("Cannot stat checkpoint " + file_name);
+    }
+    size = file_stat.st_size;
+    if (size < sizeof(CheckpointHeader)) {
+        close(file_descriptor);
+        ThrowInvalidCheckpoint("Truncated checkpoint " + file_name);
+    }
+    void* mapped_data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file_descriptor, 0);
+    if (mapped_data == MAP_FAILED) {
+        close(file_descriptor);
+        ThrowSystemError("Cannot map checkpoint " + file_name);
+    }
+    data = static_cast<const char*>(mapped_data);
+    CheckpointHeader header;
+    std::memcpy(&header, data, sizeof(header));
+    message_processors_count = header.message_processors_count;
+    edges_count = header.edges_count;
+    bool is_valid = std::memcmp(header.magic, checkpoint_magic, sizeof(checkpoint_magic)) == 0 &&
+        (size - sizeof(CheckpointHeader)) / sizeof(SectionEntry) >= message_processors_count + edges_count;
+    for (size_t i = 0; is_valid && i < message_processors_count + edges_count; ++i) {
+        SectionEntry entry;
+        std::memcpy(&entry, data + sizeof(CheckpointHeader) + i * sizeof(SectionEntry), sizeof(entry));
+        is_valid = entry.offset <= size && entry.size <= size - entry.offset;
+    }
+    if (!is_valid) {
+        munmap(const_cast<char*>(data), size);
+        close(file_descriptor);
+        ThrowInvalidCheckpoint("Not a checkpoint " + file_name);
+    }
+}
+
+CheckpointFile::~CheckpointFile() {
+    munmap(const_cast<char*>(data), size);
+    close(file_descriptor);
+}
+
+size_t CheckpointFile::GetMessageProcessorsCount() const noexcept {
+    return message_processors_count;
+}
+
+size_t CheckpointFile::GetEdgesCount() const noexcept {
+    return edges_count;
+}
+
+CheckpointReader CheckpointFile::GetMessageProcessorSection(const int message_processor_index) const noexcept {
+    return GetSection(message_processor_index);
+}
+
+CheckpointReader CheckpointFile::GetEdgeSection(const int edge_index) const noexcept {
+    return GetSection(message_processors_count + edge_index);
+}
+
+CheckpointReader CheckpointFile::GetSection(const size_t section_index) const noexcept {
+    SectionEntry entry;
+    std::memcpy(&entry, data + sizeof(CheckpointHeader) + section_index * sizeof(SectionEntry), sizeof(entry));
+    return CheckpointReader(data + entry.offset, entry.size);
+}
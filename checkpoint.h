@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <vector>
+
+// Appends the state of a message processor or the pending messages of an
+// edge to its section of a checkpoint.
+class CheckpointWriter {
+public:
+    void Write(const void* data, const size_t size);
+    // Prefixed with its size, so it is read back by ReadString.
+    void WriteString(const std::string& value);
+
+    template <typename T>
+    void Write(const T& value) {
+        static_assert(std::is_trivially_copyable_v<T>, "Only trivially copyable values are written as is");
+        Write(&value, sizeof(value));
+    }
+
+    const std::string& GetData() const noexcept;
+private:
+    std::string data;
+};
+
+// Reads a section of a checkpoint back. Reads past the end of the section
+// fail and leave the output untouched.
+class CheckpointReader {
+public:
+    CheckpointReader(const char* data, const size_t size) noexcept;
+
+    bool Read(void* output, const size_t size) noexcept;
+    bool ReadString(std::string& value);
+    bool IsFinished() const noexcept;
+
+    template <typename T>
+    bool Read(T& value) noexcept {
+        static_assert(std::is_trivially_copyable_v<T>, "Only trivially copyable values are read as is");
+        return Read(&value, sizeof(value));
+    }
+private:
+    const char* data;
+    size_t size;
+    size_t offset;
+};
+
+// Collects sections of every message processor and every edge and saves
+// them into one file. The file is written under a temporary name and
+// renamed, so a crash never leaves a partial checkpoint behind.
+class CheckpointFileWriter {
+public:
+    CheckpointFileWriter(const size_t message_processors_count, const size_t edges_count);
+
+    CheckpointWriter& GetMessageProcessorSection(const int message_processor_index) noexcept;
+    CheckpointWriter& GetEdgeSection(const int edge_index) noexcept;
+    // Throws std::system_error if the file can not be written.
+    void Save(const std::string& file_name) const;
+private:
+    std::vector<CheckpointWriter> message_processor_sections;
+    std::vector<CheckpointWriter> edge_sections;
+};
+
+// Memory-mapped checkpoint, sections are read in place by any number of
+// threads.
+class CheckpointFile {
+public:
+    // Throws std::system_error if the file can not be mapped or is not a
+    // checkpoint.
+    explicit CheckpointFile(const std::string& file_name);
+    CheckpointFile(const CheckpointFile&) = delete;
+    CheckpointFile& operator=(const CheckpointFile&) = delete;
+    ~CheckpointFile();
+
+    size_t GetMessageProcessorsCount() const noexcept;
+    size_t GetEdgesCount() const noexcept;
+    CheckpointReader GetMessageProcessorSection(const int message_processor_index) const noexcept;
+    CheckpointReader GetEdgeSection(const int edge_index) const noexcept;
+private:
+    CheckpointReader GetSection(const size_t section_index) const noexcept;
+
+    int file_descriptor;
+    const char* data;
+    size_t size;
+    size_t message_processors_count;
+    size_t edges_count;
+};
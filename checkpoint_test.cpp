@@ -0,0 +1,198 @@
+#include <atomic>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <thread>
+
+#include "checkpoint.h"
+#include "message_passing_tree.h"
+#include "sharder.h"
+
+const int messages_count = 10000;
+
+class CounterMessage : public MessageBase {
+public:
+    CounterMessage(const int value)
+    : value(value)
+    {}
+
+    void Serialize(std::string& output) const {
+        output.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    static std::unique_ptr<CounterMessage> Deserialize(const char* data, const size_t size) {
+        int value = 0;
+        std::memcpy(&value, data, std::min(size, sizeof(value)));
+        return std::make_unique<CounterMessage>(value);
+    }
+
+    int value;
+};
+
+class UnserializableMessage : public MessageBase {};
+
+std::atomic<int> received_count{0};
+std::atomic<int64_t> received_sum{0};
+
+class MessageProcessorConsumer;
+
+class MessageProcessorProducer : public MessageProcessorBase {
+public:
+    using MessageProcessorBase::MessageProcessorBase;
+
+    template <typename Sender>
+    bool Ping(const Sender& sender) {
+        if (next_value == 0) {
+            sender.template Send<MessageProcessorConsumer>(std::make_unique<UnserializableMessage>());
+        }
+        for (int i = 0; i < 10 && next_value < messages_count; ++i) {
+            sender.template Send<MessageProcessorConsumer>(std::make_unique<CounterMessage>(next_value++));
+        }
+        return next_value < messages_count;
+    }
+
+    void Checkpoint(CheckpointWriter& writer) const {
+        writer.Write(next_value);
+    }
+
+    void Restore(CheckpointReader& reader) {
+        reader.Read(next_value);
+    }
+
+    int next_value = 0;
+};
+
+class MessageProcessorConsumer : public MessageProcessorBase {
+public:
+    using MessageProcessorBase::MessageProcessorBase;
+
+    template <typename Sender>
+    bool Ping(const Sender&) {
+        return false;
+    }
+
+    template <typename Sender>
+    void Receive(const ReceivingFrom<MessageProcessorProducer>&, const CounterMessage& message, const Sender&) {
+        sum += message.value;
+        received_sum.store(sum);
+        received_count.store(++count);
+    }
+
+    template <typename Sender>
+    void Receive(const ReceivingFrom<MessageProcessorProducer>&, const UnserializableMessage&, const Sender&) {
+    }
+
+    void Checkpoint(CheckpointWriter& writer) const {
+        writer.Write(count);
+        writer.Write(sum);
+        writer.WriteString(name);
+    }
+
+    void Restore(CheckpointReader& reader) {
+        reader.Read(count);
+        reader.Read(sum);
+        reader.ReadString(name);
+        received_sum.store(sum);
+        received_count.store(count);
+    }
+
+    int count = 0;
+    int64_t sum = 0;
+    std::string name;
+};
+
+void TestSections() {
+    CheckpointFileWriter writer(1, 1);
+    writer.GetMessageProcessorSection(0).Write(42);
+    writer.GetMessageProcessorSection(0).WriteString("state");
+    writer.GetEdgeSection(0).WriteString("message");
+    writer.Save("checkpoint_test.bin");
+    CheckpointFile checkpoint("checkpoint_test.bin");
+    CheckpointReader reader = checkpoint.GetMessageProcessorSection(0);
+    int value = 0;
+    std::string text;
+    bool is_read = reader.Read(value) && reader.ReadString(text);
+    std::cout << "Value = " << value << ", text = " << text << ", read = " << is_read << ", finished = " << reader.IsFinished() <<
+        ", read past the end = " << reader.Read(value) << std::endl;
+    CheckpointReader edge_reader = checkpoint.GetEdgeSection(0);
+    edge_reader.ReadString(text);
+    std::cout << "Edge message = " << text << std::endl;
+    try {
+        CheckpointFile not_checkpoint("checkpoint_test.cpp");
+    } catch (const std::system_error& error) {
+        std::cout << "Source file rejected: " << error.what() << std::endl;
+    }
+    std::remove("checkpoint_test.bin");
+}
+
+// The last edge gets index 0.
+using TestTree = MessagePassingTree<
+    Edge<MessageProcessorProducer, MessageProcessorConsumer, UnserializableMessage>,
+    Edge<MessageProcessorProducer, MessageProcessorConsumer, CounterMessage>>;
+
+void TestTreeCheckpoint() {
+    CheckpointFileWriter writer(2, 2);
+    {
+        TestTree message_passing_tree;
+        message_passing_tree.GetMessageProcessorProxy(0)->Ping();
+        message_passing_tree.GetEdgeProxy(0)->NotifyAboutMessage();
+        std::cout << "Lost messages = " << message_passing_tree.WriteCheckpoint(writer) << std::endl;
+    }
+    writer.Save("checkpoint_test.bin");
+    CheckpointFile checkpoint("checkpoint_test.bin");
+    TestTree message_passing_tree;
+    message_passing_tree.RestoreMessageProcessor(0, checkpoint);
+    message_passing_tree.RestoreMessageProcessor(1, checkpoint);
+    int restored_count = received_count.load();
+    int delivered_count = 0;
+    while (message_passing_tree.GetEdgeProxy(0)->NotifyAboutMessage()) {
+        ++delivered_count;
+    }
+    std::cout << "Restored received = " << restored_count << ", delivered after restore = " << delivered_count <<
+        ", total received = " << received_count.load() << std::endl;
+    std::remove("checkpoint_test.bin");
+}
+
+using TestPool = DynamicallyShardedMessagePassingPool<
+    Edge<MessageProcessorProducer, MessageProcessorConsumer, CounterMessage>,
+    Edge<MessageProcessorProducer, MessageProcessorConsumer, UnserializableMessage>>;
+
+// Stops the pool once the consumer has got the messages count or after 10s.
+void RunUntil(TestPool& pool, const int count, const std::string& checkpoint_file_name, bool* is_checkpoint_written) {
+    std::thread stopper([&] {
+        for (int i = 0; i < 10000 && received_count.load() < count; ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        if (!checkpoint_file_name.empty()) {
+            *is_checkpoint_written = pool.Checkpoint(checkpoint_file_name);
+        }
+        pool.Stop();
+    });
+    pool.Run();
+    stopper.join();
+}
+
+void TestPoolRestart() {
+    SharderOptions options;
+    options.threads_count = 2;
+    bool is_checkpoint_written = false;
+    received_count.store(0);
+    {
+        TestPool pool(options);
+        RunUntil(pool, messages_count / 10, "checkpoint_test.bin", &is_checkpoint_written);
+    }
+    received_count.store(0);
+    TestPool pool(options);
+    pool.Restore("checkpoint_test.bin");
+    RunUntil(pool, messages_count, "", nullptr);
+    std::cout << "Checkpoint written = " << is_checkpoint_written << ", received after restart = " << received_count.load() <<
+        ", sum is intact = " << (received_sum.load() == static_cast<int64_t>(messages_count) * (messages_count - 1) / 2) << std::endl;
+    std::remove("checkpoint_test.bin");
+}
+
+int main() {
+    TestSections();
+    TestTreeCheckpoint();
+    TestPoolRestart();
+    return 0;
+}
@@ -0,0 +1,86 @@
+#include <cerrno>
+#include <sys/mman.h>
+#include <system_error>
+#include <unistd.h>
+
+#include "coroutine.h"
+
+const size_t Coroutine::default_stack_size = 65536; // 64KB
+
+namespace {
+thread_local Coroutine* starting_coroutine = nullptr;
+}
+
+Coroutine::Coroutine(std::function<void()>&& body, const size_t stack_size)
+    : body(std::move(body)),
+      stack(nullptr),
+      mapped_size(0),
+      is_started(false),
+      is_finished(false),
+      is_unwinding(false)
+{
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    mapped_size = (stack_size + page_size - 1) / page_size * page_size + page_size;
+    void* mapped_stack = mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if (mapped_stack == MAP_FAILED) {
+        throw std::system_error(errno, std::generic_category(), "Cannot map coroutine stack");
+    }
+    stack = static_cast<char*>(mapped_stack);
+    if (mprotect(stack, page_size, PROT_NONE) == -1) {
+        int error = errno;
+        munmap(stack, mapped_size);
+        throw std::system_error(error, std::generic_category(), "Cannot protect coroutine stack");
+    }
+}
+
+Coroutine::~Coroutine() noexcept {
+    if (is_started && !is_finished) {
+        is_unwinding = true;
+        swapcontext(&caller_context, &coroutine_context);
+    }
+    munmap(stack, mapped_size);
+}
+
+void Coroutine::Run() noexcept {
+    Coroutine* coroutine = starting_coroutine;
+    try {
+        coroutine->body();
+    } catch (const Unwinding&) {
+    } catch (...) {
+        coroutine->exception = std::current_exception();
+    }
+    coroutine->is_finished = true;
+    setcontext(&coroutine->caller_context);
+}
+
+void Coroutine::Resume() {
+    if (is_finished) {
+        return;
+    }
+    if (!is_started) {
+        getcontext(&coroutine_context);
+        coroutine_context.uc_stack.ss_sp = stack;
+        coroutine_context.uc_stack.ss_size = mapped_size;
+        coroutine_context.uc_link = nullptr;
+        makecontext(&coroutine_context, &Coroutine::Run, 0);
+        starting_coroutine = this;
+        is_started = true;
+    }
+    swapcontext(&caller_context, &coroutine_context);
+    if (exception) {
+        std::exception_ptr thrown_exception = exception;
+        exception = nullptr;
+        std::rethrow_exception(thrown_exception);
+    }
+}
+
+void Coroutine::Yield() {
+    swapcontext(&coroutine_context, &caller_context);
+    if (is_unwinding) {
+        throw Unwinding();
+    }
+}
+
+bool Coroutine::IsFinished() const noexcept {
+    return is_finished;
+}
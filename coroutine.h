@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <ucontext.h>
+
+// Stackful coroutine. The stack is mapped on its own with a guard page below
+// it, so the coroutine may be resumed and destroyed by a thread other than
+// the one which started it. Exceptions escaping the body are rethrown by
+// Resume.
+//
+// A coroutine destroyed while suspended is resumed once more, and its Yield
+// throws an exception of a private type, so objects of the body are
+// destroyed. The body must let the exception through.
+//
+// The body may continue on another thread after a Yield, while compiled code
+// may keep the address of a thread-local object in a register across the
+// call. The body must not keep thread-local objects across a Yield, and
+// functions it reaches which return them must not be inlined, like
+// GetInlineMessages.
+class Coroutine {
+private:
+    struct Unwinding {};
+
+    static void Run() noexcept;
+public:
+    // Throws std::system_error if the stack can not be mapped.
+    explicit Coroutine(std::function<void()>&& body, const size_t stack_size = default_stack_size);
+    Coroutine(const Coroutine&) = delete;
+    Coroutine& operator=(const Coroutine&) = delete;
+    ~Coroutine() noexcept;
+
+    void Resume();
+    void Yield();
+    bool IsFinished() const noexcept;
+public:
+    static const size_t default_stack_size;
+private:
+    std::function<void()> body;
+    // The guard page is included.
+    char* stack;
+    size_t mapped_size;
+    ucontext_t caller_context;
+    ucontext_t coroutine_context;
+    bool is_started;
+    bool is_finished;
+    bool is_unwinding;
+    std::exception_ptr exception;
+};
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <memory>
+#include <algorithm>
+#include <deque>
+#include <limits>
+
+#include "coroutine.h"
+#include "message_passing_tree.h"
+#include "types.h"
+
+// Message processor written as a sequential body:
+//
+//     template <typename Context>
+//     void Run(Context& context);
+//
+// The body waits for messages, timeouts and send capacity through the context.
+// It is resumed only from Ping and Receive, so it always runs on the thread
+// owning the shard at that moment. Delivered messages are copied, into a
+// mailbox if nobody waits for them. A reference returned by an await is valid
+// until the next await.
+// A body suspended when the message processor is destroyed is unwound after
+// the members of the derived class are gone, so destructors of its objects
+// must neither use them nor send.
+// Derived classes must not declare their own Ping or Receive.
+template <typename Derived>
+class CoroutineMessageProcessor : public MessageProcessorBase {
+private:
+    struct PendingMessage {
+        const void* key;
+        std::unique_ptr<MessageBase> message;
+    };
+
+    template <typename From, typename Message>
+    static const void* GetAwaitKey() noexcept {
+        static const char key = 0;
+        return &key;
+    }
+
+    template <typename Sender>
+    void Resume(const Sender& sender) {
+        current_sender = &sender;
+        coroutine->Resume();
+        current_sender = nullptr;
+    }
+public:
+    template <typename Sender>
+    class Context {
+    public:
+        explicit Context(CoroutineMessageProcessor& message_processor) noexcept
+        : message_processor(message_processor)
+        {}
+
+        const Sender& GetSender() const noexcept {
+            return *static_cast<const Sender*>(message_processor.current_sender);
+        }
+
+        template <typename To, typename Message>
+        void Send(std::unique_ptr<Message>&& message) const {
+            GetSender().template Send<To>(std::move(message));
+        }
+
+        // Suspends while the edge is full.
+        template <typename To, typename Message>
+        void SendWhenPossible(std::unique_ptr<Message>&& message) {
+            while (!GetSender().template TrySend<To>(message)) {
+                message_processor.is_waiting_for_capacity = true;
+                message_processor.coroutine->Yield();
+                message_processor.is_waiting_for_capacity = false;
+            }
+        }
+
+        template <typename From, typename Message>
+        const Message& Await() {
+            return *AwaitFor<From, Message>(std::numeric_limits<int64_t>::max());
+        }
+
+        // Returns nullptr if no message has arrived within the timeout.
+        template <typename From, typename Message>
+        const Message* AwaitFor(const int64_t timeout) {
+            auto& mp = message_processor;
+            mp.held_message.reset();
+            const void* key = GetAwaitKey<From, Message>();
+            auto pending_message = std::find_if(mp.mailbox.begin(), mp.mailbox.end(),
+                    [key](const PendingMessage& message) { return message.key == key; });
+            if (pending_message != mp.mailbox.end()) {
+                mp.held_message = std::move(pending_message->message);
+                mp.mailbox.erase(pending_message);
+                return static_cast<const Message*>(mp.held_message.get());
+            }
+            bool has_timeout = timeout != std::numeric_limits<int64_t>::max();
+            if (has_timeout) {
+                SetWakeUpTimer(timeout);
+            }
+            mp.awaited_key = key;
+            mp.delivered_message = nullptr;
+            mp.coroutine->Yield();
+            mp.awaited_key = nullptr;
+            if (has_timeout) {
+                ResetWakeUpTimer();
+            }
+            return static_cast<const Message*>(mp.delivered_message);
+        }
+
+        void Sleep(const int64_t duration) {
+            SetWakeUpTimer(duration);
+            message_processor.coroutine->Yield();
+            ResetWakeUpTimer();
+        }
+    private:
+        void SetWakeUpTimer(const int64_t delay) {
+            message_processor.wake_up_timer_id = GetSender().WakeUpAfter(delay);
+            message_processor.has_wake_up_timer = true;
+        }
+
+        void ResetWakeUpTimer() {
+            GetSender().CancelTimer(message_processor.wake_up_timer_id);
+            message_processor.has_wake_up_timer = false;
+        }
+
+        CoroutineMessageProcessor& message_processor;
+    };
+
+    CoroutineMessageProcessor() noexcept
+    : current_sender(nullptr)
+    , awaited_key(nullptr)
+    , delivered_message(nullptr)
+    , is_waiting_for_capacity(false)
+    , has_wake_up_timer(false)
+    , wake_up_timer_id(0)
+    {}
+
+    template <typename Sender>
+    bool Ping(const Sender& sender) {
+        if (!coroutine) {
+            coroutine = std::make_unique<Coroutine>([this]() {
+                Context<Sender> context(*this);
+                static_cast<Derived*>(this)->Run(context);
+            });
+        } else if (coroutine->IsFinished() ||
+                !(is_waiting_for_capacity || (has_wake_up_timer && !sender.IsTimerPending(wake_up_timer_id)))) {
+            return false;
+        }
+        Resume(sender);
+        return true;
+    }
+
+    template <typename From, typename Message, typename Sender>
+    void Receive(const ReceivingFrom<From>&, const Message& message, const Sender& sender) {
+        const void* key = GetAwaitKey<From, Message>();
+        if (coroutine && !coroutine->IsFinished() && awaited_key == key) {
+            held_message = std::make_unique<Message>(message);
+            delivered_message = held_message.get();
+            Resume(sender);
+        } else {
+            mailbox.push_back(PendingMessage{key, std::make_unique<Message>(message)});
+        }
+    }
+
+    bool IsFinished() const noexcept {
+        return coroutine && coroutine->IsFinished();
+    }
+
+    virtual ~CoroutineMessageProcessor() noexcept {
+        coroutine.reset();
+    }
+private:
+    std::unique_ptr<Coroutine> coroutine;
+    const void* current_sender;
+    const void* awaited_key;
+    const MessageBase* delivered_message;
+    std::unique_ptr<MessageBase> held_message;
+    // Pushed and erased by whichever thread owns the shard, so it stays off
+    // the thread-local allocator.
+    std::deque<PendingMessage> mailbox;
+    bool is_waiting_for_capacity;
+    bool has_wake_up_timer;
+    uint64_t wake_up_timer_id;
+};
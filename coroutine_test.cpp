@@ -0,0 +1,128 @@
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+
+#include "coroutine.h"
+#include "coroutine_message_processor.h"
+
+void TestCoroutine() {
+    Vector<int> steps;
+    Coroutine* current_coroutine = nullptr;
+    Coroutine coroutine([&]() {
+        for (int i = 0; i < 3; ++i) {
+            steps.push_back(i);
+            current_coroutine->Yield();
+        }
+    });
+    current_coroutine = &coroutine;
+    std::thread other_thread([&]() {
+        coroutine.Resume();
+    });
+    other_thread.join();
+    while (!coroutine.IsFinished()) {
+        coroutine.Resume();
+    }
+    std::cout << "Coroutine steps:";
+    for (int step : steps) {
+        std::cout << " " << step;
+    }
+    std::cout << std::endl;
+
+    Coroutine failing_coroutine([]() {
+        throw std::runtime_error("failure inside coroutine");
+    });
+    try {
+        failing_coroutine.Resume();
+    } catch (const std::exception& exception) {
+        std::cout << "Caught: " << exception.what() << ", finished = " << failing_coroutine.IsFinished() << std::endl;
+    }
+}
+
+class Request : public MessageBase {
+public:
+    Request(const int value)
+    : value(value)
+    {}
+    int value;
+};
+
+class Reply : public MessageBase {
+public:
+    Reply(const int value)
+    : value(value)
+    {}
+    int value;
+};
+
+class MessageProcessorServer;
+
+class MessageProcessorClient : public CoroutineMessageProcessor<MessageProcessorClient> {
+public:
+    template <typename Context>
+    void Run(Context& context) {
+        for (int i = 1; i <= 3; ++i) {
+            context.template Send<MessageProcessorServer>(std::make_unique<Request>(i));
+            const Reply& first_reply = context.template Await<MessageProcessorServer, Reply>();
+            std::cout << "Client: got reply " << first_reply.value << std::endl;
+            const Reply& second_reply = context.template Await<MessageProcessorServer, Reply>();
+            std::cout << "Client: got reply " << second_reply.value << std::endl;
+        }
+        const Reply* reply = context.template AwaitFor<MessageProcessorServer, Reply>(1000);
+        std::cout << "Client: timed out = " << (reply == nullptr) << std::endl;
+    }
+};
+
+bool is_server_unwound = false;
+
+class ServerUnwindingMarker {
+public:
+    ~ServerUnwindingMarker() {
+        is_server_unwound = true;
+    }
+};
+
+// Never finishes, it is unwound when the tree is destroyed.
+class MessageProcessorServer : public CoroutineMessageProcessor<MessageProcessorServer> {
+public:
+    template <typename Context>
+    void Run(Context& context) {
+        ServerUnwindingMarker marker;
+        while (true) {
+            int value = context.template Await<MessageProcessorClient, Request>().value;
+            context.Sleep(500);
+            context.template SendWhenPossible<MessageProcessorClient>(std::make_unique<Reply>(value * 10));
+            context.template SendWhenPossible<MessageProcessorClient>(std::make_unique<Reply>(value * 10 + 1));
+        }
+    }
+};
+
+void TestCoroutineMessageProcessor() {
+    {
+        MessagePassingTree<
+            Edge<MessageProcessorClient, MessageProcessorServer, Request>,
+            Edge<MessageProcessorServer, MessageProcessorClient, Reply, 1>> message_passing_tree;
+
+        int client_index = message_passing_tree.GetMessageProcessorIndexImpl(TypeSpecifier<MessageProcessorClient>());
+        auto& client = message_passing_tree.GetMessageProcessorProxy(client_index)->GetMessageProcessor<MessageProcessorClient>();
+        int64_t finish_time = GetMonotonicTime() + 5000000;
+        while (!client.IsFinished() && GetMonotonicTime() < finish_time) {
+            int64_t current_time = GetMonotonicTime();
+            for (int i = 0; i < static_cast<int>(message_passing_tree.GetMessageProcessorsCount()); ++i) {
+                message_passing_tree.AdvanceTimers(i, current_time);
+                message_passing_tree.GetMessageProcessorProxy(i)->Ping();
+            }
+            for (size_t i = 0; i < message_passing_tree.GetEdgesCount(); ++i) {
+                message_passing_tree.GetEdgeProxy(i)->NotifyAboutMessage();
+            }
+        }
+        std::cout << "Client finished = " << client.IsFinished() << ", server unwound before destruction = " <<
+            is_server_unwound << std::endl;
+    }
+    std::cout << "Suspended server unwound = " << is_server_unwound << std::endl;
+}
+
+int main() {
+    TestCoroutine();
+    TestCoroutineMessageProcessor();
+    return 0;
+}
@@ -0,0 +1,165 @@
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "cpu_topology.h"
+
+const char* const CpuTopology::default_nodes_path = "/sys/devices/system/node";
+
+namespace {
+
+const int move_pages_flags = 2; // MPOL_MF_MOVE
+
+bool ReadFirstLine(const std::string& file_name, std::string& line) {
+    std::ifstream file(file_name);
+    return file && std::getline(file, line);
+}
+
+}
+
+Vector<int> ParseCpuList(const std::string& cpu_list) {
+    Vector<int> cpus;
+    std::istringstream ranges(cpu_list);
+    std::string range;
+    while (std::getline(ranges, range, ',')) {
+        if (range.find_first_not_of(" \n") == std::string::npos) {
+            continue;
+        }
+        size_t dash = range.find('-');
+        size_t first_end = 0;
+        size_t last_end = 0;
+        int first_cpu = 0;
+        int last_cpu = 0;
+        try {
+            first_cpu = std::stoi(range.substr(0, dash), &first_end);
+            last_cpu = dash == std::string::npos ? first_cpu : std::stoi(range.substr(dash + 1), &last_end);
+        } catch (const std::logic_error&) {
+            throw std::invalid_argument("Bad CPU range \"" + range + "\"");
+        }
+        if (first_cpu < 0 || last_cpu < first_cpu) {
+            throw std::invalid_argument("Bad CPU range \"" + range + "\"");
+        }
+        for (int cpu = first_cpu; cpu <= last_cpu; ++cpu) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+CpuTopology::CpuTopology(Vector<Vector<int>>&& node_cpus) noexcept
+    : node_cpus(std::move(node_cpus))
+{
+}
+
+CpuTopology CpuTopology::ReadFromSysfs(const std::string& nodes_path) {
+    Vector<Vector<int>> node_cpus;
+    std::string online_nodes;
+    if (ReadFirstLine(nodes_path + "/online", online_nodes)) {
+        for (int node : ParseCpuList(online_nodes)) {
+            std::string cpu_list;
+            if (ReadFirstLine(nodes_path + "/node" + std::to_string(node) + "/cpulist", cpu_list)) {
+                Vector<int> cpus = ParseCpuList(cpu_list);
+                if (!cpus.empty()) {
+                    node_cpus.push_back(std::move(cpus));
+                }
+            }
+        }
+    }
+    if (node_cpus.empty()) {
+        node_cpus.emplace_back();
+        for (int cpu = 0; cpu < static_cast<int>(std::max(1u, std::thread::hardware_concurrency())); ++cpu) {
+            node_cpus.back().push_back(cpu);
+        }
+    }
+    return CpuTopology(std::move(node_cpus));
+}
+
+CpuTopology CpuTopology::Parse(const std::string& description) {
+    Vector<Vector<int>> node_cpus;
+    std::istringstream nodes(description);
+    std::string cpu_list;
+    while (std::getline(nodes, cpu_list, ';')) {
+        node_cpus.push_back(ParseCpuList(cpu_list));
+        if (node_cpus.back().empty()) {
+            throw std::invalid_argument("Empty NUMA node in \"" + description + "\"");
+        }
+    }
+    if (node_cpus.empty()) {
+        throw std::invalid_argument("Empty topology description");
+    }
+    return CpuTopology(std::move(node_cpus));
+}
+
+size_t CpuTopology::GetNodesCount() const noexcept {
+    return node_cpus.size();
+}
+
+size_t CpuTopology::GetCpusCount() const noexcept {
+    size_t cpus_count = 0;
+    for (const auto& cpus : node_cpus) {
+        cpus_count += cpus.size();
+    }
+    return cpus_count;
+}
+
+const Vector<int>& CpuTopology::GetNodeCpus(const int node) const noexcept {
+    return node_cpus[node];
+}
+
+int CpuTopology::GetCpuNode(const int cpu) const noexcept {
+    for (int node = 0; node < static_cast<int>(node_cpus.size()); ++node) {
+        if (std::find(node_cpus[node].begin(), node_cpus[node].end(), cpu) != node_cpus[node].end()) {
+            return node;
+        }
+    }
+    return -1;
+}
+
+Vector<int> CpuTopology::GetThreadCpus(const int threads_count) const {
+    Vector<int> cpus;
+    for (const auto& one_node_cpus : node_cpus) {
+        cpus.insert(cpus.end(), one_node_cpus.begin(), one_node_cpus.end());
+    }
+    Vector<int> thread_cpus;
+    for (int thread_num = 0; thread_num < threads_count; ++thread_num) {
+        thread_cpus.push_back(cpus[static_cast<size_t>(thread_num) * cpus.size() / threads_count]);
+    }
+    return thread_cpus;
+}
+
+bool PinCurrentThread(const int cpu) noexcept {
+    if (cpu < 0 || cpu >= CPU_SETSIZE) {
+        return false;
+    }
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(cpu, &cpu_set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set) == 0;
+}
+
+bool LowerCurrentThreadPriority() noexcept {
+    sched_param param;
+    param.sched_priority = 0;
+    return pthread_setschedparam(pthread_self(), SCHED_IDLE, &param) == 0;
+}
+
+bool MoveMemoryToNode(const void* address, const size_t size, const int node) noexcept {
+    uintptr_t page_size = sysconf(_SC_PAGESIZE);
+    uintptr_t begin = reinterpret_cast<uintptr_t>(address) / page_size * page_size;
+    uintptr_t end = reinterpret_cast<uintptr_t>(address) + size;
+    Vector<void*> pages;
+    for (uintptr_t page = begin; page < end; page += page_size) {
+        pages.push_back(reinterpret_cast<void*>(page));
+    }
+    Vector<int> nodes(pages.size(), node);
+    Vector<int> statuses(pages.size());
+    return syscall(SYS_move_pages, 0, pages.size(), pages.data(), nodes.data(), statuses.data(), move_pages_flags) == 0;
+}
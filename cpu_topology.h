@@ -0,0 +1,43 @@
+#pragma once
+
+#include <string>
+
+#include "types.h"
+
+// Logical CPUs grouped by NUMA node.
+class CpuTopology {
+public:
+    // Reads the online nodes and their cpulist files. Without them all
+    // hardware threads are put into one node.
+    static CpuTopology ReadFromSysfs(const std::string& nodes_path = default_nodes_path);
+    // Nodes are separated by ';' and list their CPUs in the sysfs cpulist
+    // format, e.g. "0-3,8-11;4-7,12-15".
+    static CpuTopology Parse(const std::string& description);
+
+    size_t GetNodesCount() const noexcept;
+    size_t GetCpusCount() const noexcept;
+    const Vector<int>& GetNodeCpus(const int node) const noexcept;
+    // Returns -1 for CPUs which are not in the topology.
+    int GetCpuNode(const int cpu) const noexcept;
+    // Threads fill nodes one by one in proportion to their CPUs, so threads
+    // with close numbers share a node.
+    Vector<int> GetThreadCpus(const int threads_count) const;
+public:
+    static const char* const default_nodes_path;
+private:
+    explicit CpuTopology(Vector<Vector<int>>&& node_cpus) noexcept;
+
+    Vector<Vector<int>> node_cpus;
+};
+
+// Parses lists like "0-3,8,10-11", throws std::invalid_argument.
+Vector<int> ParseCpuList(const std::string& cpu_list);
+
+bool PinCurrentThread(const int cpu) noexcept;
+
+// The thread then runs only when CPUs have nothing else to do.
+bool LowerCurrentThreadPriority() noexcept;
+
+// Migrates every page touching the range, pages shared with other objects
+// included. Fails where page migration is not supported.
+bool MoveMemoryToNode(const void* address, const size_t size, const int node) noexcept;
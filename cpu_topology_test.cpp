@@ -0,0 +1,74 @@
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cpu_topology.h"
+#include "graph_partitioner.h"
+
+void PrintCpus(const std::string& name, const Vector<int>& cpus) {
+    std::cout << name << ":";
+    for (int cpu : cpus) {
+        std::cout << " " << cpu;
+    }
+    std::cout << std::endl;
+}
+
+void TestParse() {
+    PrintCpus("Cpu list", ParseCpuList("0-2,5,7-8\n"));
+    CpuTopology topology = CpuTopology::Parse("0-3,8-11;4-7,12-15");
+    std::cout << "Nodes = " << topology.GetNodesCount() << ", cpus = " << topology.GetCpusCount()
+        << ", node of cpu 9 = " << topology.GetCpuNode(9) << ", node of cpu 16 = " << topology.GetCpuNode(16) << std::endl;
+    PrintCpus("Thread cpus for 4 threads", topology.GetThreadCpus(4));
+    PrintCpus("Thread cpus for 3 threads", CpuTopology::Parse("0-3;4-7").GetThreadCpus(3));
+    try {
+        CpuTopology::Parse("0-3;;4-7");
+    } catch (const std::invalid_argument& exception) {
+        std::cout << "Caught: " << exception.what() << std::endl;
+    }
+}
+
+void TestReadFromSysfs() {
+    char nodes_path[] = "/tmp/cpu_topology_test_XXXXXX";
+    if (mkdtemp(nodes_path) == nullptr) {
+        throw std::runtime_error("Can not create a temporary directory");
+    }
+    std::string path = nodes_path;
+    std::ofstream(path + "/online") << "0,2\n";
+    for (const auto& [node, cpu_list] : {std::make_pair(0, "0-1"), std::make_pair(2, "2-3")}) {
+        std::string node_path = path + "/node" + std::to_string(node);
+        mkdir(node_path.c_str(), 0755);
+        std::ofstream(node_path + "/cpulist") << cpu_list << "\n";
+    }
+    CpuTopology topology = CpuTopology::ReadFromSysfs(path);
+    std::cout << "Sysfs nodes = " << topology.GetNodesCount() << ", node of cpu 3 = " << topology.GetCpuNode(3) << std::endl;
+    std::system(("rm -r " + path).c_str());
+    CpuTopology missing_topology = CpuTopology::ReadFromSysfs("/nonexistent");
+    std::cout << "Missing sysfs nodes = " << missing_topology.GetNodesCount() << std::endl;
+}
+
+void TestCrossNodeCost() {
+    WeightedGraph graph(4);
+    graph.AddEdge(0, 1, 10);
+    graph.AddEdge(2, 3, 10);
+    graph.AddEdge(1, 2, 1);
+    PartitionCostModel cost_model;
+    cost_model.part_nodes = {0, 0, 1, 1};
+    cost_model.cross_node_edge_factor = 3;
+    Vector<int> same_node_parts = {0, 0, 1, 1};
+    Vector<int> cross_node_parts = {0, 2, 1, 3};
+    std::cout << "Cost within nodes = " << GetPartitionCost(graph, same_node_parts, 4, cost_model)
+        << ", across nodes = " << GetPartitionCost(graph, cross_node_parts, 4, cost_model) << std::endl;
+}
+
+int main() {
+    TestParse();
+    TestReadFromSysfs();
+    TestCrossNodeCost();
+    std::cout << "Pinned to cpu 0 = " << PinCurrentThread(0) << std::endl;
+    std::cout << "Lowered priority = " << LowerCurrentThreadPriority() << std::endl;
+    return 0;
+}
@@ -0,0 +1,556 @@
+#include <algorithm>
+#include <limits>
+#include <numeric>
+#include <queue>
+#include <random>
+#include <tuple>
+
+#include "graph_partitioner.h"
+
+const double GreedyGraphPartitioner::default_max_imbalance = 0.05;
+const double MultilevelGraphPartitioner::default_max_imbalance = 0.05;
+const size_t MultilevelGraphPartitioner::min_coarse_vertices_per_part = 16;
+const double MultilevelGraphPartitioner::min_coarsening_ratio = 0.95;
+const int MultilevelGraphPartitioner::max_refinement_passes = 16;
+const size_t MultilevelGraphPartitioner::max_unprofitable_moves = 100;
+
+namespace {
+
+int64_t GetMaxPartWeight(const WeightedGraph& graph, const int parts_count, const double max_imbalance) noexcept {
+    int64_t average_weight = (graph.GetTotalVertexWeight() + parts_count - 1) / parts_count;
+    return std::max(static_cast<int64_t>(average_weight * (1 + max_imbalance)), int64_t(1));
+}
+
+Vector<int64_t> GetPartWeights(const WeightedGraph& graph, const Vector<int>& parts, const int parts_count) {
+    Vector<int64_t> part_weights(parts_count, 0);
+    for (int vertex = 0; vertex < static_cast<int>(graph.GetVerticesCount()); ++vertex) {
+        part_weights[parts[vertex]] += graph.GetVertexWeight(vertex);
+    }
+    return part_weights;
+}
+
+// Accumulates connection weight of one vertex to every part.
+class PartConnections {
+public:
+    explicit PartConnections(const int parts_count)
+        : connections(parts_count, 0),
+          touched_parts()
+    {
+    }
+
+    void Collect(const WeightedGraph& graph, const Vector<int>& parts, const int vertex) {
+        for (int part : touched_parts) {
+            connections[part] = 0;
+        }
+        touched_parts.clear();
+        for (const auto& [neighbour, weight] : graph.GetNeighbours(vertex)) {
+            int part = parts[neighbour];
+            if (part == -1) {
+                continue;
+            }
+            if (connections[part] == 0) {
+                touched_parts.push_back(part);
+            }
+            connections[part] += weight;
+        }
+    }
+
+    int64_t Get(const int part) const noexcept {
+        return connections[part];
+    }
+
+    const Vector<int>& GetTouchedParts() const noexcept {
+        return touched_parts;
+    }
+private:
+    Vector<int64_t> connections;
+    Vector<int> touched_parts;
+};
+
+Vector<int> PartitionGreedily(const WeightedGraph& graph, const int parts_count, const int64_t max_part_weight) {
+    int vertices_count = graph.GetVerticesCount();
+    Vector<int> order(vertices_count);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&graph](const int first, const int second) {
+        return graph.GetVertexWeight(first) > graph.GetVertexWeight(second);
+    });
+    Vector<int> parts(vertices_count, -1);
+    Vector<int64_t> part_weights(parts_count, 0);
+    PartConnections connections(parts_count);
+    for (int vertex : order) {
+        int64_t weight = graph.GetVertexWeight(vertex);
+        connections.Collect(graph, parts, vertex);
+        int best_part = -1;
+        for (int part : connections.GetTouchedParts()) {
+            if (part_weights[part] + weight <= max_part_weight && (best_part == -1 ||
+                        connections.Get(part) > connections.Get(best_part) ||
+                        (connections.Get(part) == connections.Get(best_part) && part_weights[part] < part_weights[best_part]))) {
+                best_part = part;
+            }
+        }
+        if (best_part == -1) {
+            best_part = std::min_element(part_weights.begin(), part_weights.end()) - part_weights.begin();
+        }
+        parts[vertex] = best_part;
+        part_weights[best_part] += weight;
+    }
+    return parts;
+}
+
+void FillEmptyParts(const WeightedGraph& graph, const int parts_count, Vector<int>& parts) {
+    Vector<int> part_sizes(parts_count, 0);
+    for (int part : parts) {
+        ++part_sizes[part];
+    }
+    Vector<int64_t> part_weights = GetPartWeights(graph, parts, parts_count);
+    for (int empty_part = 0; empty_part < parts_count; ++empty_part) {
+        if (part_sizes[empty_part] > 0) {
+            continue;
+        }
+        int donor_part = -1;
+        for (int part = 0; part < parts_count; ++part) {
+            if (part_sizes[part] > 1 && (donor_part == -1 || part_weights[part] > part_weights[donor_part])) {
+                donor_part = part;
+            }
+        }
+        if (donor_part == -1) {
+            return;
+        }
+        int moved_vertex = -1;
+        for (int vertex = 0; vertex < static_cast<int>(parts.size()); ++vertex) {
+            if (parts[vertex] == donor_part && (moved_vertex == -1 ||
+                        graph.GetVertexWeight(vertex) < graph.GetVertexWeight(moved_vertex))) {
+                moved_vertex = vertex;
+            }
+        }
+        parts[moved_vertex] = empty_part;
+        --part_sizes[donor_part];
+        ++part_sizes[empty_part];
+        part_weights[donor_part] -= graph.GetVertexWeight(moved_vertex);
+        part_weights[empty_part] += graph.GetVertexWeight(moved_vertex);
+    }
+}
+
+// Maps every target part to an old part, heaviest overlaps first.
+Vector<int> MatchPartLabels(const WeightedGraph& graph, const Vector<int>& old_parts, const Vector<int>& target_parts,
+        const int parts_count) {
+    Vector<std::tuple<int64_t, int, int>> overlaps;
+    {
+        Vector<int64_t> overlap_weights(parts_count * parts_count, 0);
+        for (int vertex = 0; vertex < static_cast<int>(graph.GetVerticesCount()); ++vertex) {
+            overlap_weights[target_parts[vertex] * parts_count + old_parts[vertex]] += graph.GetVertexWeight(vertex);
+        }
+        for (int target_part = 0; target_part < parts_count; ++target_part) {
+            for (int old_part = 0; old_part < parts_count; ++old_part) {
+                overlaps.push_back(std::make_tuple(overlap_weights[target_part * parts_count + old_part], target_part, old_part));
+            }
+        }
+    }
+    std::stable_sort(overlaps.begin(), overlaps.end(), [](const auto& first, const auto& second) {
+        return std::get<0>(first) > std::get<0>(second);
+    });
+    Vector<int> target_labels(parts_count, -1);
+    Vector<bool> is_old_part_used(parts_count, false);
+    for (const auto& [weight, target_part, old_part] : overlaps) {
+        if (target_labels[target_part] == -1 && !is_old_part_used[old_part]) {
+            target_labels[target_part] = old_part;
+            is_old_part_used[old_part] = true;
+        }
+    }
+    return target_labels;
+}
+
+struct RefinementMove {
+    int64_t gain;
+    int vertex;
+    int to_part;
+
+    bool operator<(const RefinementMove& other) const noexcept {
+        return gain < other.gain || (gain == other.gain && vertex > other.vertex);
+    }
+};
+
+// The move of a boundary vertex which lowers the cut the most, possibly a
+// negative amount, into a part with room. Ties go to the lighter part.
+bool FindBestMove(const WeightedGraph& graph, const Vector<int>& parts, const Vector<int64_t>& part_weights,
+        const int64_t max_part_weight, const int vertex, PartConnections& connections, RefinementMove* move) {
+    int from_part = parts[vertex];
+    int64_t weight = graph.GetVertexWeight(vertex);
+    connections.Collect(graph, parts, vertex);
+    int best_part = -1;
+    int64_t best_gain = 0;
+    for (int part : connections.GetTouchedParts()) {
+        if (part == from_part || part_weights[part] + weight > max_part_weight) {
+            continue;
+        }
+        int64_t gain = connections.Get(part) - connections.Get(from_part);
+        if (best_part == -1 || gain > best_gain || (gain == best_gain && part_weights[part] < part_weights[best_part])) {
+            best_part = part;
+            best_gain = gain;
+        }
+    }
+    if (best_part == -1) {
+        return false;
+    }
+    *move = RefinementMove{best_gain, vertex, best_part};
+    return true;
+}
+
+// Decrease of the heaviest part weight plus the cut weight after the move.
+int64_t GetMoveGain(const WeightedGraph& graph, const Vector<int>& parts, const Vector<int64_t>& part_weights,
+        const int vertex, const int to_part, const PartitionCostModel& cost_model) {
+    int from_part = parts[vertex];
+    int64_t weight = graph.GetVertexWeight(vertex);
+    int64_t old_max_weight = 0;
+    int64_t new_max_weight = 0;
+    for (int part = 0; part < static_cast<int>(part_weights.size()); ++part) {
+        int64_t part_weight = part_weights[part];
+        old_max_weight = std::max(old_max_weight, part_weight);
+        if (part == from_part) {
+            part_weight -= weight;
+        } else if (part == to_part) {
+            part_weight += weight;
+        }
+        new_max_weight = std::max(new_max_weight, part_weight);
+    }
+    int64_t cut_gain = 0;
+    for (const auto& [neighbour, edge_weight] : graph.GetNeighbours(vertex)) {
+        int neighbour_part = parts[neighbour];
+        cut_gain += edge_weight * (cost_model.GetCutEdgeFactor(from_part, neighbour_part) -
+                cost_model.GetCutEdgeFactor(to_part, neighbour_part));
+    }
+    return old_max_weight - new_max_weight + cut_gain;
+}
+
+}
+
+WeightedGraph::WeightedGraph(const size_t vertices_count)
+    : vertex_weights(vertices_count, 1),
+      neighbours(vertices_count)
+{
+}
+
+void WeightedGraph::SetVertexWeight(const int vertex, const int64_t weight) noexcept {
+    vertex_weights[vertex] = weight;
+}
+
+void WeightedGraph::AddEdge(const int first_vertex, const int second_vertex, const int64_t weight) {
+    if (first_vertex == second_vertex) {
+        return;
+    }
+    auto add_half_edge = [this, weight](const int from, const int to) {
+        auto& from_neighbours = neighbours[from];
+        auto it = std::find_if(from_neighbours.begin(), from_neighbours.end(),
+                [to](const std::pair<int, int64_t>& neighbour) { return neighbour.first == to; });
+        if (it == from_neighbours.end()) {
+            from_neighbours.push_back(std::make_pair(to, weight));
+        } else {
+            it->second += weight;
+        }
+    };
+    add_half_edge(first_vertex, second_vertex);
+    add_half_edge(second_vertex, first_vertex);
+}
+
+size_t WeightedGraph::GetVerticesCount() const noexcept {
+    return vertex_weights.size();
+}
+
+int64_t WeightedGraph::GetVertexWeight(const int vertex) const noexcept {
+    return vertex_weights[vertex];
+}
+
+int64_t WeightedGraph::GetTotalVertexWeight() const noexcept {
+    return std::accumulate(vertex_weights.begin(), vertex_weights.end(), int64_t(0));
+}
+
+const Vector<std::pair<int, int64_t>>& WeightedGraph::GetNeighbours(const int vertex) const noexcept {
+    return neighbours[vertex];
+}
+
+int64_t GetCutWeight(const WeightedGraph& graph, const Vector<int>& parts) noexcept {
+    int64_t cut_weight = 0;
+    for (int vertex = 0; vertex < static_cast<int>(graph.GetVerticesCount()); ++vertex) {
+        for (const auto& [neighbour, weight] : graph.GetNeighbours(vertex)) {
+            if (vertex < neighbour && parts[vertex] != parts[neighbour]) {
+                cut_weight += weight;
+            }
+        }
+    }
+    return cut_weight;
+}
+
+double GetImbalance(const WeightedGraph& graph, const Vector<int>& parts, const int parts_count) {
+    Vector<int64_t> part_weights = GetPartWeights(graph, parts, parts_count);
+    double average_weight = static_cast<double>(graph.GetTotalVertexWeight()) / parts_count;
+    if (average_weight == 0) {
+        return 0;
+    }
+    return *std::max_element(part_weights.begin(), part_weights.end()) / average_weight - 1;
+}
+
+int64_t PartitionCostModel::GetCutEdgeFactor(const int first_part, const int second_part) const noexcept {
+    if (first_part == second_part) {
+        return 0;
+    }
+    if (!part_nodes.empty() && part_nodes[first_part] != part_nodes[second_part]) {
+        return cross_node_edge_factor;
+    }
+    return 1;
+}
+
+int64_t GetPartitionCost(const WeightedGraph& graph, const Vector<int>& parts, const int parts_count,
+        const PartitionCostModel& cost_model) {
+    Vector<int64_t> part_weights = GetPartWeights(graph, parts, parts_count);
+    int64_t cut_cost = 0;
+    for (int vertex = 0; vertex < static_cast<int>(graph.GetVerticesCount()); ++vertex) {
+        for (const auto& [neighbour, weight] : graph.GetNeighbours(vertex)) {
+            if (vertex < neighbour) {
+                cut_cost += weight * cost_model.GetCutEdgeFactor(parts[vertex], parts[neighbour]);
+            }
+        }
+    }
+    return *std::max_element(part_weights.begin(), part_weights.end()) + cut_cost;
+}
+
+Vector<int> PlanMigrations(const WeightedGraph& graph, const Vector<int>& old_parts, const Vector<int>& target_parts,
+        const int parts_count, const Vector<bool>& is_pinned, const MigrationLimits& limits,
+        const PartitionCostModel& cost_model) {
+    int vertices_count = graph.GetVerticesCount();
+    Vector<int> target_labels = MatchPartLabels(graph, old_parts, target_parts, parts_count);
+    Vector<int> parts = old_parts;
+    Vector<int64_t> part_weights = GetPartWeights(graph, parts, parts_count);
+    for (size_t move = 0; move < limits.max_moves; ++move) {
+        int best_vertex = -1;
+        int64_t best_gain = limits.migration_cost;
+        for (int vertex = 0; vertex < vertices_count; ++vertex) {
+            int to_part = target_labels[target_parts[vertex]];
+            if (is_pinned[vertex] || parts[vertex] == to_part) {
+                continue;
+            }
+            int64_t gain = GetMoveGain(graph, parts, part_weights, vertex, to_part, cost_model);
+            if (gain > best_gain) {
+                best_vertex = vertex;
+                best_gain = gain;
+            }
+        }
+        if (best_vertex == -1) {
+            break;
+        }
+        int to_part = target_labels[target_parts[best_vertex]];
+        part_weights[parts[best_vertex]] -= graph.GetVertexWeight(best_vertex);
+        part_weights[to_part] += graph.GetVertexWeight(best_vertex);
+        parts[best_vertex] = to_part;
+    }
+    return parts;
+}
+
+GreedyGraphPartitioner::GreedyGraphPartitioner(const double max_imbalance) noexcept
+    : max_imbalance(max_imbalance)
+{
+}
+
+Vector<int> GreedyGraphPartitioner::Partition(const WeightedGraph& graph, const int parts_count) const {
+    Vector<int> parts = PartitionGreedily(graph, parts_count, GetMaxPartWeight(graph, parts_count, max_imbalance));
+    FillEmptyParts(graph, parts_count, parts);
+    return parts;
+}
+
+MultilevelGraphPartitioner::MultilevelGraphPartitioner(const double max_imbalance) noexcept
+    : max_imbalance(max_imbalance)
+{
+}
+
+WeightedGraph MultilevelGraphPartitioner::Coarsen(const WeightedGraph& graph, const int64_t max_vertex_weight,
+        Vector<int>& coarse_vertices) const {
+    int vertices_count = graph.GetVerticesCount();
+    Vector<int> order(vertices_count);
+    std::iota(order.begin(), order.end(), 0);
+    std::shuffle(order.begin(), order.end(), std::mt19937(vertices_count));
+    coarse_vertices.assign(vertices_count, -1);
+    int coarse_vertices_count = 0;
+    for (int vertex : order) {
+        if (coarse_vertices[vertex] != -1) {
+            continue;
+        }
+        int mate = -1;
+        int64_t mate_edge_weight = -1;
+        for (const auto& [neighbour, weight] : graph.GetNeighbours(vertex)) {
+            if (coarse_vertices[neighbour] == -1 && weight > mate_edge_weight &&
+                    graph.GetVertexWeight(vertex) + graph.GetVertexWeight(neighbour) <= max_vertex_weight) {
+                mate = neighbour;
+                mate_edge_weight = weight;
+            }
+        }
+        coarse_vertices[vertex] = coarse_vertices_count;
+        if (mate != -1) {
+            coarse_vertices[mate] = coarse_vertices_count;
+        }
+        ++coarse_vertices_count;
+    }
+    Vector<int> members_begin(coarse_vertices_count + 1, 0);
+    for (int vertex = 0; vertex < vertices_count; ++vertex) {
+        ++members_begin[coarse_vertices[vertex] + 1];
+    }
+    std::partial_sum(members_begin.begin(), members_begin.end(), members_begin.begin());
+    Vector<int> members(vertices_count);
+    Vector<int> members_end(members_begin.begin(), members_begin.end() - 1);
+    for (int vertex = 0; vertex < vertices_count; ++vertex) {
+        members[members_end[coarse_vertices[vertex]]++] = vertex;
+    }
+    WeightedGraph coarse_graph(coarse_vertices_count);
+    Vector<int64_t> connections(coarse_vertices_count, 0);
+    Vector<int> touched_vertices;
+    for (int coarse_vertex = 0; coarse_vertex < coarse_vertices_count; ++coarse_vertex) {
+        int64_t coarse_weight = 0;
+        for (int member = members_begin[coarse_vertex]; member < members_begin[coarse_vertex + 1]; ++member) {
+            int vertex = members[member];
+            coarse_weight += graph.GetVertexWeight(vertex);
+            for (const auto& [neighbour, weight] : graph.GetNeighbours(vertex)) {
+                int coarse_neighbour = coarse_vertices[neighbour];
+                if (coarse_neighbour == coarse_vertex) {
+                    continue;
+                }
+                if (connections[coarse_neighbour] == 0) {
+                    touched_vertices.push_back(coarse_neighbour);
+                }
+                connections[coarse_neighbour] += weight;
+            }
+        }
+        coarse_graph.vertex_weights[coarse_vertex] = coarse_weight;
+        auto& coarse_neighbours = coarse_graph.neighbours[coarse_vertex];
+        coarse_neighbours.reserve(touched_vertices.size());
+        for (int coarse_neighbour : touched_vertices) {
+            coarse_neighbours.push_back(std::make_pair(coarse_neighbour, connections[coarse_neighbour]));
+            connections[coarse_neighbour] = 0;
+        }
+        touched_vertices.clear();
+    }
+    return coarse_graph;
+}
+
+void MultilevelGraphPartitioner::Rebalance(const WeightedGraph& graph, const int64_t max_part_weight, Vector<int>& parts,
+        Vector<int64_t>& part_weights) const {
+    PartConnections connections(part_weights.size());
+    for (int vertex = 0; vertex < static_cast<int>(graph.GetVerticesCount()); ++vertex) {
+        int from_part = parts[vertex];
+        if (part_weights[from_part] <= max_part_weight) {
+            continue;
+        }
+        int64_t weight = graph.GetVertexWeight(vertex);
+        RefinementMove move;
+        int to_part = -1;
+        if (FindBestMove(graph, parts, part_weights, max_part_weight, vertex, connections, &move)) {
+            to_part = move.to_part;
+        } else {
+            int lightest_part = std::min_element(part_weights.begin(), part_weights.end()) - part_weights.begin();
+            if (part_weights[lightest_part] + weight < part_weights[from_part]) {
+                to_part = lightest_part;
+            }
+        }
+        if (to_part != -1) {
+            parts[vertex] = to_part;
+            part_weights[from_part] -= weight;
+            part_weights[to_part] += weight;
+        }
+    }
+}
+
+int64_t MultilevelGraphPartitioner::RefinePass(const WeightedGraph& graph, const int64_t max_part_weight, Vector<int>& parts,
+        Vector<int64_t>& part_weights) const {
+    int vertices_count = graph.GetVerticesCount();
+    PartConnections connections(part_weights.size());
+    std::priority_queue<RefinementMove, Vector<RefinementMove>> moves;
+    RefinementMove move;
+    for (int vertex = 0; vertex < vertices_count; ++vertex) {
+        if (FindBestMove(graph, parts, part_weights, max_part_weight, vertex, connections, &move)) {
+            moves.push(move);
+        }
+    }
+    Vector<bool> is_locked(vertices_count, false);
+    Vector<std::pair<int, int>> moved_vertices;
+    int64_t total_gain = 0;
+    int64_t best_total_gain = 0;
+    size_t best_moves_count = 0;
+    while (!moves.empty() && moved_vertices.size() - best_moves_count < max_unprofitable_moves) {
+        RefinementMove queued_move = moves.top();
+        moves.pop();
+        int vertex = queued_move.vertex;
+        if (is_locked[vertex] || !FindBestMove(graph, parts, part_weights, max_part_weight, vertex, connections, &move)) {
+            continue;
+        }
+        // Gains of queued moves go stale as neighbours move.
+        if (move.gain != queued_move.gain || move.to_part != queued_move.to_part) {
+            moves.push(move);
+            continue;
+        }
+        int from_part = parts[vertex];
+        parts[vertex] = move.to_part;
+        part_weights[from_part] -= graph.GetVertexWeight(vertex);
+        part_weights[move.to_part] += graph.GetVertexWeight(vertex);
+        is_locked[vertex] = true;
+        moved_vertices.push_back(std::make_pair(vertex, from_part));
+        total_gain += move.gain;
+        if (total_gain > best_total_gain) {
+            best_total_gain = total_gain;
+            best_moves_count = moved_vertices.size();
+        }
+        for (const auto& [neighbour, weight] : graph.GetNeighbours(vertex)) {
+            RefinementMove neighbour_move;
+            if (!is_locked[neighbour] &&
+                    FindBestMove(graph, parts, part_weights, max_part_weight, neighbour, connections, &neighbour_move)) {
+                moves.push(neighbour_move);
+            }
+        }
+    }
+    while (moved_vertices.size() > best_moves_count) {
+        auto [vertex, from_part] = moved_vertices.back();
+        moved_vertices.pop_back();
+        part_weights[parts[vertex]] -= graph.GetVertexWeight(vertex);
+        part_weights[from_part] += graph.GetVertexWeight(vertex);
+        parts[vertex] = from_part;
+    }
+    return best_total_gain;
+}
+
+void MultilevelGraphPartitioner::Refine(const WeightedGraph& graph, const int parts_count, const int64_t max_part_weight,
+        Vector<int>& parts) const {
+    Vector<int64_t> part_weights = GetPartWeights(graph, parts, parts_count);
+    Rebalance(graph, max_part_weight, parts, part_weights);
+    for (int pass = 0; pass < max_refinement_passes; ++pass) {
+        if (RefinePass(graph, max_part_weight, parts, part_weights) == 0) {
+            break;
+        }
+    }
+}
+
+Vector<int> MultilevelGraphPartitioner::Partition(const WeightedGraph& graph, const int parts_count) const {
+    int64_t max_part_weight = GetMaxPartWeight(graph, parts_count, max_imbalance);
+    int64_t max_vertex_weight = std::max(graph.GetTotalVertexWeight() / (parts_count * 4), int64_t(1));
+    Vector<WeightedGraph> levels;
+    Vector<Vector<int>> coarse_vertices;
+    const WeightedGraph* current_graph = &graph;
+    while (current_graph->GetVerticesCount() > min_coarse_vertices_per_part * parts_count) {
+        Vector<int> current_coarse_vertices;
+        WeightedGraph coarse_graph = Coarsen(*current_graph, max_vertex_weight, current_coarse_vertices);
+        if (coarse_graph.GetVerticesCount() > min_coarsening_ratio * current_graph->GetVerticesCount()) {
+            break;
+        }
+        coarse_vertices.push_back(std::move(current_coarse_vertices));
+        levels.push_back(std::move(coarse_graph));
+        current_graph = &levels.back();
+    }
+    Vector<int> parts = PartitionGreedily(*current_graph, parts_count, max_part_weight);
+    Refine(*current_graph, parts_count, max_part_weight, parts);
+    for (int level = static_cast<int>(levels.size()) - 1; level >= 0; --level) {
+        const WeightedGraph& finer_graph = level == 0 ? graph : levels[level - 1];
+        Vector<int> finer_parts(finer_graph.GetVerticesCount());
+        for (int vertex = 0; vertex < static_cast<int>(finer_parts.size()); ++vertex) {
+            finer_parts[vertex] = parts[coarse_vertices[level][vertex]];
+        }
+        parts = std::move(finer_parts);
+        Refine(finer_graph, parts_count, max_part_weight, parts);
+    }
+    FillEmptyParts(graph, parts_count, parts);
+    return parts;
+}
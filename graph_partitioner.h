@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <utility>
+
+#include "types.h"
+
+class WeightedGraph {
+public:
+    explicit WeightedGraph(const size_t vertices_count);
+
+    void SetVertexWeight(const int vertex, const int64_t weight) noexcept;
+    // Edges are undirected, weights of parallel edges are summed up.
+    void AddEdge(const int first_vertex, const int second_vertex, const int64_t weight);
+
+    size_t GetVerticesCount() const noexcept;
+    int64_t GetVertexWeight(const int vertex) const noexcept;
+    int64_t GetTotalVertexWeight() const noexcept;
+    const Vector<std::pair<int, int64_t>>& GetNeighbours(const int vertex) const noexcept;
+private:
+    friend class MultilevelGraphPartitioner;
+
+    Vector<int64_t> vertex_weights;
+    Vector<Vector<std::pair<int, int64_t>>> neighbours;
+};
+
+// Total weight of edges whose ends are in different parts.
+int64_t GetCutWeight(const WeightedGraph& graph, const Vector<int>& parts) noexcept;
+
+// Heaviest part weight divided by the average one, minus one.
+double GetImbalance(const WeightedGraph& graph, const Vector<int>& parts, const int parts_count);
+
+struct PartitionCostModel {
+    // NUMA node of every part, empty if all parts share one node.
+    Vector<int> part_nodes;
+    // Cut edges between parts on different nodes weigh this many times more.
+    int64_t cross_node_edge_factor = 1;
+
+    int64_t GetCutEdgeFactor(const int first_part, const int second_part) const noexcept;
+};
+
+// Heaviest part weight plus the cut weight.
+int64_t GetPartitionCost(const WeightedGraph& graph, const Vector<int>& parts, const int parts_count,
+        const PartitionCostModel& cost_model = PartitionCostModel());
+
+struct MigrationLimits {
+    // A move is taken only if it lowers the partition cost by more than this.
+    int64_t migration_cost = 0;
+    size_t max_moves = std::numeric_limits<size_t>::max();
+};
+
+// Moves vertices from old_parts towards target_parts one at a time, the most
+// profitable move first, and stops when no move pays for its migration.
+// Parts of target_parts are relabelled to overlap old_parts the most, so any
+// partitioner output can be used as a target. Pinned vertices are not moved.
+Vector<int> PlanMigrations(const WeightedGraph& graph, const Vector<int>& old_parts, const Vector<int>& target_parts,
+        const int parts_count, const Vector<bool>& is_pinned, const MigrationLimits& limits,
+        const PartitionCostModel& cost_model = PartitionCostModel());
+
+class GraphPartitioner {
+public:
+    // Returns the part of every vertex. No part is left empty while there are
+    // enough vertices.
+    virtual Vector<int> Partition(const WeightedGraph& graph, const int parts_count) const = 0;
+    virtual ~GraphPartitioner() noexcept {}
+};
+
+// Single pass: heaviest vertices first, each to the most connected part
+// which still has room.
+class GreedyGraphPartitioner : public GraphPartitioner {
+public:
+    explicit GreedyGraphPartitioner(const double max_imbalance = default_max_imbalance) noexcept;
+    virtual Vector<int> Partition(const WeightedGraph& graph, const int parts_count) const;
+public:
+    static const double default_max_imbalance;
+private:
+    double max_imbalance;
+};
+
+// Heavy edge matching coarsens the graph, the coarsest graph is split
+// greedily and every level is refined by k-way Fiduccia-Mattheyses passes
+// on the way back. A pass moves every boundary vertex at most once, the
+// best move first even if it raises the cut, and is rolled back to its best
+// prefix, so it can climb out of local minima.
+class MultilevelGraphPartitioner : public GraphPartitioner {
+private:
+    WeightedGraph Coarsen(const WeightedGraph& graph, const int64_t max_vertex_weight, Vector<int>& coarse_vertices) const;
+    // Moves vertices out of parts heavier than max_part_weight.
+    void Rebalance(const WeightedGraph& graph, const int64_t max_part_weight, Vector<int>& parts,
+            Vector<int64_t>& part_weights) const;
+    // Returns the decrease of the cut weight.
+    int64_t RefinePass(const WeightedGraph& graph, const int64_t max_part_weight, Vector<int>& parts,
+            Vector<int64_t>& part_weights) const;
+    void Refine(const WeightedGraph& graph, const int parts_count, const int64_t max_part_weight, Vector<int>& parts) const;
+public:
+    explicit MultilevelGraphPartitioner(const double max_imbalance = default_max_imbalance) noexcept;
+    virtual Vector<int> Partition(const WeightedGraph& graph, const int parts_count) const;
+public:
+    static const double default_max_imbalance;
+private:
+    double max_imbalance;
+    static const size_t min_coarse_vertices_per_part;
+    static const double min_coarsening_ratio;
+    static const int max_refinement_passes;
+    // A pass stops after this many moves without a better cut.
+    static const size_t max_unprofitable_moves;
+};
@@ -0,0 +1,44 @@
+#include <iostream>
+#include <chrono>
+#include <random>
+
+#include "graph_partitioner.h"
+
+// Vertices form clusters with heavy edges inside and light edges between.
+WeightedGraph MakeClusteredGraph(const int vertices_count, const int clusters_count, std::mt19937& generator) {
+    WeightedGraph graph(vertices_count);
+    std::uniform_int_distribution<int> vertex_distribution(0, vertices_count - 1);
+    std::uniform_int_distribution<int64_t> weight_distribution(1, 100);
+    int cluster_size = vertices_count / clusters_count;
+    for (int vertex = 0; vertex < vertices_count; ++vertex) {
+        graph.SetVertexWeight(vertex, weight_distribution(generator));
+        int cluster_start = vertex / cluster_size * cluster_size;
+        for (int i = 0; i < 4; ++i) {
+            int neighbour = std::min(cluster_start + static_cast<int>(generator() % cluster_size), vertices_count - 1);
+            graph.AddEdge(vertex, neighbour, weight_distribution(generator) * 10);
+        }
+        graph.AddEdge(vertex, vertex_distribution(generator), weight_distribution(generator));
+    }
+    return graph;
+}
+
+void Benchmark(const GraphPartitioner& partitioner, const std::string& name, const WeightedGraph& graph, const int parts_count) {
+    auto start = std::chrono::steady_clock::now();
+    Vector<int> parts = partitioner.Partition(graph, parts_count);
+    auto finish = std::chrono::steady_clock::now();
+    std::cout << name << ": vertices = " << graph.GetVerticesCount() << ", parts = " << parts_count
+        << ", cut = " << GetCutWeight(graph, parts) << ", imbalance = " << GetImbalance(graph, parts, parts_count)
+        << ", time = " << std::chrono::duration_cast<std::chrono::microseconds>(finish - start).count() << "us" << std::endl;
+}
+
+int main() {
+    std::mt19937 generator(42);
+    for (int vertices_count : {100, 1000, 5000}) {
+        WeightedGraph graph = MakeClusteredGraph(vertices_count, 16, generator);
+        for (int parts_count : {4, 16}) {
+            Benchmark(GreedyGraphPartitioner(), "Greedy", graph, parts_count);
+            Benchmark(MultilevelGraphPartitioner(), "Multilevel", graph, parts_count);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,68 @@
+#include <iostream>
+
+#include "graph_partitioner.h"
+
+// Two cliques of four vertices joined by one light edge.
+WeightedGraph MakeTwoClusters() {
+    WeightedGraph graph(8);
+    for (int cluster = 0; cluster < 2; ++cluster) {
+        for (int i = 0; i < 4; ++i) {
+            for (int j = i + 1; j < 4; ++j) {
+                graph.AddEdge(cluster * 4 + i, cluster * 4 + j, 10);
+            }
+        }
+    }
+    graph.AddEdge(3, 4, 1);
+    return graph;
+}
+
+void TestPartitioner(const GraphPartitioner& partitioner, const std::string& name) {
+    WeightedGraph graph = MakeTwoClusters();
+    Vector<int> parts = partitioner.Partition(graph, 2);
+    std::cout << name << ": cut = " << GetCutWeight(graph, parts) << ", imbalance = " << GetImbalance(graph, parts, 2) << std::endl;
+}
+
+void TestNoEmptyParts() {
+    WeightedGraph graph(4);
+    graph.SetVertexWeight(0, 1000);
+    Vector<int> parts = MultilevelGraphPartitioner().Partition(graph, 4);
+    Vector<int> part_sizes(4, 0);
+    for (int part : parts) {
+        ++part_sizes[part];
+    }
+    std::cout << "Part sizes:";
+    for (int part_size : part_sizes) {
+        std::cout << " " << part_size;
+    }
+    std::cout << std::endl;
+}
+
+void TestPlanMigrations() {
+    WeightedGraph graph = MakeTwoClusters();
+    Vector<int> old_parts = {0, 0, 0, 1, 1, 1, 1, 0};
+    Vector<int> target_parts = MultilevelGraphPartitioner().Partition(graph, 2);
+    Vector<bool> is_pinned(8, false);
+    MigrationLimits limits;
+    Vector<int> parts = PlanMigrations(graph, old_parts, target_parts, 2, is_pinned, limits);
+    std::cout << "Migrations: cost " << GetPartitionCost(graph, old_parts, 2) << " -> " << GetPartitionCost(graph, parts, 2)
+        << ", vertex 3 part = " << parts[3] << ", vertex 7 part = " << parts[7] << std::endl;
+    limits.max_moves = 1;
+    parts = PlanMigrations(graph, old_parts, target_parts, 2, is_pinned, limits);
+    std::cout << "One move: vertex 3 part = " << parts[3] << ", vertex 7 part = " << parts[7] << std::endl;
+    limits.max_moves = std::numeric_limits<size_t>::max();
+    limits.migration_cost = 100;
+    parts = PlanMigrations(graph, old_parts, target_parts, 2, is_pinned, limits);
+    std::cout << "Expensive migration: moved = " << (parts != old_parts) << std::endl;
+    limits.migration_cost = 0;
+    is_pinned[3] = true;
+    parts = PlanMigrations(graph, old_parts, target_parts, 2, is_pinned, limits);
+    std::cout << "Pinned: vertex 3 part = " << parts[3] << ", vertex 7 part = " << parts[7] << std::endl;
+}
+
+int main() {
+    TestPartitioner(GreedyGraphPartitioner(), "Greedy");
+    TestPartitioner(MultilevelGraphPartitioner(), "Multilevel");
+    TestNoEmptyParts();
+    TestPlanMigrations();
+    return 0;
+}
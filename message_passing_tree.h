@@ -2,17 +2,103 @@
 
 #include <memory>
 #include <algorithm>
+#include <chrono>
 #include <condition_variable>
+#include <mutex>
+#include <cassert>
+#include <atomic>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
 
+#include "checkpoint.h"
 #include "type_specifier.h"
 #include "types.h"
 #include "queue.h"
+#include "timers.h"
+#include "timing_wheel.h"
+#include "traffic_recorder.h"
 
-template <typename From, typename To, typename Message>
+// Wakes up a thread waiting for messages. A notification which comes
+// between the check for messages and the wait is not lost, it is kept until
+// the next Reset.
+class WakeUpSignal {
+public:
+    WakeUpSignal() noexcept
+    : is_notified(false)
+    , is_waiting(false)
+    {}
+
+    // The mutex is taken only if the thread is waiting.
+    void Notify() {
+        is_notified.store(true, std::memory_order_seq_cst);
+        if (is_waiting.load(std::memory_order_seq_cst)) {
+            std::lock_guard<std::mutex> lock(mutex);
+            condition_variable.notify_one();
+        }
+    }
+
+    // Called by the waiting thread before it checks for messages.
+    void Reset() noexcept {
+        is_notified.store(false, std::memory_order_seq_cst);
+    }
+
+    void WaitFor(const int64_t wait_time) {
+        std::unique_lock<std::mutex> lock(mutex);
+        is_waiting.store(true, std::memory_order_seq_cst);
+        condition_variable.wait_for(lock, std::chrono::microseconds(wait_time),
+                [this] { return is_notified.load(std::memory_order_seq_cst); });
+        is_waiting.store(false, std::memory_order_relaxed);
+    }
+private:
+    std::atomic<bool> is_notified;
+    std::atomic<bool> is_waiting;
+    std::mutex mutex;
+    std::condition_variable condition_variable;
+};
+
+// Capacity of zero means unbounded edge. Send to a full bounded edge throws
+// std::length_error, TrySend reports it instead.
+template <typename From, typename To, typename Message, int64_t Capacity = 0>
 class Edge{};
 
+class RoundRobinRouting {};
+
+// Requires messages of the edge to provide GetRoutingKey().
+class KeyHashRouting {};
+
+template <typename MP, int ReplicasCount, typename RoutingPolicy = RoundRobinRouting>
+class Replicated {};
+
+template <typename MPSpec>
+class ReplicaTraits {
+public:
+    using Type = MPSpec;
+    using Routing = RoundRobinRouting;
+    static constexpr int replicas_count = 1;
+};
+
+template <typename MP, int ReplicasCount, typename RoutingPolicy>
+class ReplicaTraits<Replicated<MP, ReplicasCount, RoutingPolicy>> {
+public:
+    static_assert(ReplicasCount > 0);
+    using Type = MP;
+    using Routing = RoutingPolicy;
+    static constexpr int replicas_count = ReplicasCount;
+};
+
+// Threads serve runnable message processors of higher classes first.
+enum class MessageProcessorPriority {
+    Critical,
+    Normal,
+    Bulk
+};
+
+// A message processor sets its class by declaring its own priority member.
 class MessageProcessorBase {
 public:
+    static constexpr MessageProcessorPriority priority = MessageProcessorPriority::Normal;
+
     template <typename Sender>
     bool Ping(const Sender&) {
         return true;
@@ -26,9 +112,218 @@ public:
 
 class MessageBase {
 public:
+    virtual const MessageBase& GetPayload() const noexcept {
+        return *this;
+    }
+    virtual void OnLeavingThread() noexcept {}
     virtual ~MessageBase() {}
+
+    // Set on sending while latency is measured or the receiver is critical.
+    int64_t enqueue_time = 0;
+    // Monotonic time by which the message should be received, zero if none.
+    int64_t deadline = 0;
+};
+
+// One payload shared by all handles of a broadcast. While every handle is
+// delivered inline by the sending thread, the counter is not atomic.
+template <typename Message>
+class SharedPayload {
+public:
+    SharedPayload(std::unique_ptr<Message>&& message, const int64_t references_count, const bool is_thread_local) noexcept
+        : message(std::move(message)),
+          is_thread_local(is_thread_local),
+          local_references_count(references_count),
+          references_count(references_count)
+    {}
+
+    const Message& GetMessage() const noexcept {
+        return *message;
+    }
+
+    void MakeShared() noexcept {
+        if (is_thread_local) {
+            references_count.store(local_references_count, std::memory_order_relaxed);
+            is_thread_local = false;
+        }
+    }
+
+    void Release() noexcept {
+        if (is_thread_local) {
+            if (--local_references_count == 0) {
+                delete this;
+            }
+        } else if (references_count.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete this;
+        }
+    }
+private:
+    std::unique_ptr<Message> message;
+    bool is_thread_local;
+    int64_t local_references_count;
+    std::atomic<int64_t> references_count;
+};
+
+template <typename Message>
+class SharedMessage : public MessageBase {
+public:
+    explicit SharedMessage(SharedPayload<Message>* payload) noexcept
+        : payload(payload)
+    {}
+
+    virtual const MessageBase& GetPayload() const noexcept {
+        return payload->GetMessage();
+    }
+
+    virtual void OnLeavingThread() noexcept {
+        payload->MakeShared();
+    }
+
+    virtual ~SharedMessage() {
+        payload->Release();
+    }
+private:
+    SharedPayload<Message>* payload;
+};
+
+// Messages handed to ReceiveBatch at once. A message type may have its
+// batches gathered column by column by declaring
+//     class Batch { public: void Add(const Message&); void Clear(); };
+// messages of other types are copied into a contiguous array.
+template <typename Message, typename = void>
+class MessageBatchTraits {
+public:
+    using Batch = Span<const Message>;
+
+    class Builder {
+    public:
+        void Add(const Message& message) {
+            messages.push_back(message);
+        }
+
+        void Clear() noexcept {
+            messages.clear();
+        }
+
+        Batch Get() const noexcept {
+            return Batch(messages.data(), messages.size());
+        }
+    private:
+        Vector<Message> messages;
+    };
+};
+
+template <typename Message>
+class MessageBatchTraits<Message, std::void_t<typename Message::Batch>> {
+public:
+    using Batch = typename Message::Batch;
+
+    class Builder {
+    public:
+        void Add(const Message& message) {
+            batch.Add(message);
+        }
+
+        void Clear() {
+            batch.Clear();
+        }
+
+        const Batch& Get() const noexcept {
+            return batch;
+        }
+    private:
+        Batch batch;
+    };
+};
+
+template <typename Message>
+using MessageBatch = typename MessageBatchTraits<Message>::Batch;
+
+using MessageSerializer = void (*)(const MessageBase&, std::string&);
+using MessageDeserializer = std::unique_ptr<MessageBase> (*)(const char*, const size_t);
+
+// Messages are recorded and replayed only if they provide
+//     void Serialize(std::string& output) const;
+//     static std::unique_ptr<Message> Deserialize(const char* data, const size_t size);
+template <typename Message, typename = void>
+class MessageSerialization {
+public:
+    static constexpr MessageSerializer serializer = nullptr;
+    static constexpr MessageDeserializer deserializer = nullptr;
+};
+
+template <typename Message>
+class MessageSerialization<Message, std::void_t<
+        decltype(std::declval<const Message&>().Serialize(std::declval<std::string&>())),
+        decltype(Message::Deserialize(std::declval<const char*>(), size_t()))>> {
+private:
+    static void Serialize(const MessageBase& message, std::string& output) {
+        static_cast<const Message&>(message).Serialize(output);
+    }
+
+    static std::unique_ptr<MessageBase> Deserialize(const char* data, const size_t size) {
+        return Message::Deserialize(data, size);
+    }
+public:
+    static constexpr MessageSerializer serializer = &Serialize;
+    static constexpr MessageDeserializer deserializer = &Deserialize;
+};
+
+// Message processors keep their state across restarts only if they provide
+//     void Checkpoint(CheckpointWriter& writer) const;
+//     void Restore(CheckpointReader& reader);
+template <typename MP, typename = void>
+class MessageProcessorCheckpointing {
+public:
+    static void Checkpoint(const MP&, CheckpointWriter&) {}
+    static void Restore(MP&, CheckpointReader&) {}
+};
+
+template <typename MP>
+class MessageProcessorCheckpointing<MP, std::void_t<
+        decltype(std::declval<const MP&>().Checkpoint(std::declval<CheckpointWriter&>())),
+        decltype(std::declval<MP&>().Restore(std::declval<CheckpointReader&>()))>> {
+public:
+    static void Checkpoint(const MP& message_processor, CheckpointWriter& writer) {
+        message_processor.Checkpoint(writer);
+    }
+
+    static void Restore(MP& message_processor, CheckpointReader& reader) {
+        message_processor.Restore(reader);
+    }
+};
+
+// Carries serialized messages of remote edges to another process, which
+// pushes them into its own queues of the same edges.
+class RemoteChannel {
+public:
+    // Waits a bounded time for space. Returns false if the message is not
+    // taken, like when the other process has stopped reading.
+    virtual bool Send(const int edge_index, const std::string& payload) noexcept = 0;
+    // Returns false at once if there is no space for the message.
+    virtual bool TrySend(const int edge_index, const std::string& payload) noexcept = 0;
+    virtual ~RemoteChannel() noexcept {}
+};
+
+struct InlineMessage {
+    int edge_index;
+    std::unique_ptr<MessageBase> message;
 };
 
+// Messages sent over edges whose both ends are owned by the current thread.
+// They are delivered by the owner right after the sending callback returns,
+// so no message processor is ever reentered. A coroutine message processor
+// may send from another thread after it is resumed there, so the address is
+// never kept by callers: the function is not inlined, and the volatile asm
+// keeps it from being taken for a const function.
+template <typename GlobalPiper>
+__attribute__((noinline)) Deque<InlineMessage>& GetInlineMessages() noexcept {
+    static thread_local Deque<InlineMessage> inline_messages;
+    asm volatile("");
+    return inline_messages;
+}
+
+class SelfEdgeSpecifier {};
+
 template <typename ... Args>
 class Piper {
 protected:
@@ -39,8 +334,11 @@ protected:
         : piper(piper)
         {}
 
-        virtual void SetConditionVariable (std::condition_variable_any *) const noexcept = 0;
-        virtual bool NotifyAboutMessage() const = 0;
+        virtual void SetWakeUpSignal(WakeUpSignal* signal) const noexcept = 0;
+        virtual void SetInlineDelivery(const bool is_inline) const noexcept = 0;
+        // Returns the number of delivered messages.
+        virtual size_t NotifyAboutMessage() const = 0;
+        virtual void DeliverMessage(const MessageBase& message_base) const = 0;
         virtual int GetFromIndex() const noexcept = 0;
         virtual int GetToIndex() const noexcept = 0;
         virtual ~EdgeProxy() noexcept {}
@@ -51,9 +349,12 @@ protected:
     template <typename GlobalPiper>
     class MessageProcessorProxy {
     public:
-        MessageProcessorProxy(GlobalPiper& piper, const int message_processor_index) noexcept
+        MessageProcessorProxy(GlobalPiper& piper, const int message_processor_index,
+                              const int replica_index, const int replicas_count) noexcept
         : piper(piper)
         , message_processor_index(message_processor_index)
+        , replica_index(replica_index)
+        , replicas_count(replicas_count)
         {}
 
         template <typename MP>
@@ -61,29 +362,235 @@ protected:
             return *dynamic_cast<MP*>(piper.message_processors[message_processor_index].get());
         }
 
+        int GetReplicaIndex() const noexcept {
+            return replica_index;
+        }
+
+        int GetReplicasCount() const noexcept {
+            return replicas_count;
+        }
+
+        // Memory of the whole message processor object, without what it owns.
+        const void* GetMessageProcessorAddress() const noexcept {
+            return dynamic_cast<const void*>(piper.message_processors[message_processor_index].get());
+        }
+
         virtual bool Ping() const = 0;
 
         virtual std::string GetName() const noexcept = 0;
 
+        virtual MessageProcessorPriority GetPriority() const noexcept = 0;
+
+        virtual size_t GetMessageProcessorSize() const noexcept = 0;
+
+        virtual void Checkpoint(CheckpointWriter& writer) const = 0;
+
+        virtual void Restore(CheckpointReader& reader) const = 0;
+
         virtual ~MessageProcessorProxy() {}
     protected:
         GlobalPiper& piper;
         int message_processor_index;
+        int replica_index;
+        int replicas_count;
     };
 
     int max_message_processor_index;
     int max_edge_index;
     Vector<Vector<int>> dest_pipes;
+    Vector<Vector<int>> source_pipes;
     Vector<LockFreeQueue<MessageBase>> queues;
+    Vector<std::atomic<int64_t>> queue_sizes;
+    Vector<int64_t> edge_capacities;
     Vector<std::unique_ptr<MessageProcessorBase>> message_processors;
-    Vector<std::condition_variable_any *> notify_condition_variables;
+    Vector<int> message_processor_replicas;
+    Vector<WakeUpSignal*> notify_signals;
+    Vector<char> inline_delivery;
+    Vector<char> timestamped_edges;
+    Vector<int64_t> delivered_enqueue_times;
+    // The earliest deadline of messages sent since the queue was empty last
+    // time, zero if there is none.
+    Vector<std::atomic<int64_t>> edge_deadlines;
+    Vector<TimingWheel<InlineMessage>> timer_wheels;
+    Vector<MessageSerializer> message_serializers;
+    Vector<MessageDeserializer> message_deserializers;
+    // Null for local edges.
+    Vector<RemoteChannel*> remote_channels;
+    Vector<char> remote_message_processors;
+    std::atomic<TrafficRecorder*> traffic_recorder;
+    // Senders which may still use a recorder replaced by SetTrafficRecorder.
+    std::atomic<int> recording_senders_count;
+    std::atomic<bool> is_latency_measured;
+    static const int64_t timer_tick_duration;
+    static const size_t max_receive_batch_size;
+
+    void RecordMessage(const int edge_index, TrafficRecorder& recorder, const MessageBase& message) {
+        if (message_serializers[edge_index] == nullptr) {
+            return;
+        }
+        static thread_local std::string payload;
+        payload.clear();
+        message_serializers[edge_index](message.GetPayload(), payload);
+        recorder.Record(edge_index, GetMonotonicTime(), payload);
+    }
+
+    void RecordMessageIfRecording(const int edge_index, const MessageBase& message) {
+        recording_senders_count.fetch_add(1);
+        TrafficRecorder* recorder = traffic_recorder.load();
+        if (recorder != nullptr) {
+            try {
+                RecordMessage(edge_index, *recorder, message);
+            } catch (...) {
+                recording_senders_count.fetch_sub(1);
+                throw;
+            }
+        }
+        recording_senders_count.fetch_sub(1);
+    }
 public:
     Piper() noexcept
     : max_message_processor_index(0)
     , max_edge_index(0)
+    , traffic_recorder(nullptr)
+    , recording_senders_count(0)
+    , is_latency_measured(false)
     {
     }
 
+    void EnqueueMessage(const int edge_index, std::unique_ptr<MessageBase>&& message) {
+        queues[edge_index].Push(std::move(message));
+        if (notify_signals[edge_index] != nullptr) {
+            notify_signals[edge_index]->Notify();
+        }
+    }
+
+    // Messages which are already accepted, like replayed or restored ones,
+    // are pushed past the capacity.
+    void PushMessage(const int edge_index, std::unique_ptr<MessageBase>&& message) {
+        queue_sizes[edge_index].fetch_add(1, std::memory_order_relaxed);
+        EnqueueMessage(edge_index, std::move(message));
+    }
+
+    // Takes a place in the queue of the edge, fails if a bounded edge is
+    // full. Racing senders can not overfill it.
+    bool ReserveEdgeSlot(const int edge_index) noexcept {
+        int64_t previous_size = queue_sizes[edge_index].fetch_add(1, std::memory_order_relaxed);
+        if (edge_capacities[edge_index] > 0 && previous_size >= edge_capacities[edge_index]) {
+            queue_sizes[edge_index].fetch_sub(1, std::memory_order_relaxed);
+            return false;
+        }
+        return true;
+    }
+
+    void ForceReserveEdgeSlot(const int edge_index) noexcept {
+        queue_sizes[edge_index].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void ReleaseEdgeSlot(const int edge_index) noexcept {
+        queue_sizes[edge_index].fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    void UpdateEdgeDeadline(const int edge_index, const int64_t deadline) noexcept {
+        int64_t current_deadline = edge_deadlines[edge_index].load(std::memory_order_relaxed);
+        while ((current_deadline == 0 || deadline < current_deadline) &&
+                !edge_deadlines[edge_index].compare_exchange_weak(current_deadline, deadline, std::memory_order_relaxed)) {
+        }
+    }
+
+    // A deadline set by a concurrent sender may be lost, its message is
+    // delivered in the usual order then.
+    void OnMessageTaken(const int edge_index) noexcept {
+        int64_t deadline = edge_deadlines[edge_index].load(std::memory_order_relaxed);
+        if (queue_sizes[edge_index].fetch_sub(1, std::memory_order_relaxed) == 1 && deadline != 0) {
+            edge_deadlines[edge_index].compare_exchange_strong(deadline, 0, std::memory_order_relaxed);
+        }
+    }
+
+    bool IsInlineEdge(const int edge_index) const noexcept {
+        return inline_delivery[edge_index] && queues[edge_index].IsEmpty();
+    }
+
+    // Delayed messages are accepted when they are scheduled, so they are
+    // delivered past the capacity once their timers fire. Those not taken by
+    // a remote edge are left to the channel to count as dropped.
+    template <typename GlobalPiper>
+    void ForceSendToEdge(const int edge_index, std::unique_ptr<MessageBase>&& message) {
+        ForceReserveEdgeSlot(edge_index);
+        SendToReservedEdge<GlobalPiper>(edge_index, std::move(message));
+    }
+
+    // Remote edges are bounded by the space in their channels rather than by
+    // queue sizes. Only the messages taken by the channel are recorded.
+    bool SendToRemoteChannel(const int edge_index, const MessageBase& message, const bool is_waiting) {
+        static thread_local std::string payload;
+        payload.clear();
+        message_serializers[edge_index](message.GetPayload(), payload);
+        RemoteChannel& channel = *remote_channels[edge_index];
+        if (!(is_waiting ? channel.Send(edge_index, payload) : channel.TrySend(edge_index, payload))) {
+            return false;
+        }
+        if (traffic_recorder.load(std::memory_order_relaxed) != nullptr) {
+            RecordMessageIfRecording(edge_index, message);
+        }
+        return true;
+    }
+
+    bool IsRemoteEdge(const int edge_index) const noexcept {
+        return remote_channels[edge_index] != nullptr;
+    }
+
+    // Returns false if a remote edge does not take the message in time.
+    template <typename GlobalPiper>
+    bool SendToReservedEdge(const int edge_index, std::unique_ptr<MessageBase>&& message) {
+        if (remote_channels[edge_index] != nullptr) {
+            ReleaseEdgeSlot(edge_index);
+            return SendToRemoteChannel(edge_index, *message, true);
+        }
+        if (traffic_recorder.load(std::memory_order_relaxed) != nullptr) {
+            RecordMessageIfRecording(edge_index, *message);
+        }
+        if (timestamped_edges[edge_index] || is_latency_measured.load(std::memory_order_relaxed)) {
+            message->enqueue_time = GetMonotonicTime();
+        }
+        if (message->deadline != 0) {
+            UpdateEdgeDeadline(edge_index, message->deadline);
+        }
+        if (IsInlineEdge(edge_index)) {
+            GetInlineMessages<GlobalPiper>().push_back({edge_index, std::move(message)});
+        } else {
+            EnqueueMessage(edge_index, std::move(message));
+        }
+        return true;
+    }
+
+    bool HasPendingMessages(const int message_processor_index) const noexcept {
+        const auto& incoming_edges = dest_pipes[message_processor_index];
+        return std::any_of(incoming_edges.begin(), incoming_edges.end(),
+                [this](const int edge_index) { return queue_sizes[edge_index].load(std::memory_order_relaxed) > 0; });
+    }
+
+    int64_t GetEarliestDeadline(const int message_processor_index) const noexcept {
+        int64_t earliest_deadline = 0;
+        for (int edge_index : dest_pipes[message_processor_index]) {
+            int64_t deadline = edge_deadlines[edge_index].load(std::memory_order_relaxed);
+            if (deadline != 0 && (earliest_deadline == 0 || deadline < earliest_deadline)) {
+                earliest_deadline = deadline;
+            }
+        }
+        return earliest_deadline;
+    }
+
+    bool IsEdgeFull(const int edge_index) const noexcept {
+        return edge_capacities[edge_index] > 0 &&
+            queue_sizes[edge_index].load(std::memory_order_relaxed) >= edge_capacities[edge_index];
+    }
+
+    bool IsSaturated(const int message_processor_index) const noexcept {
+        const auto& outgoing_edges = source_pipes[message_processor_index];
+        return !outgoing_edges.empty() && std::all_of(outgoing_edges.begin(), outgoing_edges.end(),
+                [this](const int edge_index) { return IsEdgeFull(edge_index); });
+    }
+
     template <typename MP>
     int GetMessageProcessorIndexImpl(const TypeSpecifier<MP>&) noexcept {
         return -1;
@@ -92,6 +599,9 @@ public:
     template <typename GlobalPiper>
     void FillEdgeProxysImpl(GlobalPiper&, Vector<std::unique_ptr<Piper::EdgeProxy<GlobalPiper>>>&) {}
     void GetEdgeIndexImpl() {}
+    void OnEdgeUsedImpl() {}
+    void GetReplicaEdgeIndexImpl() {}
+    void GetReplicasCountImpl() {}
     template <typename GlobalPiper>
     void AddMessageProcessorsImpl(GlobalPiper& ,
                                   Vector<std::unique_ptr<Piper::MessageProcessorProxy<GlobalPiper>>>&) {}
@@ -99,30 +609,191 @@ public:
     virtual ~Piper() noexcept {}
 };
 
+template <typename ... Args>
+const int64_t Piper<Args...>::timer_tick_duration = 100; // 100us
+
+template <typename ... Args>
+const size_t Piper<Args...>::max_receive_batch_size = 64;
+
 template <typename T>
 class ReceivingFrom {};
 
-template <typename From, typename To, typename Message, typename ... Args>
-class Piper<Edge<From, To, Message>, Args...> : public Piper<Args...> {
-protected:
-    template <typename GlobalPiper, typename From2>
-    class SenderProxy {
-    public:
-        SenderProxy(GlobalPiper& piper) noexcept
-        : piper(piper)
-        {}
+// Message processors may receive queued messages of an edge in batches by
+// providing
+//     template <typename Sender>
+//     void ReceiveBatch(const ReceivingFrom<From>&, const MessageBatch<Message>& batch, const Sender& sender);
+// instead of Receive for that edge. Up to max_receive_batch_size (64)
+// messages are taken from the queue before the call, so if it throws they
+// are lost, while a message whose Receive throws stays queued and is
+// delivered again.
+template <typename MP, typename From, typename Message, typename Sender, typename = void>
+class BatchReceiving {
+public:
+    static constexpr bool is_supported = false;
+};
+
+template <typename MP, typename From, typename Message, typename Sender>
+class BatchReceiving<MP, From, Message, Sender, std::void_t<decltype(std::declval<MP&>().ReceiveBatch(
+        std::declval<const ReceivingFrom<From>&>(), std::declval<const MessageBatch<Message>&>(), std::declval<const Sender&>()))>> {
+public:
+    static constexpr bool is_supported = true;
+};
+
+// Handle through which a message processor sends messages.
+template <typename GlobalPiper, typename From2>
+class SenderProxy {
+public:
+    // A sender of a delivery is receiving, see Send.
+    SenderProxy(GlobalPiper& piper, const int message_processor_index, const int replica_index, const bool is_receiving) noexcept
+    : piper(piper)
+    , message_processor_index(message_processor_index)
+    , replica_index(replica_index)
+    , is_receiving(is_receiving)
+    {}
+
+    // Throws std::length_error if the edge is full or a remote edge does not
+    // take the message. Thrown out of Receive, it would leave the received
+    // message in its queue to be delivered again with every send repeated, so
+    // while receiving the message goes past the capacity instead: an edge
+    // overshoots by no more than one Receive sends. A remote edge which does
+    // not take it then drops and counts it.
+    template <typename To2, typename Message2>
+    void Send(std::unique_ptr<Message2>&& message) const {
+        TypeSpecifier<Edge<From2, To2, Message2>> edge;
+        int edge_index = piper.GetEdgeIndexImpl(edge, *message, replica_index);
+        if (!ReserveEdgeSlot(edge_index)) {
+            throw std::length_error("Message is sent to a full edge");
+        }
+        if (!piper.template SendToReservedEdge<GlobalPiper>(edge_index, std::move(message)) && !is_receiving) {
+            throw std::length_error("Message is not taken by a remote edge");
+        }
+        piper.OnEdgeUsedImpl(edge, edge_index);
+    }
+
+    template <typename ... To2, typename Message2>
+    void Broadcast(std::unique_ptr<Message2>&& message) const {
+        Vector<int> edge_indices;
+        (AddReplicaEdges<To2, Message2>(&edge_indices), ...);
+        SendShared(edge_indices, std::move(message));
+    }
+
+    template <typename To2, typename Message2>
+    void Multicast(const Vector<int>& to_replicas, std::unique_ptr<Message2>&& message) const {
+        Vector<int> edge_indices;
+        for (int to_replica : to_replicas) {
+            edge_indices.push_back(piper.GetReplicaEdgeIndexImpl(TypeSpecifier<Edge<From2, To2, Message2>>(),
+                        replica_index, to_replica));
+        }
+        SendShared(edge_indices, std::move(message));
+    }
+
+    template <typename To2, typename Message2>
+    uint64_t SendAfter(const int64_t delay, std::unique_ptr<Message2>&& message) const {
+        int edge_index = piper.GetEdgeIndexImpl(TypeSpecifier<Edge<From2, To2, Message2>>(), *message, replica_index);
+        return piper.timer_wheels[message_processor_index].Schedule(GetMonotonicTime() + delay,
+                InlineMessage{edge_index, std::move(message)});
+    }
+
+    // Schedules a timer which delivers nothing but wakes up the owner thread.
+    uint64_t WakeUpAfter(const int64_t delay) const {
+        return piper.timer_wheels[message_processor_index].Schedule(GetMonotonicTime() + delay, InlineMessage{-1, nullptr});
+    }
+
+    bool CancelTimer(const uint64_t timer_id) const noexcept {
+        return piper.timer_wheels[message_processor_index].Cancel(timer_id);
+    }
+
+    bool IsTimerPending(const uint64_t timer_id) const noexcept {
+        return piper.timer_wheels[message_processor_index].IsScheduled(timer_id);
+    }
+
+    // Returns false and keeps the message if the edge is full, a remote edge
+    // is full when its channel has no space.
+    template <typename To2, typename Message2>
+    bool TrySend(std::unique_ptr<Message2>& message) const {
+        TypeSpecifier<Edge<From2, To2, Message2>> edge;
+        int edge_index = piper.GetEdgeIndexImpl(edge, *message, replica_index);
+        if (piper.IsRemoteEdge(edge_index)) {
+            if (!piper.SendToRemoteChannel(edge_index, *message, false)) {
+                return false;
+            }
+            message.reset();
+        } else {
+            if (!piper.ReserveEdgeSlot(edge_index)) {
+                return false;
+            }
+            piper.template SendToReservedEdge<GlobalPiper>(edge_index, std::move(message));
+        }
+        piper.OnEdgeUsedImpl(edge, edge_index);
+        return true;
+    }
+
+    bool IsDownstreamSaturated() const noexcept {
+        return piper.IsSaturated(message_processor_index);
+    }
+
+    int GetReplicaIndex() const noexcept {
+        return replica_index;
+    }
+private:
+    bool ReserveEdgeSlot(const int edge_index) const noexcept {
+        if (piper.ReserveEdgeSlot(edge_index)) {
+            return true;
+        }
+        if (!is_receiving) {
+            return false;
+        }
+        piper.ForceReserveEdgeSlot(edge_index);
+        return true;
+    }
+
+    template <typename To2, typename Message2>
+    void AddReplicaEdges(Vector<int>* edge_indices) const {
+        TypeSpecifier<Edge<From2, To2, Message2>> edge;
+        for (int to_replica = 0; to_replica < piper.GetReplicasCountImpl(edge); ++to_replica) {
+            edge_indices->push_back(piper.GetReplicaEdgeIndexImpl(edge, replica_index, to_replica));
+        }
+    }
 
-        template <typename To2, typename Message2>
-        void Send(std::unique_ptr<Message2>&& message) const {
-            int edge_index = piper.GetEdgeIndexImpl(TypeSpecifier<Edge<From2, To2, Message2>>());
-            piper.queues[edge_index].Push(std::move(message));
-            if (piper.notify_condition_variables[edge_index] != nullptr) {
-                piper.notify_condition_variables[edge_index]->notify_one();
+    template <typename Message2>
+    void SendShared(const Vector<int>& edge_indices, std::unique_ptr<Message2>&& message) const {
+        if (edge_indices.empty()) {
+            return;
+        }
+        for (size_t i = 0; i < edge_indices.size(); ++i) {
+            if (!ReserveEdgeSlot(edge_indices[i])) {
+                for (size_t j = 0; j < i; ++j) {
+                    piper.ReleaseEdgeSlot(edge_indices[j]);
+                }
+                throw std::length_error("Message is sent to a full edge");
             }
         }
-    private:
-        GlobalPiper& piper;
-    };
+        bool is_thread_local = std::all_of(edge_indices.begin(), edge_indices.end(),
+                [this](const int edge_index) { return piper.IsInlineEdge(edge_index); });
+        auto payload = new SharedPayload<Message2>(std::move(message), edge_indices.size(), is_thread_local);
+        bool is_taken = true;
+        for (int edge_index : edge_indices) {
+            is_taken &= piper.template SendToReservedEdge<GlobalPiper>(edge_index,
+                    std::make_unique<SharedMessage<Message2>>(payload));
+        }
+        if (!is_taken && !is_receiving) {
+            throw std::length_error("Message is not taken by a remote edge");
+        }
+    }
+
+    GlobalPiper& piper;
+    int message_processor_index;
+    int replica_index;
+    bool is_receiving;
+};
+
+template <typename FromSpec, typename ToSpec, typename Message, int64_t Capacity, typename ... Args>
+class Piper<Edge<FromSpec, ToSpec, Message, Capacity>, Args...> : public Piper<Args...> {
+protected:
+    using From = typename ReplicaTraits<FromSpec>::Type;
+    using To = typename ReplicaTraits<ToSpec>::Type;
+    static constexpr int from_replicas = ReplicaTraits<FromSpec>::replicas_count;
+    static constexpr int to_replicas = ReplicaTraits<ToSpec>::replicas_count;
 
     template <typename GlobalPiper, typename MP>
     class MessageProcessorProxy : public Piper<>::MessageProcessorProxy<GlobalPiper> {
@@ -132,103 +803,273 @@ protected:
 
         virtual bool Ping() const {
             auto& message_processor = MessageProcessorProxy::template GetMessageProcessor<MP>();
-            return message_processor.Ping(SenderProxy<GlobalPiper, MP>(piper));
+            return message_processor.Ping(SenderProxy<GlobalPiper, MP>(piper,
+                        MessageProcessorProxy::message_processor_index, MessageProcessorProxy::replica_index, false));
         }
         virtual std::string GetName() const noexcept {
             return typeid(MP).name();
         }
+        virtual MessageProcessorPriority GetPriority() const noexcept {
+            return MP::priority;
+        }
+        virtual size_t GetMessageProcessorSize() const noexcept {
+            return sizeof(MP);
+        }
+        virtual void Checkpoint(CheckpointWriter& writer) const {
+            MessageProcessorCheckpointing<MP>::Checkpoint(MessageProcessorProxy::template GetMessageProcessor<MP>(), writer);
+        }
+        virtual void Restore(CheckpointReader& reader) const {
+            MessageProcessorCheckpointing<MP>::Restore(MessageProcessorProxy::template GetMessageProcessor<MP>(), reader);
+        }
     };
 
     template <typename GlobalPiper>
     class EdgeProxy : public Piper<>::EdgeProxy<GlobalPiper> {
     public:
-        using Piper<>::EdgeProxy<GlobalPiper>::EdgeProxy;
         using Piper<>::EdgeProxy<GlobalPiper>::piper;
 
-        virtual bool NotifyAboutMessage() const {
+        EdgeProxy(GlobalPiper& piper, const int from_replica, const int to_replica) noexcept
+        : Piper<>::EdgeProxy<GlobalPiper>(piper)
+        , from_replica(from_replica)
+        , to_replica(to_replica)
+        {}
+
+        virtual size_t NotifyAboutMessage() const {
+            if constexpr (is_batch_received) {
+                return DeliverBatch();
+            }
             auto& cur_piper = *dynamic_cast<Piper *>(&piper);
-            To* message_processor = dynamic_cast<To*>(cur_piper.message_processors[cur_piper.cur_to_index].get());
-            auto& current_queue = cur_piper.queues[cur_piper.cur_edge_index];
+            auto& current_queue = cur_piper.queues[GetEdgeIndex()];
             bool was_callback_called = false;
-            current_queue.PopWithHeadDataCallback([&message_processor, &was_callback_called, this] (const MessageBase& message_base) {
-                 const Message* message = dynamic_cast<const Message*>(&message_base);
-                 message_processor->Receive(ReceivingFrom<From>(), *message, SenderProxy<GlobalPiper, To>(piper));
+            current_queue.PopWithHeadDataCallback([&was_callback_called, &cur_piper, this] (const MessageBase& message_base) {
+                 cur_piper.delivered_enqueue_times[GetEdgeIndex()] = message_base.enqueue_time;
+                 DeliverMessage(message_base);
                  was_callback_called = true;
             });
-            return was_callback_called;
+            if (was_callback_called) {
+                cur_piper.OnMessageTaken(GetEdgeIndex());
+            }
+            return was_callback_called ? 1 : 0;
+        }
+
+        // A single message, such as an inline one, makes a batch of its own.
+        virtual void DeliverMessage(const MessageBase& message_base) const {
+            auto& cur_piper = *dynamic_cast<Piper *>(&piper);
+            To* message_processor = dynamic_cast<To*>(cur_piper.message_processors[GetToIndex()].get());
+            const Message* message = static_cast<const Message*>(&message_base.GetPayload());
+            if constexpr (is_batch_received) {
+                auto& batch_builder = GetBatchBuilder();
+                batch_builder.Clear();
+                batch_builder.Add(*message);
+                message_processor->ReceiveBatch(ReceivingFrom<From>(), batch_builder.Get(),
+                        SenderProxy<GlobalPiper, To>(piper, GetToIndex(), to_replica, true));
+            } else {
+                message_processor->Receive(ReceivingFrom<From>(), *message, SenderProxy<GlobalPiper, To>(piper, GetToIndex(), to_replica, true));
+            }
         }
 
-        virtual void SetConditionVariable(std::condition_variable_any * cv) const noexcept {
+        // Up to max_receive_batch_size queued messages are copied into one
+        // batch, so the receiving call and the message processor lookup are
+        // paid once per batch. The payload type is known for the edge, each
+        // message is only cast statically. The sending time of the first,
+        // longest waiting, message is kept.
+        size_t DeliverBatch() const {
             auto& cur_piper = *dynamic_cast<Piper *>(&piper);
-            cur_piper.notify_condition_variables[cur_piper.cur_edge_index] = cv;
+            auto& current_queue = cur_piper.queues[GetEdgeIndex()];
+            auto& batch_builder = GetBatchBuilder();
+            batch_builder.Clear();
+            size_t messages_count = 0;
+            while (messages_count < Piper<>::max_receive_batch_size) {
+                auto message = current_queue.PopWithHeadDataCallback([&cur_piper, messages_count, this] (const MessageBase& message_base) {
+                    if (messages_count == 0) {
+                        cur_piper.delivered_enqueue_times[GetEdgeIndex()] = message_base.enqueue_time;
+                    }
+                });
+                if (!message) {
+                    break;
+                }
+                batch_builder.Add(*static_cast<const Message*>(&message->GetPayload()));
+                cur_piper.OnMessageTaken(GetEdgeIndex());
+                ++messages_count;
+            }
+            if (messages_count != 0) {
+                To* message_processor = dynamic_cast<To*>(cur_piper.message_processors[GetToIndex()].get());
+                message_processor->ReceiveBatch(ReceivingFrom<From>(), batch_builder.Get(),
+                        SenderProxy<GlobalPiper, To>(piper, GetToIndex(), to_replica, true));
+            }
+            return messages_count;
+        }
+
+        virtual void SetWakeUpSignal(WakeUpSignal* signal) const noexcept {
+            auto& cur_piper = *dynamic_cast<Piper *>(&piper);
+            cur_piper.notify_signals[GetEdgeIndex()] = signal;
+        }
+
+        virtual void SetInlineDelivery(const bool is_inline) const noexcept {
+            auto& cur_piper = *dynamic_cast<Piper *>(&piper);
+            cur_piper.inline_delivery[GetEdgeIndex()] = is_inline;
         }
 
         virtual int GetFromIndex() const noexcept {
             auto& cur_piper = *dynamic_cast<Piper *>(&piper);
-            return cur_piper.cur_from_index;
+            return cur_piper.cur_from_index + from_replica;
         }
 
         virtual int GetToIndex() const noexcept {
             auto& cur_piper = *dynamic_cast<Piper *>(&piper);
-            return cur_piper.cur_to_index;
+            return cur_piper.cur_to_index + to_replica;
+        }
+
+        int GetEdgeIndex() const noexcept {
+            auto& cur_piper = *dynamic_cast<Piper *>(&piper);
+            return cur_piper.cur_edge_index + from_replica * to_replicas + to_replica;
         }
 
         virtual ~EdgeProxy() noexcept {}
+    private:
+        static constexpr bool is_batch_received = BatchReceiving<To, From, Message, SenderProxy<GlobalPiper, To>>::is_supported;
+
+        static typename MessageBatchTraits<Message>::Builder& GetBatchBuilder() {
+            static thread_local typename MessageBatchTraits<Message>::Builder batch_builder;
+            return batch_builder;
+        }
+
+        int from_replica;
+        int to_replica;
     };
+
+    template <typename Routing>
+    int ChooseReceiverReplica(const Message&, const int from_replica, const TypeSpecifier<Routing>&) noexcept {
+        return next_receiver_replicas[from_replica];
+    }
+
+    int ChooseReceiverReplica(const Message& message, const int, const TypeSpecifier<KeyHashRouting>&) noexcept {
+        const auto& key = message.GetRoutingKey();
+        return std::hash<std::decay_t<decltype(key)>>()(key) % to_replicas;
+    }
 public:
     using Piper<Args...>::max_message_processor_index;
     using Piper<Args...>::GetMessageProcessorIndexImpl;
     using Piper<Args...>::max_edge_index;
     using Piper<Args...>::dest_pipes;
+    using Piper<Args...>::source_pipes;
     using Piper<Args...>::queues;
+    using Piper<Args...>::queue_sizes;
+    using Piper<Args...>::edge_capacities;
     using Piper<Args...>::message_processors;
-    using Piper<Args...>::notify_condition_variables;
+    using Piper<Args...>::message_processor_replicas;
+    using Piper<Args...>::notify_signals;
+    using Piper<Args...>::inline_delivery;
+    using Piper<Args...>::timestamped_edges;
+    using Piper<Args...>::delivered_enqueue_times;
+    using Piper<Args...>::edge_deadlines;
+    using Piper<Args...>::remote_channels;
+    using Piper<Args...>::remote_message_processors;
+    using Piper<Args...>::timer_wheels;
+    using Piper<Args...>::timer_tick_duration;
+    using Piper<Args...>::message_serializers;
+    using Piper<Args...>::message_deserializers;
     using Piper<Args...>::GetEdgeIndexImpl;
+    using Piper<Args...>::OnEdgeUsedImpl;
+    using Piper<Args...>::GetReplicaEdgeIndexImpl;
+    using Piper<Args...>::GetReplicasCountImpl;
 
     Piper() noexcept
     : Piper<Args...>()
+    , next_receiver_replicas(from_replicas, 0)
     {
     }
 
     template <typename GlobalPiper, typename MP>
     void AddMessageProcessorIfNotExists(int& target_index,
+                                        const int replicas_count,
                                         GlobalPiper& piper,
                                         Vector<std::unique_ptr<Piper<>::MessageProcessorProxy<GlobalPiper>>>& message_processor_handlers) {
         target_index = Piper<Args...>::GetMessageProcessorIndexImpl(TypeSpecifier<MP>());
         if (target_index == -1) {
-            target_index = max_message_processor_index++;
-            dest_pipes.push_back(Vector<int>());
-            message_processors.push_back(std::make_unique<MP>());
-            message_processor_handlers.push_back(std::make_unique<MessageProcessorProxy<GlobalPiper, MP>>(piper, target_index));
+            target_index = max_message_processor_index;
+            max_message_processor_index += replicas_count;
+            for (int replica_index = 0; replica_index < replicas_count; ++replica_index) {
+                dest_pipes.push_back(Vector<int>());
+                source_pipes.push_back(Vector<int>());
+                message_processors.push_back(std::make_unique<MP>());
+                message_processor_replicas.push_back(replicas_count);
+                remote_message_processors.push_back(false);
+                timer_wheels.push_back(TimingWheel<InlineMessage>(timer_tick_duration, GetMonotonicTime()));
+                message_processor_handlers.push_back(std::make_unique<MessageProcessorProxy<GlobalPiper, MP>>(
+                            piper, target_index + replica_index, replica_index, replicas_count));
+            }
         }
+        assert(message_processor_replicas[target_index] == replicas_count);
     }
 
     template <typename GlobalPiper>
     void AddMessageProcessorsImpl(GlobalPiper& piper,
                                   Vector<std::unique_ptr<Piper<>::MessageProcessorProxy<GlobalPiper>>>& message_processor_handlers) {
         Piper<Args...>::template AddMessageProcessorsImpl<GlobalPiper>(piper, message_processor_handlers);
-        AddMessageProcessorIfNotExists<GlobalPiper, From>(cur_from_index, piper, message_processor_handlers);
-        AddMessageProcessorIfNotExists<GlobalPiper, To>(cur_to_index, piper, message_processor_handlers);
-        cur_edge_index = max_edge_index++;
-        dest_pipes[cur_to_index].push_back(cur_edge_index);
-        notify_condition_variables.push_back(nullptr);
+        AddMessageProcessorIfNotExists<GlobalPiper, From>(cur_from_index, from_replicas, piper, message_processor_handlers);
+        if constexpr (std::is_same_v<From, To>) {
+            static_assert(from_replicas == to_replicas);
+            cur_to_index = cur_from_index;
+        } else {
+            AddMessageProcessorIfNotExists<GlobalPiper, To>(cur_to_index, to_replicas, piper, message_processor_handlers);
+        }
+        cur_edge_index = max_edge_index;
+        max_edge_index += from_replicas * to_replicas;
+        for (int from_replica = 0; from_replica < from_replicas; ++from_replica) {
+            for (int to_replica = 0; to_replica < to_replicas; ++to_replica) {
+                int edge_index = cur_edge_index + from_replica * to_replicas + to_replica;
+                dest_pipes[cur_to_index + to_replica].push_back(edge_index);
+                source_pipes[cur_from_index + from_replica].push_back(edge_index);
+                notify_signals.push_back(nullptr);
+                inline_delivery.push_back(false);
+                timestamped_edges.push_back(To::priority == MessageProcessorPriority::Critical);
+                remote_channels.push_back(nullptr);
+                delivered_enqueue_times.push_back(0);
+                edge_capacities.push_back(Capacity);
+                message_serializers.push_back(MessageSerialization<Message>::serializer);
+                message_deserializers.push_back(MessageSerialization<Message>::deserializer);
+            }
+        }
         queues = Vector<LockFreeQueue<MessageBase>>(max_edge_index);
+        queue_sizes = Vector<std::atomic<int64_t>>(max_edge_index);
+        edge_deadlines = Vector<std::atomic<int64_t>>(max_edge_index);
     }
 
     template <typename GlobalPiper>
     void FillEdgeProxysImpl(GlobalPiper& piper, Vector<std::unique_ptr<Piper<>::EdgeProxy<GlobalPiper>>>& edge_handers) {
         Piper<Args...>::template FillEdgeProxysImpl<GlobalPiper>(piper, edge_handers);
-        edge_handers.push_back(std::make_unique<EdgeProxy<GlobalPiper>>(piper));
+        for (int from_replica = 0; from_replica < from_replicas; ++from_replica) {
+            for (int to_replica = 0; to_replica < to_replicas; ++to_replica) {
+                edge_handers.push_back(std::make_unique<EdgeProxy<GlobalPiper>>(piper, from_replica, to_replica));
+            }
+        }
     }
 
     int GetMessageProcessorIndexImpl(const TypeSpecifier<From>&) noexcept {
         return cur_from_index;
     }
-    int GetMessageProcessorIndexImpl(const TypeSpecifier<To>&) noexcept {
+    int GetMessageProcessorIndexImpl(const std::conditional_t<std::is_same_v<From, To>, SelfEdgeSpecifier, TypeSpecifier<To>>&) noexcept {
         return cur_to_index;
     }
-    int GetEdgeIndexImpl(const TypeSpecifier<Edge<From, To, Message>>&) noexcept {
-        return cur_edge_index;
+    int GetEdgeIndexImpl(const TypeSpecifier<Edge<From, To, Message>>&, const Message& message, const int from_replica) noexcept {
+        int to_replica = to_replicas == 1 ? 0 : ChooseReceiverReplica(message, from_replica,
+                TypeSpecifier<typename ReplicaTraits<ToSpec>::Routing>());
+        return GetReplicaEdgeIndexImpl(TypeSpecifier<Edge<From, To, Message>>(), from_replica, to_replica);
+    }
+    // Round robin moves on only once a message is sent, so failed TrySend
+    // calls do not skew it.
+    void OnEdgeUsedImpl(const TypeSpecifier<Edge<From, To, Message>>&, const int edge_index) noexcept {
+        int from_replica = (edge_index - cur_edge_index) / to_replicas;
+        int to_replica = (edge_index - cur_edge_index) % to_replicas;
+        next_receiver_replicas[from_replica] = (to_replica + 1) % to_replicas;
+    }
+    int GetReplicaEdgeIndexImpl(const TypeSpecifier<Edge<From, To, Message>>&, const int from_replica, const int to_replica) const noexcept {
+        assert(to_replica >= 0 && to_replica < to_replicas);
+        return cur_edge_index + from_replica * to_replicas + to_replica;
+    }
+    int GetReplicasCountImpl(const TypeSpecifier<Edge<From, To, Message>>&) const noexcept {
+        return to_replicas;
     }
 
     virtual ~Piper() {}
@@ -236,6 +1077,7 @@ private:
     int cur_to_index;
     int cur_from_index;
     int cur_edge_index;
+    Vector<int> next_receiver_replicas;
 };
 
 template <typename ... Args>
@@ -298,6 +1140,162 @@ public:
         return connecting_edges;
     }
 
+    int GetInlineMessageEdge() const noexcept {
+        const auto& inline_messages = GetInlineMessages<GlobalPiper>();
+        return inline_messages.empty() ? -1 : inline_messages.front().edge_index;
+    }
+
+    void DeliverInlineMessage() {
+        auto& inline_messages = GetInlineMessages<GlobalPiper>();
+        InlineMessage inline_message = std::move(inline_messages.front());
+        inline_messages.pop_front();
+        GlobalPiper::OnMessageTaken(inline_message.edge_index);
+        GlobalPiper::delivered_enqueue_times[inline_message.edge_index] = inline_message.message->enqueue_time;
+        edge_handers[inline_message.edge_index]->DeliverMessage(*inline_message.message);
+    }
+
+    void FlushInlineMessages() {
+        auto& inline_messages = GetInlineMessages<GlobalPiper>();
+        for (auto& inline_message : inline_messages) {
+            GlobalPiper::queue_sizes[inline_message.edge_index].fetch_sub(1, std::memory_order_relaxed);
+            inline_message.message->OnLeavingThread();
+            GlobalPiper::PushMessage(inline_message.edge_index, std::move(inline_message.message));
+        }
+        inline_messages.clear();
+    }
+
+    bool AdvanceTimers(const int message_processor_index, const int64_t current_time) {
+        return GlobalPiper::timer_wheels[message_processor_index].Advance(current_time, [this](InlineMessage&& inline_message) {
+            if (inline_message.edge_index != -1) {
+                GlobalPiper::template ForceSendToEdge<GlobalPiper>(inline_message.edge_index, std::move(inline_message.message));
+            }
+        });
+    }
+
+    int64_t GetNextTimerDeadline(const int message_processor_index) noexcept {
+        return GlobalPiper::timer_wheels[message_processor_index].GetNextDeadline();
+    }
+
+    // Index of the first replica of the message processor.
+    template <typename MP>
+    int GetMessageProcessorIndex() noexcept {
+        return GlobalPiper::GetMessageProcessorIndexImpl(TypeSpecifier<MP>());
+    }
+
+    // Messages sent to the edge are serialized into the channel instead of
+    // the local queue. Returns false if messages of the edge can not be
+    // serialized. Must be set before messages are sent.
+    bool SetRemoteChannel(const int edge_index, RemoteChannel* channel) noexcept {
+        if (channel != nullptr && !IsEdgeSerializable(edge_index)) {
+            return false;
+        }
+        GlobalPiper::remote_channels[edge_index] = channel;
+        return true;
+    }
+
+    bool IsEdgeSerializable(const int edge_index) const noexcept {
+        return GlobalPiper::message_serializers[edge_index] != nullptr && GlobalPiper::message_deserializers[edge_index] != nullptr;
+    }
+
+    // A remote message processor runs in another process, it is kept here
+    // only for the shape of the topology and must not be pinged.
+    void SetMessageProcessorRemote(const int message_processor_index, const bool is_remote) noexcept {
+        GlobalPiper::remote_message_processors[message_processor_index] = is_remote;
+    }
+
+    bool IsMessageProcessorRemote(const int message_processor_index) const noexcept {
+        return GlobalPiper::remote_message_processors[message_processor_index];
+    }
+
+    // Zero if no pending message of the message processor has a deadline.
+    int64_t GetEarliestDeadline(const int message_processor_index) const noexcept {
+        return GlobalPiper::GetEarliestDeadline(message_processor_index);
+    }
+
+    // Whether messages to the edge carry the time they were sent at.
+    bool IsEdgeTimestamped(const int edge_index) const noexcept {
+        return GlobalPiper::timestamped_edges[edge_index] || GlobalPiper::is_latency_measured.load(std::memory_order_relaxed);
+    }
+
+    // Messages sent from now on carry the time they were sent at.
+    void SetLatencyMeasured(const bool is_measured) noexcept {
+        GlobalPiper::is_latency_measured.store(is_measured, std::memory_order_relaxed);
+    }
+
+    // Sending time of the last message delivered through the edge.
+    int64_t GetDeliveredEnqueueTime(const int edge_index) const noexcept {
+        return GlobalPiper::delivered_enqueue_times[edge_index];
+    }
+
+    // Passing nullptr stops recording. Returns once no sender uses the
+    // previous recorder, so it may be destroyed right after.
+    void SetTrafficRecorder(TrafficRecorder* recorder) noexcept {
+        GlobalPiper::traffic_recorder.store(recorder);
+        while (GlobalPiper::recording_senders_count.load() != 0) {
+            std::this_thread::yield();
+        }
+    }
+
+    bool ReplayMessage(const TrafficRecord& record) {
+        if (record.edge_index < 0 || record.edge_index >= static_cast<int>(edge_handers.size()) ||
+                GlobalPiper::message_deserializers[record.edge_index] == nullptr) {
+            return false;
+        }
+        GlobalPiper::PushMessage(record.edge_index,
+                GlobalPiper::message_deserializers[record.edge_index](record.payload, record.payload_size));
+        return true;
+    }
+
+    // Must be called only while no message processor is running. Pending
+    // messages are put back in their order. Returns the number of pending
+    // messages which are not saved as they can not be serialized, pending
+    // timers are not saved either.
+    size_t WriteCheckpoint(CheckpointFileWriter& checkpoint) {
+        for (int i = 0; i < static_cast<int>(message_processor_handlers.size()); ++i) {
+            if (!IsMessageProcessorRemote(i)) {
+                message_processor_handlers[i]->Checkpoint(checkpoint.GetMessageProcessorSection(i));
+            }
+        }
+        size_t lost_messages_count = 0;
+        std::string payload;
+        Vector<std::unique_ptr<MessageBase>> messages;
+        for (int edge_index = 0; edge_index < static_cast<int>(edge_handers.size()); ++edge_index) {
+            messages.clear();
+            while (auto message = GlobalPiper::queues[edge_index].Pop()) {
+                messages.push_back(std::move(message));
+            }
+            for (auto& message : messages) {
+                if (GlobalPiper::message_serializers[edge_index] == nullptr) {
+                    ++lost_messages_count;
+                } else {
+                    payload.clear();
+                    GlobalPiper::message_serializers[edge_index](message->GetPayload(), payload);
+                    checkpoint.GetEdgeSection(edge_index).WriteString(payload);
+                }
+                GlobalPiper::queues[edge_index].Push(std::move(message));
+            }
+        }
+        return lost_messages_count;
+    }
+
+    // Restores the state of the message processor and the messages pending
+    // for it, meant to be called by the thread which is going to process it.
+    void RestoreMessageProcessor(const int message_processor_index, const CheckpointFile& checkpoint) {
+        CheckpointReader state = checkpoint.GetMessageProcessorSection(message_processor_index);
+        message_processor_handlers[message_processor_index]->Restore(state);
+        std::string payload;
+        for (int edge_index : GlobalPiper::dest_pipes[message_processor_index]) {
+            if (GlobalPiper::message_deserializers[edge_index] == nullptr) {
+                continue;
+            }
+            CheckpointReader messages = checkpoint.GetEdgeSection(edge_index);
+            while (messages.ReadString(payload)) {
+                GlobalPiper::PushMessage(edge_index,
+                        GlobalPiper::message_deserializers[edge_index](payload.data(), payload.size()));
+            }
+        }
+    }
+
     void OutputDestPipes() const noexcept {
         for (auto& pipe: dest_pipes) {
             std::for_each(pipe.begin(), pipe.end(), [](const int num) {std::cout << " " << num;});
@@ -21,10 +21,26 @@ public:
     int a;
 };
 
+class MessageProcessorBoundedProducer;
+
+class MessageProcessorBroadcaster;
+
+class MessageProcessorDeadlineSender;
+
 class MessageProcessorA : public MessageProcessorBase {
 public:
     using MessageProcessorBase::MessageProcessorBase;
 
+    template <typename Sender>
+    void Receive(const ReceivingFrom<MessageProcessorBoundedProducer>&, const IntMessage& value, const Sender& sender) {
+        std::cout << "MessageProcessorA: I have got int value from MessageProcessorBoundedProducer " << value.a << std::endl;
+    }
+
+    template <typename Sender>
+    void Receive(const ReceivingFrom<MessageProcessorBroadcaster>&, const IntMessage& value, const Sender& sender) {
+        std::cout << "MessageProcessorA: I have got int value from MessageProcessorBroadcaster " << value.a << std::endl;
+    }
+
     template <typename Sender>
     void Receive(const ReceivingFrom<MessageProcessorB>&, const DoubleMessage& value, const Sender& sender) {
         std::cout << "MessageProcessorA: I have got double value from MessageProcessorB " << value.a << std::endl;
@@ -56,7 +72,7 @@ public:
     virtual ~MessageProcessorB() {}
 };
 
-int main(){
+void TestQueuedDelivery() {
     MessagePassingTree<
         Edge<MessageProcessorA, MessageProcessorB, IntMessage>,
         Edge<MessageProcessorB, MessageProcessorA, DoubleMessage>> message_passing_tree;
@@ -67,5 +83,444 @@ int main(){
         message_passing_tree.GetEdgeProxy(1)->NotifyAboutMessage();
     }
     message_passing_tree.OutputDestPipes();
+}
+
+void TestInlineDelivery() {
+    MessagePassingTree<
+        Edge<MessageProcessorA, MessageProcessorB, IntMessage>,
+        Edge<MessageProcessorB, MessageProcessorA, DoubleMessage>> message_passing_tree;
+
+    message_passing_tree.GetEdgeProxy(0)->SetInlineDelivery(true);
+    message_passing_tree.GetEdgeProxy(1)->SetInlineDelivery(true);
+    message_passing_tree.GetMessageProcessorProxy(0)->Ping();
+    for (size_t i = 0; i < 10 && message_passing_tree.GetInlineMessageEdge() != -1; ++i) {
+        message_passing_tree.DeliverInlineMessage();
+    }
+    message_passing_tree.FlushInlineMessages();
+    std::cout << "Inline messages left: " << (message_passing_tree.GetInlineMessageEdge() != -1) << std::endl;
+    message_passing_tree.GetEdgeProxy(0)->SetInlineDelivery(false);
+    message_passing_tree.GetEdgeProxy(1)->SetInlineDelivery(false);
+    for (size_t i = 0; i < 2; ++i) {
+        message_passing_tree.GetEdgeProxy(0)->NotifyAboutMessage();
+        message_passing_tree.GetEdgeProxy(1)->NotifyAboutMessage();
+    }
+}
+
+class KeyedIntMessage : public MessageBase {
+public:
+    KeyedIntMessage(const int key)
+    : key(key)
+    {}
+    int GetRoutingKey() const noexcept {
+        return key;
+    }
+    int key;
+};
+
+class MessageProcessorWorker;
+
+class MessageProcessorProducer : public MessageProcessorBase {
+public:
+    using MessageProcessorBase::MessageProcessorBase;
+
+    template <typename Sender>
+    bool Ping(const Sender& sender) {
+        for (int i = 0; i < 6; ++i) {
+            sender.template Send<MessageProcessorWorker>(std::make_unique<IntMessage>(i));
+        }
+        return true;
+    }
+};
+
+class MessageProcessorKeyedProducer : public MessageProcessorBase {
+public:
+    using MessageProcessorBase::MessageProcessorBase;
+
+    template <typename Sender>
+    bool Ping(const Sender& sender) {
+        for (int i = 0; i < 6; ++i) {
+            sender.template Send<MessageProcessorWorker>(std::make_unique<KeyedIntMessage>(7));
+        }
+        return true;
+    }
+};
+
+class MessageProcessorWorker : public MessageProcessorBase {
+public:
+    using MessageProcessorBase::MessageProcessorBase;
+
+    template <typename Sender>
+    void Receive(const ReceivingFrom<MessageProcessorProducer>&, const IntMessage&, const Sender& sender) {
+        ++received_count;
+    }
+    template <typename Sender>
+    void Receive(const ReceivingFrom<MessageProcessorKeyedProducer>&, const KeyedIntMessage&, const Sender& sender) {
+        ++received_count;
+    }
+    int received_count = 0;
+};
+
+void TestReplicatedDelivery() {
+    MessagePassingTree<
+        Edge<MessageProcessorProducer, Replicated<MessageProcessorWorker, 3>, IntMessage>,
+        Edge<MessageProcessorKeyedProducer, Replicated<MessageProcessorWorker, 3, KeyHashRouting>, KeyedIntMessage>> message_passing_tree;
+
+    for (int i = 0; i < static_cast<int>(message_passing_tree.GetMessageProcessorsCount()); ++i) {
+        message_passing_tree.GetMessageProcessorProxy(i)->Ping();
+    }
+    for (int i = 0; i < static_cast<int>(message_passing_tree.GetEdgesCount()); ++i) {
+        while (message_passing_tree.GetEdgeProxy(i)->NotifyAboutMessage()) {}
+    }
+    for (int i = 0; i < static_cast<int>(message_passing_tree.GetMessageProcessorsCount()); ++i) {
+        auto message_processor_proxy = message_passing_tree.GetMessageProcessorProxy(i);
+        if (message_processor_proxy->GetReplicasCount() > 1) {
+            std::cout << "Worker replica " << message_processor_proxy->GetReplicaIndex() << " received " <<
+                message_processor_proxy->GetMessageProcessor<MessageProcessorWorker>().received_count << std::endl;
+        }
+    }
+}
+
+class MessageProcessorBoundedProducer : public MessageProcessorBase {
+public:
+    using MessageProcessorBase::MessageProcessorBase;
+
+    template <typename Sender>
+    bool Ping(const Sender& sender) {
+        while (!sender.IsDownstreamSaturated()) {
+            auto message = std::make_unique<IntMessage>(sent_count);
+            if (!sender.template TrySend<MessageProcessorA>(message)) {
+                break;
+            }
+            ++sent_count;
+        }
+        auto message = std::make_unique<IntMessage>(sent_count);
+        std::cout << "Sent " << sent_count << " messages, TrySend to full edge = " <<
+            sender.template TrySend<MessageProcessorA>(message) << ", message kept = " << (message != nullptr) << std::endl;
+        try {
+            sender.template Send<MessageProcessorA>(std::move(message));
+        } catch (const std::length_error&) {
+            std::cout << "Send to full edge throws, message kept = " << (message != nullptr) << std::endl;
+        }
+        return true;
+    }
+    int sent_count = 0;
+};
+
+void TestBoundedEdge() {
+    MessagePassingTree<
+        Edge<MessageProcessorBoundedProducer, MessageProcessorA, IntMessage, 4>> message_passing_tree;
+
+    message_passing_tree.GetMessageProcessorProxy(0)->Ping();
+    std::cout << "Saturated = " << message_passing_tree.IsSaturated(0) << std::endl;
+}
+
+class MessageProcessorRelay;
+
+class MessageProcessorRelaySink;
+
+class MessageProcessorRelaySource : public MessageProcessorBase {
+public:
+    template <typename Sender>
+    bool Ping(const Sender& sender) {
+        for (int i = 0; i < 2; ++i) {
+            sender.template Send<MessageProcessorRelay>(std::make_unique<IntMessage>(i));
+        }
+        return true;
+    }
+};
+
+class MessageProcessorRelay : public MessageProcessorBase {
+public:
+    template <typename Sender>
+    void Receive(const ReceivingFrom<MessageProcessorRelaySource>&, const IntMessage& value, const Sender& sender) {
+        ++received_count;
+        for (int i = 0; i < 2; ++i) {
+            sender.template Send<MessageProcessorRelaySink>(std::make_unique<IntMessage>(value.a));
+        }
+    }
+    int received_count = 0;
+};
+
+class MessageProcessorRelaySink : public MessageProcessorBase {
+public:
+    template <typename Sender>
+    void Receive(const ReceivingFrom<MessageProcessorRelay>&, const IntMessage&, const Sender&) {
+        ++received_count;
+    }
+    int received_count = 0;
+};
+
+// Sends from Receive go past the capacity of one, so nothing is delivered
+// twice.
+void TestSendFromReceiveToFullEdge() {
+    MessagePassingTree<
+        Edge<MessageProcessorRelaySource, MessageProcessorRelay, IntMessage>,
+        Edge<MessageProcessorRelay, MessageProcessorRelaySink, IntMessage, 1>> message_passing_tree;
+
+    message_passing_tree.GetMessageProcessorProxy(message_passing_tree.GetMessageProcessorIndex<MessageProcessorRelaySource>())->Ping();
+    for (bool is_delivered = true; is_delivered; ) {
+        is_delivered = false;
+        for (int i = 0; i < static_cast<int>(message_passing_tree.GetEdgesCount()); ++i) {
+            while (message_passing_tree.GetEdgeProxy(i)->NotifyAboutMessage()) {
+                is_delivered = true;
+            }
+        }
+    }
+    auto relay = message_passing_tree.GetMessageProcessorProxy(message_passing_tree.GetMessageProcessorIndex<MessageProcessorRelay>());
+    auto sink = message_passing_tree.GetMessageProcessorProxy(message_passing_tree.GetMessageProcessorIndex<MessageProcessorRelaySink>());
+    std::cout << "Relay received = " << relay->GetMessageProcessor<MessageProcessorRelay>().received_count <<
+        ", sink received = " << sink->GetMessageProcessor<MessageProcessorRelaySink>().received_count << std::endl;
+}
+
+class MessageProcessorRoundRobinWorker;
+
+class MessageProcessorRoundRobinProducer : public MessageProcessorBase {
+public:
+    using MessageProcessorBase::MessageProcessorBase;
+
+    template <typename Sender>
+    bool Ping(const Sender& sender) {
+        int messages_count = is_first_ping ? 3 : 1;
+        for (int i = 0; i < messages_count; ++i) {
+            auto message = std::make_unique<IntMessage>(i);
+            sent_count += sender.template TrySend<MessageProcessorRoundRobinWorker>(message);
+        }
+        is_first_ping = false;
+        return true;
+    }
+    bool is_first_ping = true;
+    int sent_count = 0;
+};
+
+class MessageProcessorRoundRobinWorker : public MessageProcessorBase {
+public:
+    using MessageProcessorBase::MessageProcessorBase;
+
+    template <typename Sender>
+    void Receive(const ReceivingFrom<MessageProcessorRoundRobinProducer>&, const IntMessage&, const Sender&) {
+        ++received_count;
+    }
+    int received_count = 0;
+};
+
+// The third message finds the first replica full, the round robin still
+// starts from it once there is room.
+void TestBoundedRoundRobin() {
+    MessagePassingTree<
+        Edge<MessageProcessorRoundRobinProducer, Replicated<MessageProcessorRoundRobinWorker, 2>, IntMessage, 1>> message_passing_tree;
+
+    auto producer = message_passing_tree.GetMessageProcessorProxy(0);
+    producer->Ping();
+    for (int i = 0; i < static_cast<int>(message_passing_tree.GetEdgesCount()); ++i) {
+        while (message_passing_tree.GetEdgeProxy(i)->NotifyAboutMessage()) {}
+    }
+    producer->Ping();
+    for (int i = 0; i < static_cast<int>(message_passing_tree.GetEdgesCount()); ++i) {
+        while (message_passing_tree.GetEdgeProxy(i)->NotifyAboutMessage()) {}
+    }
+    std::cout << "Round robin sent " << producer->GetMessageProcessor<MessageProcessorRoundRobinProducer>().sent_count;
+    for (int i = 1; i < static_cast<int>(message_passing_tree.GetMessageProcessorsCount()); ++i) {
+        auto worker = message_passing_tree.GetMessageProcessorProxy(i);
+        std::cout << ", replica " << worker->GetReplicaIndex() << " received " <<
+            worker->GetMessageProcessor<MessageProcessorRoundRobinWorker>().received_count;
+    }
+    std::cout << std::endl;
+}
+
+class MessageProcessorListener : public MessageProcessorBase {
+public:
+    using MessageProcessorBase::MessageProcessorBase;
+
+    template <typename Sender>
+    void Receive(const ReceivingFrom<MessageProcessorBroadcaster>&, const IntMessage& value, const Sender& sender) {
+        std::cout << "MessageProcessorListener: I have got int value " << value.a << " from MessageProcessorBroadcaster at replica " <<
+            sender.GetReplicaIndex() << std::endl;
+        if (value.a == 5) {
+            broadcast_payloads.push_back(reinterpret_cast<uintptr_t>(&value));
+        }
+    }
+    static Vector<uintptr_t> broadcast_payloads;
+};
+
+Vector<uintptr_t> MessageProcessorListener::broadcast_payloads;
+
+class MessageProcessorBroadcaster : public MessageProcessorBase {
+public:
+    using MessageProcessorBase::MessageProcessorBase;
+
+    template <typename Sender>
+    bool Ping(const Sender& sender) {
+        sender.template Broadcast<MessageProcessorListener, MessageProcessorA>(std::make_unique<IntMessage>(5));
+        sender.template Multicast<MessageProcessorListener>(Vector<int>{0, 2}, std::make_unique<IntMessage>(6));
+        return true;
+    }
+};
+
+void TestBroadcast() {
+    MessagePassingTree<
+        Edge<MessageProcessorBroadcaster, Replicated<MessageProcessorListener, 3>, IntMessage>,
+        Edge<MessageProcessorBroadcaster, MessageProcessorA, IntMessage>> message_passing_tree;
+
+    message_passing_tree.GetMessageProcessorProxy(0)->Ping();
+    for (int i = 0; i < static_cast<int>(message_passing_tree.GetEdgesCount()); ++i) {
+        while (message_passing_tree.GetEdgeProxy(i)->NotifyAboutMessage()) {}
+    }
+    auto& payloads = MessageProcessorListener::broadcast_payloads;
+    std::cout << "Broadcast payload shared = " << (payloads.size() == 3 && payloads[0] == payloads[1] && payloads[1] == payloads[2]) << std::endl;
+}
+
+class MessageProcessorTimerUser : public MessageProcessorBase {
+public:
+    using MessageProcessorBase::MessageProcessorBase;
+
+    template <typename Sender>
+    bool Ping(const Sender& sender) {
+        sender.template SendAfter<MessageProcessorTimerUser>(1000, std::make_unique<IntMessage>(1));
+        uint64_t timer_id = sender.template SendAfter<MessageProcessorTimerUser>(2000, std::make_unique<IntMessage>(2));
+        std::cout << "MessageProcessorTimerUser: cancelled timer = " << sender.CancelTimer(timer_id) << std::endl;
+        return false;
+    }
+
+    template <typename Sender>
+    void Receive(const ReceivingFrom<MessageProcessorTimerUser>&, const IntMessage& value, const Sender& sender) {
+        std::cout << "MessageProcessorTimerUser: I have got delayed value " << value.a << std::endl;
+    }
+};
+
+void TestTimers() {
+    MessagePassingTree<
+        Edge<MessageProcessorTimerUser, MessageProcessorTimerUser, IntMessage>> message_passing_tree;
+
+    int64_t start_time = GetMonotonicTime();
+    message_passing_tree.GetMessageProcessorProxy(0)->Ping();
+    std::cout << "Fired before deadline = " << message_passing_tree.AdvanceTimers(0, start_time) << std::endl;
+    std::cout << "Next deadline is set = " << (message_passing_tree.GetNextTimerDeadline(0) <= start_time + 1000 + 100) << std::endl;
+    std::cout << "Fired after deadline = " << message_passing_tree.AdvanceTimers(0, start_time + 5000) << std::endl;
+    while (message_passing_tree.GetEdgeProxy(0)->NotifyAboutMessage()) {}
+}
+
+class MessageProcessorCritical : public MessageProcessorBase {
+public:
+    static constexpr MessageProcessorPriority priority = MessageProcessorPriority::Critical;
+
+    template <typename Sender>
+    void Receive(const ReceivingFrom<MessageProcessorDeadlineSender>&, const IntMessage& value, const Sender& sender) {
+    }
+};
+
+class MessageProcessorDeadlineSender : public MessageProcessorBase {
+public:
+    template <typename Sender>
+    bool Ping(const Sender& sender) {
+        for (int64_t deadline : {3000, 1000, 2000}) {
+            auto message = std::make_unique<IntMessage>(0);
+            message->deadline = deadline;
+            sender.template Send<MessageProcessorCritical>(std::move(message));
+        }
+        return true;
+    }
+};
+
+void TestPriorities() {
+    MessagePassingTree<
+        Edge<MessageProcessorDeadlineSender, MessageProcessorCritical, IntMessage>> message_passing_tree;
+
+    std::cout << "Critical = " << (message_passing_tree.GetMessageProcessorProxy(1)->GetPriority() ==
+            MessageProcessorPriority::Critical) << ", edge timestamped = " << message_passing_tree.IsEdgeTimestamped(0) << std::endl;
+    message_passing_tree.GetMessageProcessorProxy(0)->Ping();
+    std::cout << "Earliest deadline = " << message_passing_tree.GetEarliestDeadline(1) << std::endl;
+    while (message_passing_tree.GetEdgeProxy(0)->NotifyAboutMessage()) {}
+    std::cout << "Earliest deadline after delivery = " << message_passing_tree.GetEarliestDeadline(1) << std::endl;
+}
+
+class PointMessage : public MessageBase {
+public:
+    PointMessage(const double x, const double y)
+    : x(x)
+    , y(y)
+    {}
+
+    class Batch {
+    public:
+        void Add(const PointMessage& message) {
+            xs.push_back(message.x);
+            ys.push_back(message.y);
+        }
+
+        void Clear() noexcept {
+            xs.clear();
+            ys.clear();
+        }
+
+        Vector<double> xs;
+        Vector<double> ys;
+    };
+
+    double x;
+    double y;
+};
+
+class MessageProcessorAggregator;
+
+class MessageProcessorBatchProducer : public MessageProcessorBase {
+public:
+    template <typename Sender>
+    bool Ping(const Sender& sender) {
+        for (int i = 0; i < 100; ++i) {
+            sender.template Send<MessageProcessorAggregator>(std::make_unique<IntMessage>(i));
+            sender.template Send<MessageProcessorAggregator>(std::make_unique<PointMessage>(i, 2 * i));
+        }
+        return true;
+    }
+};
+
+class MessageProcessorAggregator : public MessageProcessorBase {
+public:
+    template <typename Sender>
+    void ReceiveBatch(const ReceivingFrom<MessageProcessorBatchProducer>&, const MessageBatch<IntMessage>& batch, const Sender&) {
+        int64_t sum = 0;
+        for (const IntMessage& message : batch) {
+            sum += message.a;
+        }
+        std::cout << "MessageProcessorAggregator: got " << batch.size() << " ints, sum " << sum << std::endl;
+    }
+
+    template <typename Sender>
+    void ReceiveBatch(const ReceivingFrom<MessageProcessorBatchProducer>&, const PointMessage::Batch& batch, const Sender&) {
+        double dot_product = 0;
+        for (size_t i = 0; i < batch.xs.size(); ++i) {
+            dot_product += batch.xs[i] * batch.ys[i];
+        }
+        std::cout << "MessageProcessorAggregator: got " << batch.xs.size() << " points, dot product " << dot_product << std::endl;
+    }
+};
+
+void TestBatchReceive() {
+    MessagePassingTree<
+        Edge<MessageProcessorBatchProducer, MessageProcessorAggregator, IntMessage>,
+        Edge<MessageProcessorBatchProducer, MessageProcessorAggregator, PointMessage>> message_passing_tree;
+
+    message_passing_tree.GetMessageProcessorProxy(0)->Ping();
+    for (int i = 0; i < static_cast<int>(message_passing_tree.GetEdgesCount()); ++i) {
+        size_t delivered_count = 0;
+        while (size_t batch_size = message_passing_tree.GetEdgeProxy(i)->NotifyAboutMessage()) {
+            delivered_count += batch_size;
+        }
+        std::cout << "Delivered through edge " << i << " = " << delivered_count << std::endl;
+    }
+    message_passing_tree.GetEdgeProxy(0)->DeliverMessage(PointMessage(1, 1));
+}
+
+int main(){
+    TestQueuedDelivery();
+    TestInlineDelivery();
+    TestReplicatedDelivery();
+    TestBoundedEdge();
+    TestBoundedRoundRobin();
+    TestSendFromReceiveToFullEdge();
+    TestBroadcast();
+    TestTimers();
+    TestPriorities();
+    TestBatchReceive();
     return 0;
 }
@@ -0,0 +1,367 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <new>
+#include <sstream>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "async_logger.h"
+#include "metrics.h"
+#include "timers.h"
+
+const size_t ThreadMetricValues::chunk_size = 256;
+const size_t ThreadMetricValues::max_chunks_count = 4096;
+std::atomic<uint64_t> MetricsRegistry::registries_count(0);
+const char* const MetricsExporter::unix_socket_prefix = "unix:";
+const int64_t MetricsExporter::stop_check_period = 1e5; // 100ms
+
+namespace {
+
+// Values of the current thread, one block per registry.
+thread_local std::vector<std::pair<uint64_t, ThreadMetricValues*>> thread_metric_values;
+
+std::string FormatLabels(const std::string& labels, const std::string& extra_label = "") {
+    if (labels.empty() && extra_label.empty()) {
+        return "";
+    }
+    if (labels.empty() || extra_label.empty()) {
+        return "{" + labels + extra_label + "}";
+    }
+    return "{" + labels + "," + extra_label + "}";
+}
+
+}
+
+ThreadMetricValues::ThreadMetricValues() noexcept
+    : chunks(new (std::nothrow) std::atomic<std::atomic<int64_t>*>[max_chunks_count]())
+{
+}
+
+ThreadMetricValues::~ThreadMetricValues() {
+    if (chunks) {
+        for (size_t i = 0; i < max_chunks_count; ++i) {
+            delete[] chunks[i].load(std::memory_order_relaxed);
+        }
+    }
+}
+
+std::atomic<int64_t>* ThreadMetricValues::GetValue(const size_t index) noexcept {
+    size_t chunk_index = index / chunk_size;
+    if (!chunks || chunk_index >= max_chunks_count) {
+        return nullptr;
+    }
+    std::atomic<int64_t>* chunk = chunks[chunk_index].load(std::memory_order_relaxed);
+    if (chunk == nullptr) {
+        chunk = new (std::nothrow) std::atomic<int64_t>[chunk_size]();
+        if (chunk == nullptr) {
+            return nullptr;
+        }
+        chunks[chunk_index].store(chunk, std::memory_order_release);
+    }
+    return &chunk[index % chunk_size];
+}
+
+int64_t ThreadMetricValues::LoadValue(const size_t index) const noexcept {
+    size_t chunk_index = index / chunk_size;
+    if (!chunks || chunk_index >= max_chunks_count) {
+        return 0;
+    }
+    const std::atomic<int64_t>* chunk = chunks[chunk_index].load(std::memory_order_acquire);
+    return chunk == nullptr ? 0 : chunk[index % chunk_size].load(std::memory_order_relaxed);
+}
+
+Counter::Counter(MetricsRegistry& registry, const size_t index) noexcept
+    : registry(registry),
+      index(index)
+{
+}
+
+void Counter::Add(const int64_t delta) noexcept {
+    ThreadMetricValues* values = registry.GetThreadValues();
+    std::atomic<int64_t>* value = values == nullptr ? nullptr : values->GetValue(index);
+    if (value != nullptr) {
+        value->store(value->load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+    }
+}
+
+Gauge::Gauge() noexcept
+    : value(0)
+{
+}
+
+void Gauge::Set(const double new_value) noexcept {
+    value.store(new_value, std::memory_order_relaxed);
+}
+
+double Gauge::Get() const noexcept {
+    return value.load(std::memory_order_relaxed);
+}
+
+Histogram::Histogram(MetricsRegistry& registry, const size_t index, const std::vector<int64_t>& bounds)
+    : registry(registry),
+      index(index),
+      bounds(bounds)
+{
+}
+
+// Bucket counts go first, the sum of observed values goes last.
+void Histogram::Observe(const int64_t observed_value) noexcept {
+    ThreadMetricValues* values = registry.GetThreadValues();
+    if (values == nullptr) {
+        return;
+    }
+    size_t bucket = std::lower_bound(bounds.begin(), bounds.end(), observed_value) - bounds.begin();
+    std::atomic<int64_t>* count = values->GetValue(index + bucket);
+    std::atomic<int64_t>* sum = values->GetValue(index + bounds.size() + 1);
+    if (count != nullptr && sum != nullptr) {
+        count->store(count->load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        sum->store(sum->load(std::memory_order_relaxed) + observed_value, std::memory_order_relaxed);
+    }
+}
+
+MetricsRegistry::MetricsRegistry()
+    : id(++registries_count),
+      mutex(),
+      metrics(),
+      thread_values(),
+      values_count(0)
+{
+}
+
+MetricsRegistry::Metric& MetricsRegistry::AddMetric(const MetricType type, const std::string& name,
+        const std::string& help, const std::string& labels) {
+    metrics.push_back(std::make_unique<Metric>());
+    Metric& metric = *metrics.back();
+    metric.type = type;
+    metric.name = name;
+    metric.help = help;
+    metric.labels = labels;
+    return metric;
+}
+
+size_t MetricsRegistry::AllocateValues(const size_t count) {
+    size_t index = values_count;
+    values_count += count;
+    return index;
+}
+
+Counter& MetricsRegistry::AddCounter(const std::string& name, const std::string& help, const std::string& labels) {
+    std::lock_guard<std::mutex> lock(mutex);
+    Metric& metric = AddMetric(MetricType::Counter, name, help, labels);
+    metric.counter = std::make_unique<Counter>(*this, AllocateValues(1));
+    return *metric.counter;
+}
+
+Gauge& MetricsRegistry::AddGauge(const std::string& name, const std::string& help, const std::string& labels) {
+    std::lock_guard<std::mutex> lock(mutex);
+    Metric& metric = AddMetric(MetricType::Gauge, name, help, labels);
+    metric.gauge = std::make_unique<Gauge>();
+    return *metric.gauge;
+}
+
+Histogram& MetricsRegistry::AddHistogram(const std::string& name, const std::string& help,
+        const std::vector<int64_t>& bounds, const std::string& labels) {
+    std::lock_guard<std::mutex> lock(mutex);
+    Metric& metric = AddMetric(MetricType::Histogram, name, help, labels);
+    std::vector<int64_t> sorted_bounds = bounds;
+    std::sort(sorted_bounds.begin(), sorted_bounds.end());
+    metric.histogram = std::make_unique<Histogram>(*this, AllocateValues(sorted_bounds.size() + 2), sorted_bounds);
+    return *metric.histogram;
+}
+
+ThreadMetricValues* MetricsRegistry::GetThreadValues() noexcept {
+    for (const auto& values : thread_metric_values) {
+        if (values.first == id) {
+            return values.second;
+        }
+    }
+    try {
+        std::lock_guard<std::mutex> lock(mutex);
+        thread_values.push_back(std::make_unique<ThreadMetricValues>());
+        thread_metric_values.emplace_back(id, thread_values.back().get());
+        return thread_values.back().get();
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+int64_t MetricsRegistry::SumValues(const size_t index) const {
+    int64_t sum = 0;
+    for (const auto& values : thread_values) {
+        sum += values->LoadValue(index);
+    }
+    return sum;
+}
+
+void MetricsRegistry::ExportMetric(const Metric& metric, std::string& text) const {
+    std::ostringstream ss;
+    switch (metric.type) {
+        case MetricType::Counter:
+            ss << metric.name << FormatLabels(metric.labels) << " " << SumValues(metric.counter->index) << "\n";
+            break;
+        case MetricType::Gauge:
+            ss << metric.name << FormatLabels(metric.labels) << " " << metric.gauge->Get() << "\n";
+            break;
+        case MetricType::Histogram: {
+            const Histogram& histogram = *metric.histogram;
+            int64_t count = 0;
+            for (size_t bucket = 0; bucket <= histogram.bounds.size(); ++bucket) {
+                count += SumValues(histogram.index + bucket);
+                std::string bound = bucket < histogram.bounds.size() ? std::to_string(histogram.bounds[bucket]) : "+Inf";
+                ss << metric.name << "_bucket" << FormatLabels(metric.labels, "le=\"" + bound + "\"") << " " << count << "\n";
+            }
+            ss << metric.name << "_sum" << FormatLabels(metric.labels) << " "
+                << SumValues(histogram.index + histogram.bounds.size() + 1) << "\n";
+            ss << metric.name << "_count" << FormatLabels(metric.labels) << " " << count << "\n";
+            break;
+        }
+    }
+    text += ss.str();
+}
+
+std::string MetricsRegistry::ExportText() const {
+    static const char* const type_names[] = {"counter", "gauge", "histogram"};
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<std::string> names;
+    std::unordered_map<std::string, std::vector<const Metric*>> name_metrics;
+    for (const auto& metric : metrics) {
+        auto& same_name_metrics = name_metrics[metric->name];
+        if (same_name_metrics.empty()) {
+            names.push_back(metric->name);
+        }
+        same_name_metrics.push_back(metric.get());
+    }
+    std::string text;
+    for (const auto& name : names) {
+        const Metric& first_metric = *name_metrics[name].front();
+        text += "# HELP " + name + " " + first_metric.help + "\n";
+        text += "# TYPE " + name + " " + type_names[static_cast<int>(first_metric.type)] + "\n";
+        for (const Metric* metric : name_metrics[name]) {
+            ExportMetric(*metric, text);
+        }
+    }
+    return text;
+}
+
+MetricsExporter::MetricsExporter(const MetricsRegistry& registry, const std::string& target, const uint64_t period)
+    : registry(registry),
+      path(target),
+      is_socket(target.rfind(unix_socket_prefix, 0) == 0),
+      socket_descriptor(-1),
+      period(period),
+      stop_mutex(),
+      stop_cv(),
+      is_stopped(false),
+      export_thread()
+{
+    if (is_socket) {
+        path = target.substr(std::strlen(unix_socket_prefix));
+        sockaddr_un address;
+        std::memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(address.sun_path)) {
+            throw std::system_error(std::make_error_code(std::errc::filename_too_long), "Metrics socket path is too long");
+        }
+        std::strcpy(address.sun_path, path.c_str());
+        socket_descriptor = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (socket_descriptor == -1) {
+            throw std::system_error(errno, std::generic_category(), "Can not create metrics socket");
+        }
+        unlink(path.c_str());
+        if (bind(socket_descriptor, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == -1 ||
+                listen(socket_descriptor, SOMAXCONN) == -1) {
+            int error = errno;
+            close(socket_descriptor);
+            throw std::system_error(error, std::generic_category(), "Can not listen to metrics socket " + path);
+        }
+    }
+    export_thread = std::thread(&MetricsExporter::ExportAction, this);
+}
+
+MetricsExporter::~MetricsExporter() {
+    {
+        std::lock_guard<std::mutex> lock(stop_mutex);
+        is_stopped = true;
+    }
+    stop_cv.notify_all();
+    export_thread.join();
+    if (is_socket) {
+        close(socket_descriptor);
+        unlink(path.c_str());
+    }
+}
+
+void MetricsExporter::ExportAction() noexcept {
+    std::string text;
+    int64_t next_export_time = GetMonotonicTime();
+    std::unique_lock<std::mutex> lock(stop_mutex);
+    while (!is_stopped) {
+        lock.unlock();
+        int64_t current_time = GetMonotonicTime();
+        if (current_time >= next_export_time) {
+            try {
+                text = registry.ExportText();
+            } catch (...) {
+                global_logger.Log("[Metrics] : can not export metrics");
+            }
+            if (!is_socket) {
+                WriteFile(text);
+            }
+            next_export_time = current_time + period;
+        }
+        int64_t wait_time = std::min(next_export_time - current_time, stop_check_period);
+        if (is_socket) {
+            ServeClients(text, wait_time);
+            lock.lock();
+        } else {
+            lock.lock();
+            stop_cv.wait_for(lock, std::chrono::microseconds(wait_time), [this]() { return is_stopped; });
+        }
+    }
+}
+
+void MetricsExporter::WriteFile(const std::string& text) noexcept {
+    std::string temporary_path = path + ".tmp";
+    {
+        std::ofstream file(temporary_path, std::ios::trunc);
+        file << text;
+        file.flush();
+        if (!file) {
+            global_logger.Log("[Metrics] : can not write {}", temporary_path);
+            return;
+        }
+    }
+    if (std::rename(temporary_path.c_str(), path.c_str()) != 0) {
+        global_logger.Log("[Metrics] : can not replace {}", path);
+    }
+}
+
+void MetricsExporter::ServeClients(const std::string& text, const int64_t wait_time) noexcept {
+    pollfd poll_descriptor{socket_descriptor, POLLIN, 0};
+    int timeout = std::max(static_cast<int>(wait_time / 1000), 1);
+    while (poll(&poll_descriptor, 1, timeout) > 0) {
+        int client_descriptor = accept(socket_descriptor, nullptr, nullptr);
+        if (client_descriptor == -1) {
+            return;
+        }
+        size_t written_size = 0;
+        while (written_size < text.size()) {
+            ssize_t size = send(client_descriptor, text.data() + written_size, text.size() - written_size, MSG_NOSIGNAL);
+            if (size <= 0) {
+                break;
+            }
+            written_size += size;
+        }
+        close(client_descriptor);
+        timeout = 0;
+    }
+}
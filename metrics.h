@@ -0,0 +1,144 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class MetricsRegistry;
+
+// Values of counters and histograms are kept per thread, only the updating
+// thread writes its values, so an update is a plain load and store. Values
+// are summed up on export.
+class ThreadMetricValues {
+public:
+    ThreadMetricValues() noexcept;
+    ThreadMetricValues(const ThreadMetricValues&) = delete;
+    ThreadMetricValues& operator=(const ThreadMetricValues&) = delete;
+    ~ThreadMetricValues();
+
+    // Returns nullptr if memory for the value can not be allocated.
+    std::atomic<int64_t>* GetValue(const size_t index) noexcept;
+    int64_t LoadValue(const size_t index) const noexcept;
+public:
+    static const size_t chunk_size;
+    static const size_t max_chunks_count;
+private:
+    std::unique_ptr<std::atomic<std::atomic<int64_t>*>[]> chunks;
+};
+
+class Counter {
+public:
+    Counter(MetricsRegistry& registry, const size_t index) noexcept;
+    void Add(const int64_t delta = 1) noexcept;
+private:
+    friend class MetricsRegistry;
+
+    MetricsRegistry& registry;
+    size_t index;
+};
+
+class Gauge {
+public:
+    Gauge() noexcept;
+    void Set(const double value) noexcept;
+    double Get() const noexcept;
+private:
+    std::atomic<double> value;
+};
+
+// Buckets are given by their inclusive upper bounds, the last bucket has no
+// upper bound.
+class Histogram {
+public:
+    Histogram(MetricsRegistry& registry, const size_t index, const std::vector<int64_t>& bounds);
+    void Observe(const int64_t value) noexcept;
+private:
+    friend class MetricsRegistry;
+
+    MetricsRegistry& registry;
+    size_t index;
+    std::vector<int64_t> bounds;
+};
+
+// Metrics are registered once and updated through the returned references,
+// which stay valid as long as the registry. Labels are given in the
+// Prometheus form, like thread="0".
+class MetricsRegistry {
+private:
+    enum class MetricType {
+        Counter,
+        Gauge,
+        Histogram
+    };
+
+    struct Metric {
+        MetricType type;
+        std::string name;
+        std::string help;
+        std::string labels;
+        std::unique_ptr<Counter> counter;
+        std::unique_ptr<Gauge> gauge;
+        std::unique_ptr<Histogram> histogram;
+    };
+
+    Metric& AddMetric(const MetricType type, const std::string& name, const std::string& help, const std::string& labels);
+    size_t AllocateValues(const size_t count);
+    int64_t SumValues(const size_t index) const;
+    void ExportMetric(const Metric& metric, std::string& text) const;
+public:
+    MetricsRegistry();
+    MetricsRegistry(const MetricsRegistry&) = delete;
+    MetricsRegistry& operator=(const MetricsRegistry&) = delete;
+
+    Counter& AddCounter(const std::string& name, const std::string& help, const std::string& labels = "");
+    Gauge& AddGauge(const std::string& name, const std::string& help, const std::string& labels = "");
+    Histogram& AddHistogram(const std::string& name, const std::string& help, const std::vector<int64_t>& bounds,
+            const std::string& labels = "");
+
+    // Prometheus text format, metrics of one name are grouped together.
+    std::string ExportText() const;
+
+    // Returns nullptr if the thread can not get its values.
+    ThreadMetricValues* GetThreadValues() noexcept;
+private:
+    static std::atomic<uint64_t> registries_count;
+    uint64_t id;
+    mutable std::mutex mutex;
+    std::vector<std::unique_ptr<Metric>> metrics;
+    std::vector<std::unique_ptr<ThreadMetricValues>> thread_values;
+    size_t values_count;
+};
+
+// Writes the text of a registry every period to a file, or serves it to
+// every client connecting to a Unix socket if the target is "unix:<path>".
+// Files are replaced atomically, so a reader never sees a partial export.
+class MetricsExporter {
+private:
+    void ExportAction() noexcept;
+    void WriteFile(const std::string& text) noexcept;
+    void ServeClients(const std::string& text, const int64_t wait_time) noexcept;
+public:
+    // Throws std::system_error if the socket can not be listened to.
+    MetricsExporter(const MetricsRegistry& registry, const std::string& target, const uint64_t period);
+    MetricsExporter(const MetricsExporter&) = delete;
+    MetricsExporter& operator=(const MetricsExporter&) = delete;
+    ~MetricsExporter();
+public:
+    static const char* const unix_socket_prefix;
+private:
+    static const int64_t stop_check_period;
+    const MetricsRegistry& registry;
+    std::string path;
+    bool is_socket;
+    int socket_descriptor;
+    uint64_t period;
+    std::mutex stop_mutex;
+    std::condition_variable stop_cv;
+    bool is_stopped;
+    std::thread export_thread;
+};
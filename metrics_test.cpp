@@ -0,0 +1,85 @@
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "metrics.h"
+
+void TestExportText() {
+    MetricsRegistry registry;
+    Counter& first_counter = registry.AddCounter("messages_total", "Messages sent.", "edge=\"0\"");
+    Counter& second_counter = registry.AddCounter("messages_total", "Messages sent.", "edge=\"1\"");
+    Gauge& gauge = registry.AddGauge("active_threads", "Threads running shards.");
+    Histogram& histogram = registry.AddHistogram("switch_microseconds", "Switch duration.", {10, 100});
+    std::vector<std::thread> threads;
+    for (int thread_num = 0; thread_num < 4; ++thread_num) {
+        threads.emplace_back([&]() {
+            for (int i = 0; i < 1000; ++i) {
+                first_counter.Add();
+            }
+            second_counter.Add(5);
+            histogram.Observe(10);
+            histogram.Observe(1000);
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    gauge.Set(2.5);
+    std::cout << registry.ExportText();
+}
+
+std::string ReadFile(const std::string& path) {
+    std::ifstream file(path);
+    std::stringstream ss;
+    ss << file.rdbuf();
+    return ss.str();
+}
+
+std::string ReadSocket(const std::string& path) {
+    int socket_descriptor = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    path.copy(address.sun_path, sizeof(address.sun_path) - 1);
+    std::string text;
+    if (connect(socket_descriptor, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0) {
+        char buffer[256];
+        ssize_t size;
+        while ((size = read(socket_descriptor, buffer, sizeof(buffer))) > 0) {
+            text.append(buffer, size);
+        }
+    }
+    close(socket_descriptor);
+    return text;
+}
+
+void TestExporter() {
+    char directory_template[] = "/tmp/metrics_test_XXXXXX";
+    std::string directory = mkdtemp(directory_template);
+    MetricsRegistry registry;
+    registry.AddCounter("reshards_total", "Reshards done.").Add(3);
+    {
+        MetricsExporter file_exporter(registry, directory + "/metrics.prom", 10000);
+        MetricsExporter socket_exporter(registry, MetricsExporter::unix_socket_prefix + directory + "/metrics.sock", 10000);
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        std::string expected = "reshards_total 3\n";
+        std::cout << "File export = " << (ReadFile(directory + "/metrics.prom").find(expected) != std::string::npos)
+            << ", socket export = " << (ReadSocket(directory + "/metrics.sock").find(expected) != std::string::npos) << std::endl;
+    }
+    unlink((directory + "/metrics.prom").c_str());
+    rmdir(directory.c_str());
+}
+
+int main() {
+    TestExportText();
+    TestExporter();
+    return 0;
+}
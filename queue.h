@@ -165,6 +165,10 @@ public:
         return PopWithHeadDataCallback([](const T&){});
     }
 
+    bool IsEmpty() const noexcept {
+        return head.load().ptr == tail.load().ptr;
+    }
+
     ~LockFreeQueue() {
         while (true) {
             auto popped = Pop();
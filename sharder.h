@@ -3,134 +3,844 @@
 #include <atomic>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
+#include <deque>
 #include <cassert>
-#include <sstream>
+#include <limits>
+#include <memory>
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <stdexcept>
+#include <tuple>
 
 #include "types.h"
 #include "timers.h"
+#include "async_logger.h"
 #include "message_passing_tree.h"
+#include "graph_partitioner.h"
+#include "cpu_topology.h"
+#include "metrics.h"
+#include "shared_memory_ring.h"
 #include "exception_top_proto_storage.h"
 
-struct ShadowCounter {
-    bool is_first_main:1;
-    long long int noupdate_counter:63;
+using ReshardingConf = Vector<Vector<int>>;
+
+// Configuration published by the planner thread, never changed after it.
+// An epoch is freed only after every thread has switched to a newer one.
+struct ShardingEpoch {
+    int64_t number;
+    ReshardingConf conf;
+    // Thread of every shard, woken up by senders to the shard.
+    Vector<int> shard_threads;
 };
 
-using ReshardingConf = Vector<Vector<int>>;
+struct SharderOptions {
+    // Zero means one thread per CPU of the topology.
+    int threads_count = 0;
+    // Idle threads process shards from the runnable deques of busy threads.
+    // Resharding then only decides where shards are processed by default.
+    bool is_work_stealing_enabled = false;
+    // Pins every thread to its CPU, threads fill NUMA nodes one by one.
+    bool is_pinning_enabled = false;
+    // Topology in the CpuTopology::Parse format, read from sysfs if empty.
+    // A simulation never reads sysfs, it has one node with a CPU per thread
+    // then, four threads unless threads_count is set, so that runs do not
+    // depend on the host.
+    std::string simulated_topology;
+    // Threads are added and retired at reshards depending on utilization,
+    // threads_count is then the maximum. Retired threads are parked.
+    bool is_elastic = false;
+    // File path or "unix:<socket path>" where metrics of the pool are
+    // written in the Prometheus text format, nothing is written if empty.
+    std::string metrics_export_target;
+    uint64_t metrics_export_period = 1e6; // 1s
+    // Every thread runs as a logical worker on the thread calling Run, in
+    // virtual time of the VirtualClock set before the pool is created. The
+    // earliest worker makes the next step, ties are broken by a generator
+    // seeded with simulation_seed. Message latency is measured.
+    bool is_simulated = false;
+    uint64_t simulation_seed = 0;
+    // Virtual time after which a simulation is over.
+    int64_t simulated_duration = 1e7; // 10s
+    // Shards are weighted at resharding as if every call took this quantile
+    // of their call durations, so shards with rare stalls are not packed
+    // onto one thread. Every call is timed then. Zero weighs shards by the
+    // time they spent in total.
+    double balanced_latency_quantile = 0;
+    // Shards are weighted at resharding by their load with the past weighing
+    // half as much every load_half_life, so placement follows the recent
+    // load. Zero weighs them by everything measured since their last move.
+    int64_t load_half_life = 2e6; // 2s
+};
+
+struct EdgeStatistics {
+    std::string from;
+    std::string to;
+    uint64_t messages_count;
+    // Microseconds from sending to the end of processing, zero unless
+    // latency is measured.
+    int64_t latency_sum;
+    int64_t max_latency;
+    // Microseconds from sending to the start of delivery, zero unless the
+    // receiver is critical or latency is measured.
+    int64_t queueing_delay_sum;
+    int64_t max_queueing_delay;
+};
 
 template <typename Controller>
 class Sharder {
+private:
+    // The deques are shared between threads, so they must not use the
+    // thread-local allocator behind Deque.
+    struct RunnableShards {
+        std::mutex mutex;
+        std::deque<int> shards;
+    };
+
+    struct ShardUrgency {
+        // Deadline of pending messages, the maximum if there is none.
+        int64_t deadline;
+        MessageProcessorPriority priority;
+        bool has_pending_messages;
+        int shard_num;
+
+        bool operator<(const ShardUrgency& other) const noexcept {
+            return std::make_tuple(deadline, priority, !has_pending_messages, shard_num) <
+                std::make_tuple(other.deadline, other.priority, !other.has_pending_messages, other.shard_num);
+        }
+    };
+
+    // Gives a shard back to nobody when processing is over, even on exception.
+    struct ShardOwnershipGuard {
+        ShardOwnershipGuard(std::atomic<int>& owner)
+            : owner(owner)
+        {}
+        ShardOwnershipGuard& operator=(const ShardOwnershipGuard&) = delete;
+        ShardOwnershipGuard(const ShardOwnershipGuard&) = delete;
+        ~ShardOwnershipGuard() {
+            owner.store(no_owner, std::memory_order_release);
+        }
+        std::atomic<int>& owner;
+    };
+
+    static int GetThreadsCount(const SharderOptions& options, const CpuTopology& topology, const Controller& controller) noexcept {
+        size_t threads_count = options.threads_count > 0 ? options.threads_count : topology.GetCpusCount();
+        return std::max(size_t(1), std::min(threads_count, controller.GetMaxThreadsCount()));
+    }
+
+    static VirtualClock* GetSimulationClock(const SharderOptions& options) {
+        if (!options.is_simulated) {
+            return nullptr;
+        }
+        VirtualClock* clock = dynamic_cast<VirtualClock*>(GetClock());
+        if (clock == nullptr) {
+            throw std::invalid_argument("Simulation needs a VirtualClock set before the pool is created");
+        }
+        return clock;
+    }
+
+    static CpuTopology GetTopology(const SharderOptions& options) {
+        if (!options.simulated_topology.empty()) {
+            return CpuTopology::Parse(options.simulated_topology);
+        }
+        if (options.is_simulated) {
+            int simulated_threads_count = options.threads_count > 0 ? options.threads_count : default_simulated_threads_count;
+            return CpuTopology::Parse("0-" + std::to_string(simulated_threads_count - 1));
+        }
+        return CpuTopology::ReadFromSysfs();
+    }
 public:
-    Sharder(Controller& controller)
+    Sharder(Controller& controller, const SharderOptions& options = SharderOptions())
         : controller(controller),
-          threads_count(std::min(static_cast<size_t>(std::thread::hardware_concurrency()), controller.GetMaxThreadsCount())),
-          first_conf(controller.GetInitialSharding(threads_count)),
-          second_conf(),
-          shadow_counter({true, 0}),
+          options(options),
+          topology(GetTopology(options)),
+          threads_count(GetThreadsCount(options, topology, controller)),
+          thread_cpus(topology.GetThreadCpus(threads_count)),
+          simulation_clock(GetSimulationClock(options)),
+          initial_epoch(MakeEpoch(0, controller.GetInitialSharding(threads_count))),
+          current_epoch(initial_epoch.get()),
+          retired_epoch(nullptr),
+          active_threads_count(threads_count),
+          is_stopped(false),
+          is_draining(false),
+          is_thread_drained(threads_count),
+          busy_steps_counts(threads_count),
+          checked_busy_steps_counts(threads_count, 0),
+          was_drained_at_check(false),
+          park_mutex(),
+          park_cv(),
+          is_planning_stopped(false),
+          planner_mutex(),
+          planner_cv(),
+          planner_thread(),
+          is_checkpoint_requested(false),
+          is_checkpoint_written(false),
+          checkpoint_file_name(),
+          checkpoint_cv(),
+          is_pausing(false),
+          paused_threads_count(0),
+          pause_mutex(),
+          pause_cv(),
+          restored_threads_count(0),
           threads(),
-          shard_mutexes(controller.GetShardsCount()),
+          shard_owners(controller.GetShardsCount()),
+          local_epochs(threads_count, current_epoch.load()),
+          observed_epochs(threads_count),
+          measured_epochs(threads_count),
+          owned_shards(threads_count),
+          pending_shards(threads_count),
           can_be_updated(threads_count, true),
-          is_first_local(threads_count, true),
-          reshard_waiting_timer(threads_count, WaitingTimer{time_between_reshards})
+          reshard_deadlines(threads_count, 0),
+          runnable_shards(threads_count),
+          is_thread_waiting(threads_count),
+          shard_urgencies(threads_count),
+          serving_orders(threads_count),
+          last_served_times(controller.GetShardsCount(), 0),
+          bulk_turns(controller.GetShardsCount()),
+          metrics(),
+          reshards_counter(metrics.AddCounter("rast_reshards_total", "Sharding configurations published.")),
+          active_threads_gauge(metrics.AddGauge("rast_active_threads", "Threads processing shards.")),
+          switch_duration_histogram(metrics.AddHistogram("rast_switch_duration_microseconds",
+                      "Time threads spend switching to a new sharding configuration.", {10, 100, 1000, 10000, 100000})),
+          metrics_exporter()
     {
-        assert(static_cast<size_t>(threads_count) == first_conf.size());
+        const ReshardingConf& conf = current_epoch.load()->conf;
+        assert(static_cast<size_t>(threads_count) == conf.size());
+        for (auto& owner : shard_owners) {
+            owner.store(no_owner, std::memory_order_relaxed);
+        }
+        for (int thread_num = 0; thread_num < threads_count; ++thread_num) {
+            observed_epochs[thread_num].store(0, std::memory_order_relaxed);
+            measured_epochs[thread_num].store(-1, std::memory_order_relaxed);
+            is_thread_drained[thread_num].store(false, std::memory_order_relaxed);
+            busy_steps_counts[thread_num].store(0, std::memory_order_relaxed);
+            if (!options.is_work_stealing_enabled) {
+                for (int shard : conf[thread_num]) {
+                    shard_owners[shard].store(thread_num, std::memory_order_relaxed);
+                }
+            }
+        }
+        controller.SetInlineDeliveryEnabled(!options.is_work_stealing_enabled);
+        Vector<int> thread_nodes;
+        for (int cpu : thread_cpus) {
+            thread_nodes.push_back(topology.GetCpuNode(cpu));
+        }
+        controller.SetThreadNodes(thread_nodes);
+        controller.SetLatencyMeasured(options.is_simulated);
+        controller.SetBalancedLatencyQuantile(options.balanced_latency_quantile);
+        controller.SetLoadHalfLife(options.load_half_life);
+        controller.RegisterMetrics(metrics, threads_count);
+        active_threads_gauge.Set(threads_count);
+        if (!options.metrics_export_target.empty()) {
+            metrics_exporter = std::make_unique<MetricsExporter>(metrics, options.metrics_export_target, options.metrics_export_period);
+        }
     }
 
-    ReshardingConf& GetConf(bool is_first) noexcept {
-        if (is_first) {
-            return first_conf;
-        } else {
-            return second_conf;
-        }
+    bool HaveAllThreadsReached(const Vector<std::atomic<int64_t>>& thread_epochs, int64_t epoch_number) const noexcept {
+        return std::all_of(thread_epochs.begin(), thread_epochs.end(), [epoch_number](const std::atomic<int64_t>& thread_epoch) {
+            return thread_epoch.load(std::memory_order_acquire) >= epoch_number;
+        });
     }
 
+    // Called by the planner thread only. A new epoch is published once every
+    // thread has measured the current one, the retired epoch is freed once
+    // every thread has left it. Threads do not update statistics after their
+    // measurement, so the planner sees a consistent snapshot of them while
+    // the threads go on processing their shards.
     void Reshard() noexcept {
-        ShadowCounter current_counter = shadow_counter.load(std::memory_order_acquire);
-        if (current_counter.noupdate_counter < threads_count) {
+        const ShardingEpoch* epoch = current_epoch.load(std::memory_order_relaxed);
+        if (retired_epoch) {
+            if (!HaveAllThreadsReached(observed_epochs, epoch->number)) {
+                return;
+            }
+            FreeEpoch(retired_epoch);
+            retired_epoch = nullptr;
+        }
+        if (!HaveAllThreadsReached(measured_epochs, epoch->number)) {
             return;
         }
-        ReshardingConf new_conf = controller.GetResharding(GetConf(current_counter.is_first_main), threads_count);
-        GetConf(!current_counter.is_first_main) = new_conf;
-        shadow_counter.compare_exchange_strong(
-                current_counter, {!current_counter.is_first_main, 0},
-                std::memory_order_acquire, std::memory_order_relaxed);
+        int new_threads_count = epoch->conf.size();
+        if (options.is_elastic) {
+            new_threads_count = controller.GetDesiredThreadsCount(epoch->conf.size(), threads_count);
+        }
+        auto new_epoch = MakeEpoch(epoch->number + 1, controller.GetResharding(epoch->conf, new_threads_count));
+        retired_epoch = epoch;
+        current_epoch.store(new_epoch, std::memory_order_release);
+        active_threads_count.store(new_threads_count, std::memory_order_relaxed);
+        reshards_counter.Add();
+        active_threads_gauge.Set(new_threads_count);
+        WakeUpThreads();
+    }
+
+    // Called by the planner thread only. A thread sets its flag after an
+    // iteration without work and clears it once it stops waiting, so a message
+    // sent to a drained thread shows up either as a pending message or as a
+    // busy iteration at one of two checks in a row.
+    void CheckDrained() noexcept {
+        if (!is_draining.load(std::memory_order_relaxed)) {
+            return;
+        }
+        bool is_drained = !controller.HasAnyPendingMessages();
+        for (int thread_num = 0; thread_num < threads_count; ++thread_num) {
+            uint64_t busy_steps_count = busy_steps_counts[thread_num].load(std::memory_order_acquire);
+            is_drained = is_drained && is_thread_drained[thread_num].load(std::memory_order_acquire) &&
+                busy_steps_count == checked_busy_steps_counts[thread_num];
+            checked_busy_steps_counts[thread_num] = busy_steps_count;
+        }
+        if (is_drained && was_drained_at_check) {
+            Stop();
+        }
+        was_drained_at_check = is_drained;
+    }
+
+    ShardingEpoch* MakeEpoch(int64_t number, ReshardingConf&& conf) const {
+        Vector<int> shard_threads(controller.GetShardsCount(), 0);
+        for (int thread_num = 0; thread_num < static_cast<int>(conf.size()); ++thread_num) {
+            for (int shard_num : conf[thread_num]) {
+                shard_threads[shard_num] = thread_num;
+            }
+        }
+        return new ShardingEpoch{number, std::move(conf), std::move(shard_threads)};
+    }
+
+    // Epochs are allocated by the thread-local allocator of the planner
+    // thread, so the planner frees them. The initial epoch belongs to the
+    // thread which has constructed the sharder.
+    void FreeEpoch(const ShardingEpoch* epoch) noexcept {
+        if (epoch != initial_epoch.get()) {
+            delete epoch;
+        }
+    }
+
+    void PlannerAction() noexcept {
+        if (!LowerCurrentThreadPriority()) {
+            global_logger.Log("[Planner] : can not lower the thread priority");
+        }
+        std::unique_lock<std::mutex> lock(planner_mutex);
+        while (!is_planning_stopped) {
+            planner_cv.wait_for(lock, std::chrono::microseconds(planner_check_period));
+            if (!is_planning_stopped) {
+                bool is_checkpoint_due = is_checkpoint_requested;
+                lock.unlock();
+                if (is_checkpoint_due) {
+                    TakeCheckpoint();
+                }
+                Reshard();
+                CheckDrained();
+                lock.lock();
+            }
+        }
+        lock.unlock();
+        CancelCheckpoint();
+        FreeEpoch(retired_epoch);
+        retired_epoch = nullptr;
+        FreeEpoch(current_epoch.load(std::memory_order_relaxed));
+        current_epoch.store(initial_epoch.get(), std::memory_order_relaxed);
+    }
+
+    // Threads pause between their steps, so no message processor is running
+    // and no inline message is pending then. A thread blocked on a full edge
+    // does not get there, the checkpoint is given up after max_pause_wait_time.
+    bool PauseThreads() noexcept {
+        is_pausing.store(true, std::memory_order_release);
+        WakeUpThreads();
+        std::unique_lock<std::mutex> lock(pause_mutex);
+        return pause_cv.wait_for(lock, std::chrono::microseconds(max_pause_wait_time), [this] {
+            return paused_threads_count == threads_count || is_stopped.load(std::memory_order_relaxed);
+        }) && !is_stopped.load(std::memory_order_relaxed);
+    }
+
+    void ResumeThreads() noexcept {
+        {
+            std::lock_guard<std::mutex> lock(pause_mutex);
+            is_pausing.store(false, std::memory_order_relaxed);
+        }
+        pause_cv.notify_all();
+    }
+
+    void WaitWhilePaused() noexcept {
+        std::unique_lock<std::mutex> lock(pause_mutex);
+        ++paused_threads_count;
+        pause_cv.notify_all();
+        pause_cv.wait(lock, [this] {
+            return !is_pausing.load(std::memory_order_relaxed);
+        });
+        --paused_threads_count;
+    }
+
+    // Called by the planner thread only, or between steps of a simulation.
+    void TakeCheckpoint() noexcept {
+        bool is_written = false;
+        if (options.is_simulated || PauseThreads()) {
+            is_written = controller.WriteCheckpoint(checkpoint_file_name);
+        }
+        if (!options.is_simulated) {
+            ResumeThreads();
+        }
+        {
+            std::lock_guard<std::mutex> lock(planner_mutex);
+            is_checkpoint_requested = false;
+            is_checkpoint_written = is_written;
+        }
+        checkpoint_cv.notify_all();
+    }
+
+    // Called once planning has stopped, nobody is going to take a requested
+    // checkpoint then.
+    void CancelCheckpoint() noexcept {
+        {
+            std::lock_guard<std::mutex> lock(planner_mutex);
+            is_checkpoint_requested = false;
+            is_checkpoint_written = false;
+        }
+        checkpoint_cv.notify_all();
+    }
+
+    // Threads restore their initial shards themselves, so restored state is
+    // allocated by the thread-local allocator of the thread processing it.
+    // No thread starts before all of them have restored their shards, so
+    // restored messages come before new ones.
+    void WaitForRestoredThreads() noexcept {
+        restored_threads_count.fetch_add(1, std::memory_order_acq_rel);
+        while (restored_threads_count.load(std::memory_order_acquire) < threads_count) {
+            std::this_thread::yield();
+        }
+    }
+
+    void StopPlanning() noexcept {
+        {
+            std::lock_guard<std::mutex> lock(planner_mutex);
+            is_planning_stopped = true;
+        }
+        planner_cv.notify_all();
+    }
+
+    void WakeUpParkedThreads() noexcept {
+        {
+            std::lock_guard<std::mutex> lock(park_mutex);
+        }
+        park_cv.notify_all();
+    }
+
+    // Waiting threads notice a new epoch, a pause or a stop at once.
+    void WakeUpThreads() noexcept {
+        for (int thread_num = 0; thread_num < threads_count; ++thread_num) {
+            controller.WakeUpThread(thread_num);
+        }
+        WakeUpParkedThreads();
+    }
+
+    // A thread out of the active ones has nothing to measure, it waits for
+    // an epoch which may need it.
+    void Park(int thread_num) {
+        NoUpdatePromise(thread_num);
+        std::unique_lock<std::mutex> lock(park_mutex);
+        park_cv.wait(lock, [this, thread_num]() {
+            return is_stopped.load(std::memory_order_relaxed) || is_pausing.load(std::memory_order_relaxed) ||
+                current_epoch.load(std::memory_order_acquire) != local_epochs[thread_num];
+        });
+    }
+
+    static const Vector<int>& GetEpochShards(const ShardingEpoch* epoch, int thread_num) noexcept {
+        static const Vector<int> no_shards;
+        if (static_cast<size_t>(thread_num) < epoch->conf.size()) {
+            return epoch->conf[thread_num];
+        }
+        return no_shards;
+    }
+
+    bool IsThreadActive(int thread_num) const noexcept {
+        return static_cast<size_t>(thread_num) < local_epochs[thread_num]->conf.size();
+    }
+
+    int GetActiveThreadsCount() const noexcept {
+        return active_threads_count.load(std::memory_order_relaxed);
+    }
+
+    const MetricsRegistry& GetMetrics() const noexcept {
+        return metrics;
     }
 
     void NoUpdatePromise(int thread_num) noexcept {
         if (can_be_updated[thread_num]) {
-            ShadowCounter old_counter = shadow_counter.load(std::memory_order_relaxed);
-            ShadowCounter new_counter;
-            do {
-                new_counter = old_counter;
-                ++new_counter.noupdate_counter;
-            } while (!shadow_counter.compare_exchange_weak(old_counter, new_counter,
-                        std::memory_order_acquire, std::memory_order_relaxed));
+            controller.FinishMeasurement(thread_num);
+            measured_epochs[thread_num].store(local_epochs[thread_num]->number, std::memory_order_release);
             can_be_updated[thread_num] = false;
         }
     }
 
-    Vector<int> GetShards(int thread_num) noexcept {
-        if (!can_be_updated[thread_num]) {
-            ShadowCounter current_counter = shadow_counter.load(std::memory_order_acquire);
-            if (current_counter.is_first_main != is_first_local[thread_num]) {
-                SwitchConfiguration(thread_num);
+    const Vector<int>& GetShards(int thread_num) noexcept {
+        const ShardingEpoch* epoch = current_epoch.load(std::memory_order_acquire);
+        if (epoch != local_epochs[thread_num]) {
+            SwitchConfiguration(thread_num, epoch);
+        }
+        return GetEpochShards(local_epochs[thread_num], thread_num);
+    }
+
+    static Vector<int> GetMissingShards(const Vector<int>& shards, const Vector<int>& other_shards) {
+        Vector<int> missing_shards;
+        for (int shard : shards) {
+            if (std::find(other_shards.begin(), other_shards.end(), shard) == other_shards.end()) {
+                missing_shards.push_back(shard);
             }
         }
-        return GetConf(is_first_local[thread_num])[thread_num];
+        return missing_shards;
     }
 
-    void SwitchConfiguration(int thread_num) noexcept {
-        FinishConfiguration(thread_num);
-        is_first_local[thread_num] = !is_first_local[thread_num];
+    // Only shards which have changed their thread are released and taken, so
+    // a thread keeping its shard set does not touch any owner word.
+    void SwitchConfiguration(int thread_num, const ShardingEpoch* epoch) noexcept {
+        int64_t switch_start_time = GetMonotonicTime();
+        const Vector<int>& old_shards = GetEpochShards(local_epochs[thread_num], thread_num);
+        const Vector<int>& new_shards = GetEpochShards(epoch, thread_num);
+        if (!options.is_work_stealing_enabled) {
+            ReleaseShards(thread_num, GetMissingShards(old_shards, new_shards));
+            for (int shard : GetMissingShards(new_shards, old_shards)) {
+                pending_shards[thread_num].push_back(shard);
+            }
+        }
+        local_epochs[thread_num] = epoch;
+        observed_epochs[thread_num].store(epoch->number, std::memory_order_release);
         StartConfiguration(thread_num);
+        switch_duration_histogram.Observe(GetMonotonicTime() - switch_start_time);
+    }
+
+    // Shards never acquired are just forgotten.
+    void ReleaseShards(int thread_num, const Vector<int>& shards) noexcept {
+        for (int shard : shards) {
+            auto& pending = pending_shards[thread_num];
+            auto pending_shard = std::find(pending.begin(), pending.end(), shard);
+            if (pending_shard != pending.end()) {
+                pending.erase(pending_shard);
+                continue;
+            }
+            auto& owned = owned_shards[thread_num];
+            owned.erase(std::find(owned.begin(), owned.end(), shard));
+            shard_owners[shard].store(no_owner, std::memory_order_release);
+            global_logger.Log("[Thread {}] : releasing shard {}", thread_num, controller.GetShardLogName(shard));
+        }
+    }
+
+    // A shard still processed by its previous owner is skipped and retried on
+    // the next iteration instead of waiting for it.
+    void AcquirePendingShards(int thread_num) noexcept {
+        auto& pending = pending_shards[thread_num];
+        if (pending.empty()) {
+            return;
+        }
+        bool is_acquired = false;
+        for (auto shard = pending.begin(); shard != pending.end();) {
+            int free_owner = no_owner;
+            if (shard_owners[*shard].compare_exchange_strong(free_owner, thread_num,
+                        std::memory_order_acquire, std::memory_order_relaxed)) {
+                global_logger.Log("[Thread {}] : taking shard {}", thread_num, controller.GetShardLogName(*shard));
+                owned_shards[thread_num].push_back(*shard);
+                shard = pending.erase(shard);
+                is_acquired = true;
+            } else {
+                ++shard;
+            }
+        }
+        if (is_acquired) {
+            controller.OnSwitch(thread_num, owned_shards[thread_num], local_epochs[thread_num]->shard_threads,
+                    can_be_updated[thread_num]);
+        }
     }
 
-    void FinishConfiguration(int thread_num) noexcept {
-        std::ostringstream ss;
-        ss << "[Thread " << thread_num << "] : releasing shards ";
-        for (int shard : GetConf(is_first_local[thread_num])[thread_num]) {
-            shard_mutexes[shard].unlock();
-            ss << controller.GetShardName(shard) << " ";
+    // Shard lists of a thread are filled by the thread itself, the
+    // thread-local allocator can not free memory of other threads.
+    void TakeInitialShards(int thread_num) {
+        if (!options.is_work_stealing_enabled) {
+            owned_shards[thread_num] = GetEpochShards(local_epochs[thread_num], thread_num);
         }
-        ss << std::endl;
-        std::cout << ss.str();
+        exception_top_keeper.WithCatchingException([thread_num, this] {
+            controller.RestoreShards(GetEpochShards(local_epochs[thread_num], thread_num));
+        });
+        StartConfiguration(thread_num);
     }
 
     void StartConfiguration(int thread_num) noexcept {
-        std::ostringstream ss;
-        ss << "[Thread " << thread_num << "] : taking shards ";
-        reshard_waiting_timer[thread_num].Reset();
-        for (int shard : GetConf(is_first_local[thread_num])[thread_num]) {
-            shard_mutexes[shard].lock();
-            ss << controller.GetShardName(shard) << " ";
-        }
-        ss << std::endl;
-        std::cout << ss.str();
+        reshard_deadlines[thread_num] = GetMonotonicTime() + time_between_reshards;
         can_be_updated[thread_num] = true;
-        controller.OnSwitch(thread_num, GetConf(is_first_local[thread_num])[thread_num]);
+        controller.OnSwitch(thread_num, options.is_work_stealing_enabled ?
+                GetEpochShards(local_epochs[thread_num], thread_num) : owned_shards[thread_num],
+                local_epochs[thread_num]->shard_threads, true);
+    }
+
+    bool IsShardUrgent(int shard_num) const noexcept {
+        return controller.HasShardPendingMessages(shard_num) &&
+            (controller.GetShardPriority(shard_num) == MessageProcessorPriority::Critical ||
+             controller.GetShardDeadline(shard_num) != 0);
+    }
+
+    // Shards with pending messages that have deadlines come first, earlier
+    // deadlines first, then shards of higher priority classes. While critical
+    // or deadline messages are pending, bulk shards are served once in
+    // max_bulk_delay, each time for a bulk turn of many messages, so they are
+    // delayed but not starved. Without urgent messages shards are served in
+    // their own order, nothing is sorted.
+    const Vector<int>& GetServingOrder(int thread_num, const Vector<int>& shards) {
+        if (std::none_of(shards.begin(), shards.end(), [this](int shard_num) { return IsShardUrgent(shard_num); })) {
+            return shards;
+        }
+        Vector<ShardUrgency>& urgencies = shard_urgencies[thread_num];
+        urgencies.clear();
+        for (int shard_num : shards) {
+            MessageProcessorPriority priority = controller.GetShardPriority(shard_num);
+            bool has_pending_messages = controller.HasShardPendingMessages(shard_num);
+            int64_t deadline = has_pending_messages ? controller.GetShardDeadline(shard_num) : 0;
+            urgencies.push_back({deadline != 0 ? deadline : std::numeric_limits<int64_t>::max(), priority,
+                    has_pending_messages, shard_num});
+        }
+        std::sort(urgencies.begin(), urgencies.end());
+        Vector<int>& order = serving_orders[thread_num];
+        order.clear();
+        int64_t current_time = GetMonotonicTime();
+        for (const auto& urgency : urgencies) {
+            if (urgency.priority == MessageProcessorPriority::Bulk &&
+                    urgency.deadline == std::numeric_limits<int64_t>::max()) {
+                if (current_time - last_served_times[urgency.shard_num] < max_bulk_delay) {
+                    continue;
+                }
+                last_served_times[urgency.shard_num] = current_time;
+                bulk_turns[urgency.shard_num].store(true, std::memory_order_relaxed);
+            }
+            order.push_back(urgency.shard_num);
+        }
+        return order;
+    }
+
+    void PushRunnableShards(int thread_num, const Vector<int>& shards) {
+        size_t runnable_count = 0;
+        const Vector<int>& serving_order = GetServingOrder(thread_num, shards);
+        {
+            std::lock_guard<std::mutex> lock(runnable_shards[thread_num].mutex);
+            for (int shard_num : serving_order) {
+                if (controller.IsShardRunnable(shard_num)) {
+                    runnable_shards[thread_num].shards.push_back(shard_num);
+                }
+            }
+            runnable_count = runnable_shards[thread_num].shards.size();
+        }
+        if (runnable_count > 1) {
+            for (int other_thread = 0; other_thread < threads_count; ++other_thread) {
+                if (is_thread_waiting[other_thread].load(std::memory_order_relaxed)) {
+                    controller.WakeUpThread(other_thread);
+                    break;
+                }
+            }
+        }
+    }
+
+    bool PopRunnableShard(int thread_num, bool is_stealing, int* shard_num) {
+        std::lock_guard<std::mutex> lock(runnable_shards[thread_num].mutex);
+        auto& shards = runnable_shards[thread_num].shards;
+        if (shards.empty()) {
+            return false;
+        }
+        if (is_stealing) {
+            *shard_num = shards.back();
+            shards.pop_back();
+        } else {
+            *shard_num = shards.front();
+            shards.pop_front();
+        }
+        return true;
+    }
+
+    bool HasStealableShards(int thread_num) {
+        for (int other_thread = 0; other_thread < threads_count; ++other_thread) {
+            if (other_thread != thread_num) {
+                std::lock_guard<std::mutex> lock(runnable_shards[other_thread].mutex);
+                if (!runnable_shards[other_thread].shards.empty()) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    void TryProcessShard(int shard_num, int thread_num) {
+        int free_owner = no_owner;
+        if (shard_owners[shard_num].compare_exchange_strong(free_owner, thread_num,
+                    std::memory_order_acquire, std::memory_order_relaxed)) {
+            ShardOwnershipGuard guard(shard_owners[shard_num]);
+            controller.ProcessShard(shard_num, thread_num, can_be_updated[thread_num],
+                    bulk_turns[shard_num].exchange(false, std::memory_order_relaxed));
+        }
+    }
+
+    // Waiting for messages is not a sign of work, so a drained thread stays
+    // drained while it waits.
+    void OnWaitFinished(int thread_num) noexcept {
+        if (is_draining.load(std::memory_order_relaxed)) {
+            is_thread_drained[thread_num].store(false, std::memory_order_relaxed);
+        }
+    }
+
+    // Shards are owned only while being processed, so a shard is owned by
+    // whoever has taken it from a runnable deque.
+    void ProcessWithStealing(int thread_num, const Vector<int>& shards) {
+        is_thread_waiting[thread_num].store(true, std::memory_order_relaxed);
+        controller.PreProcess(thread_num, can_be_updated[thread_num], !options.is_simulated && !HasStealableShards(thread_num));
+        OnWaitFinished(thread_num);
+        is_thread_waiting[thread_num].store(false, std::memory_order_relaxed);
+        PushRunnableShards(thread_num, shards);
+        int shard_num;
+        while (PopRunnableShard(thread_num, false, &shard_num)) {
+            TryProcessShard(shard_num, thread_num);
+        }
+        for (int i = 1; i < threads_count; ++i) {
+            if (PopRunnableShard((thread_num + i) % threads_count, true, &shard_num)) {
+                TryProcessShard(shard_num, thread_num);
+            }
+        }
     }
 
     void ThreadAction(int thread_num) noexcept {
         exception_top_keeper.SetPath("file " + std::to_string(thread_num));
-        StartConfiguration(thread_num);
-        while (true) {
-            exception_top_keeper.WithCatchingException([thread_num, this] {
-                Vector<int> shards = GetShards(thread_num);
-                controller.PreProcess(thread_num, can_be_updated[thread_num]);
-                for (int shard_num : shards) {
-                    controller.ProcessShard(shard_num, thread_num, can_be_updated[thread_num]);
+        if (options.is_pinning_enabled && !PinCurrentThread(thread_cpus[thread_num])) {
+            global_logger.Log("[Thread {}] : can not pin to CPU {}", thread_num, thread_cpus[thread_num]);
+        }
+        TakeInitialShards(thread_num);
+        if (controller.IsRestoring()) {
+            WaitForRestoredThreads();
+        }
+        while (!is_stopped.load(std::memory_order_relaxed)) {
+            if (is_pausing.load(std::memory_order_acquire)) {
+                WaitWhilePaused();
+            }
+            ThreadStep(thread_num);
+        }
+    }
+
+    void ThreadStep(int thread_num) noexcept {
+        bool is_draining_now = is_draining.load(std::memory_order_relaxed);
+        exception_top_keeper.WithCatchingException([thread_num, this] {
+            const Vector<int>& shards = GetShards(thread_num);
+            if (!IsThreadActive(thread_num)) {
+                if (is_draining.load(std::memory_order_relaxed)) {
+                    is_thread_drained[thread_num].store(true, std::memory_order_release);
                 }
-                if (reshard_waiting_timer[thread_num].CheckTime()) {
+                if (options.is_simulated) {
                     NoUpdatePromise(thread_num);
-                    if (thread_num == 0) {
-                        Reshard();
+                } else {
+                    Park(thread_num);
+                }
+                return;
+            }
+            if (options.is_work_stealing_enabled) {
+                ProcessWithStealing(thread_num, shards);
+            } else {
+                AcquirePendingShards(thread_num);
+                controller.PreProcess(thread_num, can_be_updated[thread_num],
+                        !options.is_simulated && pending_shards[thread_num].empty());
+                OnWaitFinished(thread_num);
+                for (int shard_num : GetServingOrder(thread_num, owned_shards[thread_num])) {
+                    controller.ProcessShard(shard_num, thread_num, can_be_updated[thread_num],
+                            bulk_turns[shard_num].exchange(false, std::memory_order_relaxed));
+                }
+            }
+            if (GetMonotonicTime() >= reshard_deadlines[thread_num]) {
+                NoUpdatePromise(thread_num);
+            }
+        });
+        if (is_draining_now) {
+            if (IsThreadActive(thread_num) && !controller.IsThreadIdle(thread_num)) {
+                busy_steps_counts[thread_num].fetch_add(1, std::memory_order_relaxed);
+            } else {
+                is_thread_drained[thread_num].store(true, std::memory_order_release);
+            }
+        }
+    }
+
+    // A worker with nothing to do sleeps until its next timer, until a busy
+    // worker may have sent it a message or until the planner may have given
+    // it other shards.
+    int64_t GetSimulatedWakeUpTime(int thread_num, const Vector<int64_t>& thread_times,
+            const Vector<bool>& is_thread_idle, int64_t next_planning_time) noexcept {
+        int64_t wake_up_time = next_planning_time;
+        if (IsThreadActive(thread_num)) {
+            wake_up_time = std::min(wake_up_time, controller.GetNextTimerDeadline(thread_num));
+        }
+        for (int other_thread = 0; other_thread < threads_count; ++other_thread) {
+            if (other_thread != thread_num && !is_thread_idle[other_thread]) {
+                wake_up_time = std::min(wake_up_time, thread_times[other_thread]);
+            }
+        }
+        return wake_up_time;
+    }
+
+    void RunSimulation() noexcept {
+        exception_top_keeper.SetPath("file 0");
+        std::mt19937_64 random_generator(options.simulation_seed);
+        int64_t finish_time = simulation_clock->GetTime() + options.simulated_duration;
+        int64_t next_planning_time = simulation_clock->GetTime() + planner_check_period;
+        Vector<int64_t> thread_times(threads_count, simulation_clock->GetTime());
+        Vector<bool> is_thread_idle(threads_count, false);
+        Vector<int> next_threads;
+        for (int thread_num = 0; thread_num < threads_count; ++thread_num) {
+            TakeInitialShards(thread_num);
+        }
+        while (!is_stopped.load(std::memory_order_relaxed)) {
+            int64_t step_time = *std::min_element(thread_times.begin(), thread_times.end());
+            if (step_time >= finish_time) {
+                break;
+            }
+            if (next_planning_time <= step_time) {
+                simulation_clock->SetTime(next_planning_time);
+                bool is_checkpoint_due = false;
+                {
+                    std::lock_guard<std::mutex> lock(planner_mutex);
+                    is_checkpoint_due = is_checkpoint_requested;
+                }
+                if (is_checkpoint_due) {
+                    TakeCheckpoint();
+                }
+                Reshard();
+                CheckDrained();
+                next_planning_time += planner_check_period;
+                continue;
+            }
+            next_threads.clear();
+            for (int thread_num = 0; thread_num < threads_count; ++thread_num) {
+                if (thread_times[thread_num] == step_time) {
+                    next_threads.push_back(thread_num);
+                }
+            }
+            int thread_num = next_threads[random_generator() % next_threads.size()];
+            simulation_clock->SetTime(step_time);
+            ThreadStep(thread_num);
+            int64_t finish_step_time = std::max(simulation_clock->GetTime(), step_time + min_simulated_step_time);
+            is_thread_idle[thread_num] = !IsThreadActive(thread_num) || controller.IsThreadIdle(thread_num);
+            if (is_thread_idle[thread_num]) {
+                int64_t wake_up_time = GetSimulatedWakeUpTime(thread_num, thread_times, is_thread_idle, next_planning_time);
+                if (wake_up_time > finish_step_time) {
+                    if (IsThreadActive(thread_num)) {
+                        controller.AddIdleTime(thread_num, can_be_updated[thread_num], wake_up_time - finish_step_time);
                     }
+                    finish_step_time = wake_up_time;
                 }
-            });
+            }
+            thread_times[thread_num] = finish_step_time;
         }
+        simulation_clock->SetTime(finish_time);
+        StopPlanning();
+        CancelCheckpoint();
+        controller.FinishRestoring();
+        FreeEpoch(retired_epoch);
+        retired_epoch = nullptr;
+        FreeEpoch(current_epoch.load(std::memory_order_relaxed));
+        current_epoch.store(initial_epoch.get(), std::memory_order_relaxed);
     }
 
     void Run() noexcept {
+        if (options.is_simulated) {
+            RunSimulation();
+            return;
+        }
+        planner_thread = std::thread(&Sharder<Controller>::PlannerAction, this);
         for (int i = 1; i < threads_count; ++i) {
             threads.push_back(std::thread(&Sharder<Controller>::ThreadAction, this, i));
         }
@@ -138,140 +848,611 @@ public:
         for (auto& one_thread : threads) {
             one_thread.join();
         }
+        StopPlanning();
+        planner_thread.join();
+        controller.FinishRestoring();
+    }
+
+    // Makes Run return once every thread has finished its iteration.
+    void Stop() noexcept {
+        is_stopped.store(true, std::memory_order_relaxed);
+        WakeUpThreads();
+        {
+            std::lock_guard<std::mutex> lock(pause_mutex);
+        }
+        pause_cv.notify_all();
+    }
+
+    // Blocks until the planner has quiesced the threads at its next check and
+    // written the state of every message processor with its pending messages.
+    // Returns false if the checkpoint can not be written or the pool stops
+    // first. Must be called while Run is active, by a thread of its own.
+    bool Checkpoint(const std::string& file_name) {
+        std::unique_lock<std::mutex> lock(planner_mutex);
+        if (is_planning_stopped) {
+            return false;
+        }
+        checkpoint_file_name = file_name;
+        is_checkpoint_requested = true;
+        checkpoint_cv.wait(lock, [this] {
+            return !is_checkpoint_requested;
+        });
+        return is_checkpoint_written;
+    }
+
+    // Makes Run return once no message is pending and no thread has found
+    // anything to do for two planner checks in a row. Message processors are
+    // expected to have stopped producing.
+    void Drain() noexcept {
+        is_draining.store(true, std::memory_order_relaxed);
     }
 private:
     Controller& controller;
+    SharderOptions options;
+    CpuTopology topology;
     int threads_count;
-    ReshardingConf first_conf;
-    ReshardingConf second_conf;
-    std::atomic<ShadowCounter> shadow_counter;
+    Vector<int> thread_cpus;
+    VirtualClock* simulation_clock;
+    std::unique_ptr<const ShardingEpoch> initial_epoch;
+    std::atomic<const ShardingEpoch*> current_epoch;
+    const ShardingEpoch* retired_epoch;
+    std::atomic<int> active_threads_count;
+    std::atomic<bool> is_stopped;
+    std::atomic<bool> is_draining;
+    Vector<std::atomic<bool>> is_thread_drained;
+    Vector<std::atomic<uint64_t>> busy_steps_counts;
+    Vector<uint64_t> checked_busy_steps_counts;
+    bool was_drained_at_check;
+    std::mutex park_mutex;
+    std::condition_variable park_cv;
+    bool is_planning_stopped;
+    std::mutex planner_mutex;
+    std::condition_variable planner_cv;
+    std::thread planner_thread;
+    bool is_checkpoint_requested;
+    bool is_checkpoint_written;
+    std::string checkpoint_file_name;
+    std::condition_variable checkpoint_cv;
+    std::atomic<bool> is_pausing;
+    int paused_threads_count;
+    std::mutex pause_mutex;
+    std::condition_variable pause_cv;
+    std::atomic<int> restored_threads_count;
     Vector<std::thread> threads;
-    Vector<std::mutex> shard_mutexes;
+    Vector<std::atomic<int>> shard_owners;
+    Vector<const ShardingEpoch*> local_epochs;
+    Vector<std::atomic<int64_t>> observed_epochs;
+    Vector<std::atomic<int64_t>> measured_epochs;
+    Vector<Vector<int>> owned_shards;
+    Vector<Vector<int>> pending_shards;
     Vector<bool> can_be_updated;
-    Vector<bool> is_first_local;
-    Vector<WaitingTimer> reshard_waiting_timer;
+    // Threads may loop slowly after a burst of fast iterations, approximate
+    // timers would wind up and miss the deadline then.
+    Vector<int64_t> reshard_deadlines;
+    Vector<RunnableShards> runnable_shards;
+    Vector<std::atomic<bool>> is_thread_waiting;
+    Vector<Vector<ShardUrgency>> shard_urgencies;
+    Vector<Vector<int>> serving_orders;
+    Vector<int64_t> last_served_times;
+    // Set for bulk shards let in among urgent ones, taken by the thread
+    // serving the shard, which may be a stealing one.
+    Vector<std::atomic<bool>> bulk_turns;
+    MetricsRegistry metrics;
+    Counter& reshards_counter;
+    Gauge& active_threads_gauge;
+    Histogram& switch_duration_histogram;
+    std::unique_ptr<MetricsExporter> metrics_exporter;
     static const uint64_t time_between_reshards;
+    static const uint64_t planner_check_period;
+    static const int64_t min_simulated_step_time;
+    static const int64_t max_bulk_delay;
+    static const int64_t max_pause_wait_time;
+    static const int default_simulated_threads_count;
+    static const int no_owner;
 };
 
 template <typename Controller>
 const uint64_t Sharder<Controller>::time_between_reshards = 1e6; // 1s
 
-class DummyLockable {
-public:
-    void lock() {}
-    void unlock() {}
-};
+template <typename Controller>
+const uint64_t Sharder<Controller>::planner_check_period = 1e4; // 10ms
+
+template <typename Controller>
+const int64_t Sharder<Controller>::min_simulated_step_time = 1; // 1us
+
+template <typename Controller>
+const int64_t Sharder<Controller>::max_bulk_delay = 1e3; // 1ms
+
+template <typename Controller>
+const int64_t Sharder<Controller>::max_pause_wait_time = 1e6; // 1s
+
+template <typename Controller>
+const int Sharder<Controller>::default_simulated_threads_count = 4;
+
+template <typename Controller>
+const int Sharder<Controller>::no_owner = -1;
 
 template <typename ... Args>
 class MessagePassingController {
 public:
     MessagePassingController()
         : message_passing_tree(),
-          message_wait_cvs(),
-          message_send_cvs(),
+          message_wait_signals(),
           is_active(),
+          thread_shards(),
+          current_times(),
+          measured_times(),
+          idle_times(),
+          epoch_measured_times(),
+          epoch_idle_times(),
+          next_timer_deadlines(),
           message_processor_timers(),
-          edge_timers()
-    {}
+          edge_timers(),
+          is_inline_delivery_enabled(true),
+          balanced_latency_quantile(0),
+          load_half_life(0),
+          message_processor_duration_rates(),
+          edge_duration_rates(),
+          edge_count_rates(),
+          graph_partitioner(std::make_unique<MultilevelGraphPartitioner>()),
+          shard_move_rounds(),
+          resharding_round(0),
+          thread_nodes(),
+          thread_busy_counters(),
+          thread_idle_counters(),
+          message_processor_time_counters(),
+          message_processor_pings_counters(),
+          message_processor_load_gauges(),
+          edge_time_counters(),
+          edge_messages_counters(),
+          is_latency_measured(false),
+          edge_messages_counts(),
+          edge_latency_sums(),
+          edge_max_latencies(),
+          edge_latency_histograms(),
+          edge_queueing_delay_sums(),
+          edge_max_queueing_delays(),
+          edge_queueing_delay_histograms(),
+          shard_priorities(),
+          shard_log_names(),
+          remote_edge_receiver(),
+          restored_checkpoint()
+    {
+        for (int i = 0; static_cast<size_t>(i) < message_passing_tree.GetMessageProcessorsCount(); ++i) {
+            shard_log_names.push_back(global_logger.RegisterName(GetShardName(i)));
+        }
+    }
+
+    void SetInlineDeliveryEnabled(bool is_enabled) noexcept {
+        is_inline_delivery_enabled = is_enabled;
+    }
+
+    void SetThreadNodes(const Vector<int>& new_thread_nodes) {
+        thread_nodes = new_thread_nodes;
+    }
+
+    // Timers of every shard and edge keep histograms of call durations then,
+    // so it is set before the threads start.
+    void SetBalancedLatencyQuantile(double quantile) {
+        balanced_latency_quantile = quantile;
+        bool is_histogram_enabled = quantile > 0;
+        message_processor_timers.assign(message_passing_tree.GetMessageProcessorsCount(), StartFinishTimer(is_histogram_enabled));
+        edge_timers.assign(message_passing_tree.GetEdgesCount(), StartFinishTimer(is_histogram_enabled));
+    }
+
+    // Rates are fed with the timer totals of every epoch at resharding, so
+    // the hot path only keeps the totals.
+    void SetLoadHalfLife(int64_t half_life) {
+        load_half_life = half_life;
+        int64_t start_time = GetMonotonicTime();
+        message_processor_duration_rates.assign(message_passing_tree.GetMessageProcessorsCount(), DecayedRate(half_life, start_time));
+        edge_duration_rates.assign(message_passing_tree.GetEdgesCount(), DecayedRate(half_life, start_time));
+        edge_count_rates.assign(message_passing_tree.GetEdgesCount(), DecayedRate(half_life, start_time));
+    }
+
+    // Messages are stamped on sending, so latency is exact only while time
+    // does not pass between sending and stamping, as in a simulation.
+    void SetLatencyMeasured(bool is_measured) noexcept {
+        is_latency_measured = is_measured;
+        message_passing_tree.SetLatencyMeasured(is_measured);
+    }
+
+    // Message counts are updated on delivery, times come from the shard
+    // timers of measured intervals and are added up at every resharding.
+    void RegisterMetrics(MetricsRegistry& metrics, int threads_count) {
+        for (int thread_num = 0; thread_num < threads_count; ++thread_num) {
+            std::string labels = "thread=\"" + std::to_string(thread_num) + "\"";
+            thread_busy_counters.push_back(&metrics.AddCounter("rast_thread_busy_microseconds_total",
+                        "Time threads spent out of waiting for messages.", labels));
+            thread_idle_counters.push_back(&metrics.AddCounter("rast_thread_idle_microseconds_total",
+                        "Time threads spent waiting for messages.", labels));
+        }
+        for (int i = 0; static_cast<size_t>(i) < message_passing_tree.GetMessageProcessorsCount(); ++i) {
+            std::string labels = "message_processor=\"" + GetShardName(i) + "\"";
+            message_processor_time_counters.push_back(&metrics.AddCounter("rast_message_processor_time_microseconds_total",
+                        "Approximate time spent in pings of message processors.", labels));
+            message_processor_pings_counters.push_back(&metrics.AddCounter("rast_message_processor_pings_total",
+                        "Measured pings of message processors.", labels));
+            message_processor_load_gauges.push_back(&metrics.AddGauge("rast_message_processor_load",
+                        "Weight of message processors at the last resharding.", labels));
+        }
+        for (int i = 0; static_cast<size_t>(i) < message_passing_tree.GetEdgesCount(); ++i) {
+            auto edge_proxy = message_passing_tree.GetEdgeProxy(i);
+            std::string labels = "from=\"" + GetShardName(edge_proxy->GetFromIndex()) +
+                "\",to=\"" + GetShardName(edge_proxy->GetToIndex()) + "\"";
+            edge_time_counters.push_back(&metrics.AddCounter("rast_edge_time_microseconds_total",
+                        "Approximate time spent delivering messages of edges.", labels));
+            edge_messages_counters.push_back(&metrics.AddCounter("rast_edge_messages_total",
+                        "Messages delivered through edges.", labels));
+            if (is_latency_measured) {
+                edge_latency_histograms.push_back(&metrics.AddHistogram("rast_edge_latency_microseconds",
+                            "Time from sending messages to the end of their delivery.", {10, 100, 1000, 10000, 100000}, labels));
+            }
+            edge_queueing_delay_histograms.push_back(nullptr);
+            if (shard_priorities[edge_proxy->GetToIndex()] == MessageProcessorPriority::Critical) {
+                edge_queueing_delay_histograms.back() = &metrics.AddHistogram("rast_critical_queueing_delay_microseconds",
+                        "Time messages to critical message processors wait for delivery.", {10, 100, 1000, 10000, 100000}, labels);
+            }
+        }
+    }
+
+    // Message processors of the types run in the other process. Messages to
+    // them are written to the outgoing ring, messages from them are read from
+    // the incoming ring and pushed into the local queues.
+    template <typename ... RemoteMPs>
+    void ConnectRemoteProcess(SharedMemoryRing& outgoing_ring, SharedMemoryRing& incoming_ring) {
+        (SetMessageProcessorRemote(message_passing_tree.template GetMessageProcessorIndex<RemoteMPs>()), ...);
+        for (int i = 0; static_cast<size_t>(i) < message_passing_tree.GetEdgesCount(); ++i) {
+            auto edge_proxy = message_passing_tree.GetEdgeProxy(i);
+            bool is_from_remote = message_passing_tree.IsMessageProcessorRemote(edge_proxy->GetFromIndex());
+            bool is_to_remote = message_passing_tree.IsMessageProcessorRemote(edge_proxy->GetToIndex());
+            if (is_from_remote != is_to_remote && !message_passing_tree.IsEdgeSerializable(i)) {
+                throw std::invalid_argument("Messages from " + GetShardName(edge_proxy->GetFromIndex()) + " to " +
+                        GetShardName(edge_proxy->GetToIndex()) + " can not be serialized");
+            }
+            if (!is_from_remote && is_to_remote) {
+                message_passing_tree.SetRemoteChannel(i, &outgoing_ring);
+            }
+        }
+        remote_edge_receiver = std::make_unique<RemoteEdgeReceiver>(incoming_ring, [this](const TrafficRecord& record) {
+            message_passing_tree.ReplayMessage(record);
+        });
+    }
 
-    void PreProcess(int thread_num, bool can_be_updated) {
-        if (!is_active[thread_num]) {
-            DummyLockable dummy_lock;
-            message_wait_cvs[thread_num].wait_for(dummy_lock, std::chrono::microseconds(wait_for_message_time));
+    void SetMessageProcessorRemote(int message_processor_index) noexcept {
+        auto message_processor_proxy = message_passing_tree.GetMessageProcessorProxy(message_processor_index);
+        for (int replica_index = 0; replica_index < message_processor_proxy->GetReplicasCount(); ++replica_index) {
+            message_passing_tree.SetMessageProcessorRemote(message_processor_index + replica_index, true);
+        }
+    }
+
+    // Throws std::system_error if the checkpoint can not be read or was taken
+    // for another topology.
+    void SetRestoredCheckpoint(const std::string& file_name) {
+        auto checkpoint = std::make_unique<CheckpointFile>(file_name);
+        if (checkpoint->GetMessageProcessorsCount() != message_passing_tree.GetMessageProcessorsCount() ||
+                checkpoint->GetEdgesCount() != message_passing_tree.GetEdgesCount()) {
+            throw std::system_error(std::make_error_code(std::errc::invalid_argument), "Checkpoint was taken for another topology");
+        }
+        restored_checkpoint = std::move(checkpoint);
+    }
+
+    bool IsRestoring() const noexcept {
+        return restored_checkpoint != nullptr;
+    }
+
+    void RestoreShards(const Vector<int>& shards) {
+        if (restored_checkpoint == nullptr) {
+            return;
+        }
+        for (int shard_num : shards) {
+            if (!message_passing_tree.IsMessageProcessorRemote(shard_num)) {
+                message_passing_tree.RestoreMessageProcessor(shard_num, *restored_checkpoint);
+            }
+        }
+    }
+
+    void FinishRestoring() noexcept {
+        restored_checkpoint.reset();
+    }
+
+    bool WriteCheckpoint(const std::string& file_name) noexcept {
+        try {
+            CheckpointFileWriter checkpoint(message_passing_tree.GetMessageProcessorsCount(), message_passing_tree.GetEdgesCount());
+            size_t lost_messages_count = message_passing_tree.WriteCheckpoint(checkpoint);
+            checkpoint.Save(file_name);
+            global_logger.Log("[Planner] : checkpoint written, {} pending messages can not be serialized", lost_messages_count);
+            return true;
+        } catch (const std::exception& exception) {
+            global_logger.Log("[Planner] : can not write checkpoint: {}", exception.what());
+            return false;
+        }
+    }
+
+    bool IsNumaAware() const noexcept {
+        return std::any_of(thread_nodes.begin(), thread_nodes.end(),
+                [this](const int node) { return node != thread_nodes.front(); });
+    }
+
+    void PreProcess(int thread_num, bool can_be_updated, bool can_wait) {
+        int64_t previous_time = current_times[thread_num];
+        int64_t wait_start_time = 0;
+        if (can_wait && !is_active[thread_num]) {
+            message_wait_signals[thread_num].Reset();
+            if (!HasPendingMessages(thread_num)) {
+                wait_start_time = GetMonotonicTime();
+                int64_t wait_time = std::min(static_cast<int64_t>(max_wait_for_message_time),
+                        next_timer_deadlines[thread_num] - wait_start_time);
+                if (wait_time > 0) {
+                    message_wait_signals[thread_num].WaitFor(wait_time);
+                }
+            }
         }
         is_active[thread_num] = false;
+        current_times[thread_num] = GetMonotonicTime();
+        int64_t loop_time = current_times[thread_num] - previous_time;
+        int64_t idle_time = wait_start_time != 0 ? current_times[thread_num] - wait_start_time : 0;
+        thread_busy_counters[thread_num]->Add(loop_time - idle_time);
+        thread_idle_counters[thread_num]->Add(idle_time);
+        if (can_be_updated) {
+            measured_times[thread_num] += loop_time;
+            idle_times[thread_num] += idle_time;
+        }
+        next_timer_deadlines[thread_num] = std::numeric_limits<int64_t>::max();
     }
 
-    void ProcessShard(int shard_num, int thread_num, bool can_be_updated) {
+    // Simulated threads do not wait in PreProcess, the time they would have
+    // waited is added here. The next loop is measured from the end of it.
+    void AddIdleTime(int thread_num, bool can_be_updated, int64_t idle_time) noexcept {
+        current_times[thread_num] += idle_time;
+        thread_idle_counters[thread_num]->Add(idle_time);
         if (can_be_updated) {
-            message_processor_timers[shard_num].Start();
+            measured_times[thread_num] += idle_time;
+            idle_times[thread_num] += idle_time;
         }
-        if (message_passing_tree.GetMessageProcessorProxy(shard_num)->Ping()) {
+    }
+
+    bool IsThreadIdle(int thread_num) const noexcept {
+        return !is_active[thread_num] && !HasPendingMessages(thread_num);
+    }
+
+    int64_t GetNextTimerDeadline(int thread_num) const noexcept {
+        return next_timer_deadlines[thread_num];
+    }
+
+    std::vector<EdgeStatistics> GetEdgeStatistics() {
+        std::vector<EdgeStatistics> statistics;
+        for (int i = 0; static_cast<size_t>(i) < message_passing_tree.GetEdgesCount(); ++i) {
+            auto edge_proxy = message_passing_tree.GetEdgeProxy(i);
+            statistics.push_back({GetShardName(edge_proxy->GetFromIndex()), GetShardName(edge_proxy->GetToIndex()),
+                    edge_messages_counts[i], edge_latency_sums[i], edge_max_latencies[i],
+                    edge_queueing_delay_sums[i], edge_max_queueing_delays[i]});
+        }
+        return statistics;
+    }
+
+    MessageProcessorPriority GetShardPriority(int shard_num) const noexcept {
+        return shard_priorities[shard_num];
+    }
+
+    // Zero if no pending message of the shard has a deadline.
+    int64_t GetShardDeadline(int shard_num) const noexcept {
+        return message_passing_tree.GetEarliestDeadline(shard_num);
+    }
+
+    bool HasShardPendingMessages(int shard_num) const noexcept {
+        return message_passing_tree.HasPendingMessages(shard_num);
+    }
+
+    bool HasAnyPendingMessages() const noexcept {
+        for (int shard_num = 0; static_cast<size_t>(shard_num) < message_passing_tree.GetMessageProcessorsCount(); ++shard_num) {
+            if (message_passing_tree.HasPendingMessages(shard_num)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool HasPendingMessages(int thread_num) const noexcept {
+        return std::any_of(thread_shards[thread_num].begin(), thread_shards[thread_num].end(),
+                [this](const int shard_num) { return message_passing_tree.HasPendingMessages(shard_num); });
+    }
+
+    bool IsShardRunnable(int shard_num) const noexcept {
+        return !message_passing_tree.IsMessageProcessorRemote(shard_num) &&
+            (message_passing_tree.HasPendingMessages(shard_num) || !message_passing_tree.IsSaturated(shard_num));
+    }
+
+    void WakeUpThread(int thread_num) noexcept {
+        message_wait_signals[thread_num].Notify();
+    }
+
+    // In a bulk turn every incoming edge is drained for up to
+    // max_bulk_turn_size messages or max_bulk_turn_time rather than one
+    // batch, as the turn comes once in max_bulk_delay. The turn is short next
+    // to that delay, so urgent messages still come first.
+    void ProcessShard(int shard_num, int thread_num, bool can_be_updated, bool is_bulk_turn) {
+        if (message_passing_tree.IsMessageProcessorRemote(shard_num)) {
+            return;
+        }
+        if (message_passing_tree.AdvanceTimers(shard_num, current_times[thread_num])) {
             is_active[thread_num] = true;
         }
-        if (can_be_updated) {
-            message_processor_timers[shard_num].Finish();
+        if (DeliverInlineMessages(can_be_updated)) {
+            is_active[thread_num] = true;
         }
-        for (int edge : message_passing_tree.GetIncomingEdges(shard_num)) {
+        if (!message_passing_tree.IsSaturated(shard_num)) {
             if (can_be_updated) {
-                edge_timers[edge].Start();
+                message_processor_timers[shard_num].Start();
             }
-            if (message_passing_tree.GetEdgeProxy(edge)->NotifyAboutMessage()) {
+            if (message_passing_tree.GetMessageProcessorProxy(shard_num)->Ping()) {
                 is_active[thread_num] = true;
             }
             if (can_be_updated) {
-                edge_timers[edge].Finish();
+                message_processor_timers[shard_num].Finish();
             }
+            if (DeliverInlineMessages(can_be_updated)) {
+                is_active[thread_num] = true;
+            }
+        }
+        for (int edge : message_passing_tree.GetIncomingEdges(shard_num)) {
+            size_t turn_size = 0;
+            int64_t turn_deadline = is_bulk_turn ? GetMonotonicTime() + max_bulk_turn_time : 0;
+            size_t delivered_count = 0;
+            do {
+                if (can_be_updated) {
+                    edge_timers[edge].Start();
+                }
+                int64_t delivery_start_time = message_passing_tree.IsEdgeTimestamped(edge) ? GetMonotonicTime() : 0;
+                delivered_count = message_passing_tree.GetEdgeProxy(edge)->NotifyAboutMessage();
+                if (delivered_count != 0) {
+                    OnMessageDelivered(edge, delivery_start_time, delivered_count);
+                    is_active[thread_num] = true;
+                }
+                if (can_be_updated) {
+                    edge_timers[edge].Finish();
+                }
+                if (DeliverInlineMessages(can_be_updated)) {
+                    is_active[thread_num] = true;
+                }
+                turn_size += delivered_count;
+            } while (is_bulk_turn && delivered_count != 0 && turn_size < max_bulk_turn_size &&
+                    GetMonotonicTime() < turn_deadline);
         }
+        next_timer_deadlines[thread_num] = std::min(next_timer_deadlines[thread_num],
+                message_passing_tree.GetNextTimerDeadline(shard_num));
     }
 
-    void SetSenderCVS(const ReshardingConf& conf) {
-        std::vector<int> shard_thread;
-        for (int thread_num = 0; thread_num < static_cast<int>(conf.size()); ++thread_num) {
-            for (auto shard_num : conf[thread_num]) {
-                while (shard_thread.size() <= static_cast<size_t>(shard_num)) {
-                    shard_thread.push_back(0);
-                }
-                shard_thread[shard_num] = thread_num;
+    // Messages of a batch are accounted with the sending time of its first
+    // one, histograms get one observation per batch.
+    void OnMessageDelivered(int edge, int64_t delivery_start_time, size_t messages_count) noexcept {
+        edge_messages_counters[edge]->Add(messages_count);
+        edge_messages_counts[edge] += messages_count;
+        if (delivery_start_time != 0) {
+            int64_t queueing_delay = delivery_start_time - message_passing_tree.GetDeliveredEnqueueTime(edge);
+            edge_queueing_delay_sums[edge] += queueing_delay * static_cast<int64_t>(messages_count);
+            edge_max_queueing_delays[edge] = std::max(edge_max_queueing_delays[edge], queueing_delay);
+            if (edge_queueing_delay_histograms[edge] != nullptr) {
+                edge_queueing_delay_histograms[edge]->Observe(queueing_delay);
             }
         }
-        for (int queue_index = 0; queue_index < static_cast<int>(message_passing_tree.GetEdgesCount()); ++queue_index) {
-            int receiver_index = message_passing_tree.GetEdgeProxy(queue_index)->GetToIndex();
-            int receiver_thread = shard_thread[receiver_index];
-            message_send_cvs[queue_index] = &message_wait_cvs[receiver_thread];
+        if (is_latency_measured) {
+            int64_t latency = GetMonotonicTime() - message_passing_tree.GetDeliveredEnqueueTime(edge);
+            edge_latency_sums[edge] += latency * static_cast<int64_t>(messages_count);
+            edge_max_latencies[edge] = std::max(edge_max_latencies[edge], latency);
+            edge_latency_histograms[edge]->Observe(latency);
         }
     }
 
+    bool DeliverInlineMessages(bool can_be_updated) {
+        bool was_delivered = false;
+        for (size_t i = 0; i < max_inline_messages_in_row; ++i) {
+            int edge = message_passing_tree.GetInlineMessageEdge();
+            if (edge == -1) {
+                return was_delivered;
+            }
+            if (can_be_updated) {
+                edge_timers[edge].Start();
+            }
+            int64_t delivery_start_time = message_passing_tree.IsEdgeTimestamped(edge) ? GetMonotonicTime() : 0;
+            message_passing_tree.DeliverInlineMessage();
+            OnMessageDelivered(edge, delivery_start_time, 1);
+            if (can_be_updated) {
+                edge_timers[edge].Finish();
+            }
+            was_delivered = true;
+        }
+        message_passing_tree.FlushInlineMessages();
+        return was_delivered;
+    }
+
     ReshardingConf GetInitialSharding(int threads_count) {
-        message_wait_cvs = Vector<std::condition_variable_any>(threads_count);
-        message_send_cvs.resize(message_passing_tree.GetEdgesCount());
+        message_wait_signals = Vector<WakeUpSignal>(threads_count);
         is_active.assign(threads_count, true);
-        message_processor_timers.assign(message_passing_tree.GetMessageProcessorsCount(), {});
-        edge_timers.assign(message_passing_tree.GetEdgesCount(), {});
+        thread_shards.assign(threads_count, {});
+        current_times.assign(threads_count, GetMonotonicTime());
+        measured_times.assign(threads_count, 0);
+        idle_times.assign(threads_count, 0);
+        epoch_measured_times.assign(threads_count, 0);
+        epoch_idle_times.assign(threads_count, 0);
+        next_timer_deadlines.assign(threads_count, std::numeric_limits<int64_t>::max());
+        message_processor_timers.assign(message_passing_tree.GetMessageProcessorsCount(), StartFinishTimer());
+        edge_timers.assign(message_passing_tree.GetEdgesCount(), StartFinishTimer());
+        edge_messages_counts.assign(message_passing_tree.GetEdgesCount(), 0);
+        edge_latency_sums.assign(message_passing_tree.GetEdgesCount(), 0);
+        edge_max_latencies.assign(message_passing_tree.GetEdgesCount(), 0);
+        edge_queueing_delay_sums.assign(message_passing_tree.GetEdgesCount(), 0);
+        edge_max_queueing_delays.assign(message_passing_tree.GetEdgesCount(), 0);
+        shard_priorities.clear();
+        for (int shard_num = 0; static_cast<size_t>(shard_num) < message_passing_tree.GetMessageProcessorsCount(); ++shard_num) {
+            shard_priorities.push_back(message_passing_tree.GetMessageProcessorProxy(shard_num)->GetPriority());
+        }
+        shard_move_rounds.assign(message_passing_tree.GetMessageProcessorsCount(), -reshard_cooldown_rounds);
         ReshardingConf conf(threads_count, Vector<int>{});
         for (int shard_num = 0; static_cast<size_t>(shard_num) < message_passing_tree.GetMessageProcessorsCount(); ++shard_num) {
             conf[shard_num % threads_count].push_back(shard_num);
         }
-        SetSenderCVS(conf);
         return conf;
     }
 
-    void OnSwitch(int thread_num, const Vector<int>& new_shards) noexcept {
+    // The planner reads the snapshot once every thread has finished measuring
+    // the epoch, while the threads go on and may restart their measurement.
+    void FinishMeasurement(int thread_num) noexcept {
+        epoch_measured_times[thread_num] = measured_times[thread_num];
+        epoch_idle_times[thread_num] = idle_times[thread_num];
+    }
+
+    // Message processors which have just come to the thread are moved to its
+    // NUMA node. Queue nodes are allocated by the thread-local allocators of
+    // senders, so they are local to the sending thread anyway. Shard timers
+    // are left alone once the thread has finished measuring the epoch, the
+    // planner may be reading them.
+    void OnSwitch(int thread_num, const Vector<int>& new_shards, const Vector<int>& shard_threads, bool is_measuring) noexcept {
+        if (IsNumaAware()) {
+            for (int new_shard : new_shards) {
+                const auto& old_shards = thread_shards[thread_num];
+                if (std::find(old_shards.begin(), old_shards.end(), new_shard) == old_shards.end()) {
+                    auto message_processor_proxy = message_passing_tree.GetMessageProcessorProxy(new_shard);
+                    MoveMemoryToNode(message_processor_proxy->GetMessageProcessorAddress(),
+                            message_processor_proxy->GetMessageProcessorSize(), thread_nodes[thread_num]);
+                }
+            }
+        }
+        thread_shards[thread_num] = new_shards;
+        current_times[thread_num] = GetMonotonicTime();
+        measured_times[thread_num] = 0;
+        idle_times[thread_num] = 0;
         for (int new_shard : new_shards) {
             for (int outgoing_edge : message_passing_tree.GetOutgoingEdges(new_shard)) {
-                message_passing_tree.GetEdgeProxy(outgoing_edge)->SetConditionVariable(message_send_cvs[outgoing_edge]);
+                auto edge_proxy = message_passing_tree.GetEdgeProxy(outgoing_edge);
+                edge_proxy->SetWakeUpSignal(&message_wait_signals[shard_threads[edge_proxy->GetToIndex()]]);
+                edge_proxy->SetInlineDelivery(is_inline_delivery_enabled &&
+                        std::find(new_shards.begin(), new_shards.end(), edge_proxy->GetToIndex()) != new_shards.end());
             }
-            message_processor_timers[new_shard].Reset();
-            for (int edge : message_passing_tree.GetIncomingEdges(new_shard)) {
-                edge_timers[edge].Reset();
+            if (is_measuring) {
+                message_processor_timers[new_shard].Reset();
+                for (int edge : message_passing_tree.GetIncomingEdges(new_shard)) {
+                    edge_timers[edge].Reset();
+                }
             }
         }
     }
 
-    void ProcessMPChoice(int64_t duration, int mp, int64_t* accumulated_duration,
-            Vector<int>* current_thread_mps, Set<std::pair<int64_t, int>>* available_duration_mp,
-            Vector<int64_t>* message_passing_cost) {
-        *accumulated_duration += duration;
-        current_thread_mps->push_back(mp);
-        available_duration_mp->erase(std::make_pair(duration, mp));
-        for (auto duration_mp : *available_duration_mp) {
-            for (int edge : message_passing_tree.GetConnectingEdges(mp, duration_mp.second)) {
-                message_passing_cost->operator[](duration_mp.second) += edge_timers[edge].GetAverageDuration();
-            }
-        }
+    void SetGraphPartitioner(std::unique_ptr<GraphPartitioner>&& new_graph_partitioner) noexcept {
+        graph_partitioner = std::move(new_graph_partitioner);
     }
 
+    // Vertices are weighted by the time spent in a message processor, edges by
+    // the messages passed and the time spent receiving them. The partitioner
+    // output is only a target: starting from the old configuration, shards are
+    // moved towards it while a move saves more than a migration costs. Shards
+    // moved recently stay where they are.
     ReshardingConf GetResharding(const ReshardingConf& old_conf, int threads_count) {
-        int64_t avg_duration = 0;
-        for (int i = 0; static_cast<size_t>(i) < message_passing_tree.GetMessageProcessorsCount(); ++i) {
-            avg_duration += message_processor_timers[i].GetAverageDuration();
+        WeightedGraph graph(message_passing_tree.GetMessageProcessorsCount());
+        bool is_load_decayed = load_half_life > 0 && resharding_round > 0;
+        if (load_half_life > 0) {
+            UpdateLoadRates();
         }
-        for (int i = 0; static_cast<size_t>(i) < message_passing_tree.GetEdgesCount(); ++i) {
-            avg_duration += edge_timers[i].GetAverageDuration();
-        }
-        avg_duration /= threads_count;
-        avg_duration = std::max(avg_duration, int64_t(1));
-        Set<std::pair<int64_t, int>> available_duration_mp;
         for (int i = 0; static_cast<size_t>(i) < message_passing_tree.GetMessageProcessorsCount(); ++i) {
             int64_t duration = message_processor_timers[i].GetAverageDuration();
             int64_t all_duration = message_processor_timers[i].GetDurationSum();
@@ -279,49 +1460,169 @@ public:
                 duration += edge_timers[j].GetAverageDuration();
                 all_duration += edge_timers[j].GetDurationSum();
             }
-            std::cout << "[Resharding] Time of " << GetShardName(i) << " = " << duration << ", total = " << all_duration << std::endl;
-            available_duration_mp.insert(std::make_pair(duration, i));
+            int64_t weight = all_duration;
+            if (balanced_latency_quantile > 0) {
+                weight = std::max(weight, GetTailDuration(i));
+            }
+            // The tail factor of the whole measurement applies to the recent load.
+            if (is_load_decayed) {
+                double tail_factor = all_duration > 0 ? static_cast<double>(weight) / all_duration : 1;
+                weight = std::llround(GetRecentDuration(i) * tail_factor);
+            }
+            global_logger.Log("[Resharding] Time of {} = {}, total = {}, weight = {}", shard_log_names[i], duration, all_duration, weight);
+            graph.SetVertexWeight(i, std::max(weight, int64_t(1)));
+            message_processor_time_counters[i]->Add(std::max(message_processor_timers[i].GetDurationSum(), int64_t(0)));
+            message_processor_pings_counters[i]->Add(message_processor_timers[i].GetCount());
+            message_processor_load_gauges[i]->Set(weight);
         }
-        ReshardingConf conf;
-        for (int thread_num = 0; thread_num < threads_count; ++thread_num) {
-            int64_t accumulated_duration = 0;
-            Vector<int> current_thread_mps;
-            Vector<int64_t> message_passing_cost(message_passing_tree.GetMessageProcessorsCount(), 0);
-            assert(available_duration_mp.size() > 0);
-            auto it = available_duration_mp.rbegin();
-            if (it->first > avg_duration) {
-                ProcessMPChoice(it->first, it->second, &accumulated_duration,
-                        &current_thread_mps, &available_duration_mp, &message_passing_cost);
-            } else {
-                while (available_duration_mp.size() > 0) {
-                    auto chosen_it = available_duration_mp.end();
-                    double largest_cost = -1;
-                    for (auto it = available_duration_mp.begin(); it != available_duration_mp.upper_bound(std::make_pair(avg_duration - accumulated_duration, 0)); ++it) {
-                        if (largest_cost < message_passing_cost[it->second]) {
-                            largest_cost = message_passing_cost[it->second];
-                            chosen_it = it;
-                        }
-                    }
-                    if (chosen_it == available_duration_mp.end()) {
-                        break;
-                    } else {
-                        ProcessMPChoice(chosen_it->first, chosen_it->second, &accumulated_duration,
-                            &current_thread_mps, &available_duration_mp, &message_passing_cost);
-                    }
-                }
+        for (int i = 0; static_cast<size_t>(i) < message_passing_tree.GetEdgesCount(); ++i) {
+            auto edge_proxy = message_passing_tree.GetEdgeProxy(i);
+            int64_t weight = static_cast<int64_t>(edge_timers[i].GetCount()) * cross_thread_message_cost + edge_timers[i].GetDurationSum();
+            if (is_load_decayed) {
+                weight = std::llround(edge_count_rates[i].GetRate() * cross_thread_message_cost + edge_duration_rates[i].GetRate());
             }
-            if (thread_num + 1 == threads_count) {
-                for (auto duration_mp : available_duration_mp) {
-                    current_thread_mps.push_back(duration_mp.second);
+            graph.AddEdge(edge_proxy->GetFromIndex(), edge_proxy->GetToIndex(), weight);
+            edge_time_counters[i]->Add(std::max(edge_timers[i].GetDurationSum(), int64_t(0)));
+        }
+        Vector<int> old_parts(message_passing_tree.GetMessageProcessorsCount());
+        for (int thread_num = 0; thread_num < static_cast<int>(old_conf.size()); ++thread_num) {
+            for (int shard_num : old_conf[thread_num]) {
+                old_parts[shard_num] = thread_num;
+            }
+        }
+        ++resharding_round;
+        Vector<int> start_parts = MoveOffRetiredThreads(graph, old_parts, threads_count);
+        Vector<bool> is_pinned(old_parts.size());
+        for (int i = 0; i < static_cast<int>(old_parts.size()); ++i) {
+            is_pinned[i] = resharding_round - shard_move_rounds[i] <= reshard_cooldown_rounds;
+        }
+        MigrationLimits limits;
+        limits.migration_cost = shard_migration_cost;
+        limits.max_moves = max_shard_moves_per_reshard;
+        PartitionCostModel cost_model;
+        if (IsNumaAware()) {
+            cost_model.part_nodes = thread_nodes;
+            cost_model.cross_node_edge_factor = cross_node_message_cost_factor;
+        }
+        Vector<int> parts = PlanMigrations(graph, start_parts, graph_partitioner->Partition(graph, threads_count),
+                threads_count, is_pinned, limits, cost_model);
+        ReshardingConf conf(threads_count, Vector<int>{});
+        for (int thread_num = 0; thread_num < std::min(threads_count, static_cast<int>(old_conf.size())); ++thread_num) {
+            for (int shard_num : old_conf[thread_num]) {
+                if (parts[shard_num] == thread_num) {
+                    conf[thread_num].push_back(shard_num);
                 }
             }
-            assert(current_thread_mps.size() > 0);
-            conf.push_back(current_thread_mps);
         }
-        SetSenderCVS(conf);
+        for (int i = 0; i < static_cast<int>(parts.size()); ++i) {
+            if (parts[i] != old_parts[i]) {
+                global_logger.Log("[Resharding] Moving {} from thread {} to thread {}", shard_log_names[i], old_parts[i], parts[i]);
+                conf[parts[i]].push_back(i);
+                shard_move_rounds[i] = resharding_round;
+            }
+        }
         return conf;
     }
 
+    // Timers are reset at the start of every epoch, so their totals are the
+    // amounts of the interval since the last resharding. The first epoch
+    // includes the start of the pool and the first wind-up of approximate
+    // timers, so the rates start after it and the first resharding weighs
+    // shards by their totals.
+    void UpdateLoadRates() noexcept {
+        int64_t time = GetMonotonicTime();
+        if (resharding_round == 0) {
+            for (auto* rates : {&message_processor_duration_rates, &edge_duration_rates, &edge_count_rates}) {
+                for (auto& rate : *rates) {
+                    rate = DecayedRate(load_half_life, time);
+                }
+            }
+            return;
+        }
+        for (size_t i = 0; i < message_passing_tree.GetMessageProcessorsCount(); ++i) {
+            message_processor_duration_rates[i].AddInterval(message_processor_timers[i].GetDurationSum(), time);
+        }
+        for (size_t i = 0; i < message_passing_tree.GetEdgesCount(); ++i) {
+            edge_duration_rates[i].AddInterval(edge_timers[i].GetDurationSum(), time);
+            edge_count_rates[i].AddInterval(edge_timers[i].GetCount(), time);
+        }
+    }
+
+    // Microseconds per second spent in a shard and in deliveries to it.
+    double GetRecentDuration(int message_processor_index) const noexcept {
+        double recent_duration = message_processor_duration_rates[message_processor_index].GetRate();
+        for (int edge : message_passing_tree.GetIncomingEdges(message_processor_index)) {
+            recent_duration += edge_duration_rates[edge].GetRate();
+        }
+        return recent_duration;
+    }
+
+    // Calls of a shard and deliveries to it counted at the balanced quantile
+    // of their merged durations, in microseconds.
+    int64_t GetTailDuration(int message_processor_index) {
+        LatencyHistogram histogram = *message_processor_timers[message_processor_index].GetHistogram();
+        for (int edge : message_passing_tree.GetIncomingEdges(message_processor_index)) {
+            histogram.Merge(*edge_timers[edge].GetHistogram());
+        }
+        global_logger.Log("[Resharding] Durations of {}: p50 = {}ns, p99 = {}ns, p999 = {}ns", shard_log_names[message_processor_index],
+                histogram.GetP50(), histogram.GetP99(), histogram.GetP999());
+        return static_cast<int64_t>(histogram.GetCount()) * histogram.GetValueAtQuantile(balanced_latency_quantile) / 1000;
+    }
+
+    // Shards of retired threads go to the least loaded remaining threads
+    // regardless of migration limits.
+    Vector<int> MoveOffRetiredThreads(const WeightedGraph& graph, const Vector<int>& old_parts, int threads_count) const {
+        Vector<int> parts = old_parts;
+        Vector<int64_t> thread_loads(threads_count, 0);
+        for (int i = 0; i < static_cast<int>(parts.size()); ++i) {
+            if (parts[i] < threads_count) {
+                thread_loads[parts[i]] += graph.GetVertexWeight(i);
+            }
+        }
+        for (int i = 0; i < static_cast<int>(parts.size()); ++i) {
+            if (parts[i] >= threads_count) {
+                parts[i] = std::min_element(thread_loads.begin(), thread_loads.end()) - thread_loads.begin();
+                thread_loads[parts[i]] += graph.GetVertexWeight(i);
+            }
+        }
+        return parts;
+    }
+
+    // Threads measure the time they spend waiting for messages, the rest of
+    // the measured time is busy. Shard timers are approximate, so they only
+    // weigh shards against each other. Nothing changes while utilization
+    // stays in the [min_thread_utilization, max_thread_utilization] band.
+    int GetDesiredThreadsCount(int threads_count, int max_threads_count) const {
+        int64_t measured_time = 0;
+        int64_t busy_time = 0;
+        for (int thread_num = 0; thread_num < threads_count; ++thread_num) {
+            measured_time += epoch_measured_times[thread_num];
+            busy_time += epoch_measured_times[thread_num] - epoch_idle_times[thread_num];
+        }
+        if (measured_time <= 0) {
+            return threads_count;
+        }
+        double utilization = static_cast<double>(busy_time) / measured_time;
+        int desired_threads_count = threads_count;
+        if (utilization < min_thread_utilization || utilization > max_thread_utilization) {
+            desired_threads_count = std::ceil(utilization * threads_count / target_thread_utilization);
+            desired_threads_count = std::max(1, std::min(desired_threads_count, max_threads_count));
+        }
+        global_logger.Log("[Resharding] Utilization of {} threads = {}, threads wanted = {}",
+                threads_count, utilization, desired_threads_count);
+        return desired_threads_count;
+    }
+
+    // Zero before the first resharding.
+    double GetShardLoad(int shard_num) const noexcept {
+        return message_processor_load_gauges[shard_num]->Get();
+    }
+
+    template <typename MessageProcessor>
+    int GetMessageProcessorIndex() noexcept {
+        return message_passing_tree.template GetMessageProcessorIndex<MessageProcessor>();
+    }
+
     size_t GetMaxThreadsCount() const noexcept {
         return message_passing_tree.GetMessageProcessorsCount();
     }
@@ -330,37 +1631,173 @@ public:
         return message_passing_tree.GetMessageProcessorsCount();
     }
 
+    // Names are formatted by the logger thread, so logging one on a switch
+    // costs an integer.
+    LogName GetShardLogName(int shard_num) const noexcept {
+        return shard_log_names[shard_num];
+    }
+
     std::string GetShardName(int shard_num) noexcept {
-        std::string name = message_passing_tree.GetMessageProcessorProxy(shard_num)->GetName();
+        auto message_processor_proxy = message_passing_tree.GetMessageProcessorProxy(shard_num);
+        std::string name = message_processor_proxy->GetName();
         name.erase(std::remove_if(name.begin(), name.end(), [](char c) { return !isalpha(c); } ), name.end());
+        if (message_processor_proxy->GetReplicasCount() > 1) {
+            name += "#" + std::to_string(message_processor_proxy->GetReplicaIndex());
+        }
         return name;
     }
 private:
     MessagePassingTree<Args...> message_passing_tree;
-    Vector<std::condition_variable_any> message_wait_cvs;
-    Vector<std::condition_variable_any *> message_send_cvs;
+    Vector<WakeUpSignal> message_wait_signals;
     Vector<bool> is_active;
+    Vector<Vector<int>> thread_shards;
+    Vector<int64_t> current_times;
+    Vector<int64_t> measured_times;
+    Vector<int64_t> idle_times;
+    // Measurements of the last epoch each thread has finished measuring.
+    Vector<int64_t> epoch_measured_times;
+    Vector<int64_t> epoch_idle_times;
+    Vector<int64_t> next_timer_deadlines;
     Vector<StartFinishTimer> message_processor_timers;
     Vector<StartFinishTimer> edge_timers;
-    static const uint64_t wait_for_message_time;
+    bool is_inline_delivery_enabled;
+    double balanced_latency_quantile;
+    int64_t load_half_life;
+    Vector<DecayedRate> message_processor_duration_rates;
+    Vector<DecayedRate> edge_duration_rates;
+    Vector<DecayedRate> edge_count_rates;
+    std::unique_ptr<GraphPartitioner> graph_partitioner;
+    Vector<int> shard_move_rounds;
+    int resharding_round;
+    Vector<int> thread_nodes;
+    Vector<Counter*> thread_busy_counters;
+    Vector<Counter*> thread_idle_counters;
+    Vector<Counter*> message_processor_time_counters;
+    Vector<Counter*> message_processor_pings_counters;
+    Vector<Gauge*> message_processor_load_gauges;
+    Vector<Counter*> edge_time_counters;
+    Vector<Counter*> edge_messages_counters;
+    bool is_latency_measured;
+    Vector<uint64_t> edge_messages_counts;
+    Vector<int64_t> edge_latency_sums;
+    Vector<int64_t> edge_max_latencies;
+    Vector<Histogram*> edge_latency_histograms;
+    Vector<int64_t> edge_queueing_delay_sums;
+    Vector<int64_t> edge_max_queueing_delays;
+    Vector<Histogram*> edge_queueing_delay_histograms;
+    Vector<MessageProcessorPriority> shard_priorities;
+    Vector<LogName> shard_log_names;
+    std::unique_ptr<RemoteEdgeReceiver> remote_edge_receiver;
+    std::unique_ptr<CheckpointFile> restored_checkpoint;
+    static const uint64_t max_wait_for_message_time;
+    static const int64_t cross_thread_message_cost;
+    static const int64_t shard_migration_cost;
+    static const size_t max_shard_moves_per_reshard;
+    static const int reshard_cooldown_rounds;
+    static const size_t max_inline_messages_in_row;
+    static const size_t max_bulk_turn_size;
+    static const int64_t max_bulk_turn_time;
+    static const int64_t cross_node_message_cost_factor;
+    static const double min_thread_utilization;
+    static const double max_thread_utilization;
+    static const double target_thread_utilization;
 };
 
 template <typename ... Args>
-const uint64_t MessagePassingController<Args...>::wait_for_message_time = 1e3; // 1ms
+const uint64_t MessagePassingController<Args...>::max_wait_for_message_time = 1e5; // 100ms
+
+template <typename ... Args>
+const size_t MessagePassingController<Args...>::max_inline_messages_in_row = 1000;
+
+template <typename ... Args>
+const size_t MessagePassingController<Args...>::max_bulk_turn_size = 32;
+
+template <typename ... Args>
+const int64_t MessagePassingController<Args...>::max_bulk_turn_time = 100; // 100us
+
+template <typename ... Args>
+const int64_t MessagePassingController<Args...>::cross_thread_message_cost = 1; // 1us
+
+template <typename ... Args>
+const int64_t MessagePassingController<Args...>::shard_migration_cost = 1000; // 1ms
+
+template <typename ... Args>
+const size_t MessagePassingController<Args...>::max_shard_moves_per_reshard = 4;
+
+template <typename ... Args>
+const int MessagePassingController<Args...>::reshard_cooldown_rounds = 2;
+
+template <typename ... Args>
+const int64_t MessagePassingController<Args...>::cross_node_message_cost_factor = 3;
+
+template <typename ... Args>
+const double MessagePassingController<Args...>::min_thread_utilization = 0.3;
+
+template <typename ... Args>
+const double MessagePassingController<Args...>::max_thread_utilization = 0.85;
+
+template <typename ... Args>
+const double MessagePassingController<Args...>::target_thread_utilization = 0.6;
 
 template <typename ... Args>
 class DynamicallyShardedMessagePassingPool {
 public:
 public:
-    DynamicallyShardedMessagePassingPool()
+    DynamicallyShardedMessagePassingPool(const SharderOptions& options = SharderOptions())
         : controller(),
-          sharder(controller)
+          sharder(controller, options)
     {
     }
 
     void Run() noexcept {
         sharder.Run();
     }
+
+    void Stop() noexcept {
+        sharder.Stop();
+    }
+
+    void Drain() noexcept {
+        sharder.Drain();
+    }
+
+    // Message processors and their pending messages are restored by the
+    // threads which get them first when Run starts. Throws std::system_error
+    // if the checkpoint can not be read or was taken for another topology.
+    void Restore(const std::string& file_name) {
+        controller.SetRestoredCheckpoint(file_name);
+    }
+
+    bool Checkpoint(const std::string& file_name) {
+        return sharder.Checkpoint(file_name);
+    }
+
+    // The other process connects with the complementary types and the rings
+    // swapped. Throws std::invalid_argument if messages crossing the
+    // processes can not be serialized. Must be called before Run.
+    template <typename ... RemoteMPs>
+    void ConnectRemoteProcess(SharedMemoryRing& outgoing_ring, SharedMemoryRing& incoming_ring) {
+        controller.template ConnectRemoteProcess<RemoteMPs...>(outgoing_ring, incoming_ring);
+    }
+
+    int GetActiveThreadsCount() const noexcept {
+        return sharder.GetActiveThreadsCount();
+    }
+
+    // Weight the message processor was placed by at the last resharding.
+    template <typename MessageProcessor>
+    double GetLoad() noexcept {
+        return controller.GetShardLoad(controller.template GetMessageProcessorIndex<MessageProcessor>());
+    }
+
+    const MetricsRegistry& GetMetrics() const noexcept {
+        return sharder.GetMetrics();
+    }
+
+    // Must be called when the pool is not running.
+    std::vector<EdgeStatistics> GetEdgeStatistics() {
+        return controller.GetEdgeStatistics();
+    }
 private:
     MessagePassingController<Args...> controller;
     Sharder<MessagePassingController<Args...>> sharder;
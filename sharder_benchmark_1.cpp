@@ -0,0 +1,116 @@
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include "message_passing_tree.h"
+#include "sharder.h"
+
+// Producers generate messages at a given total rate, workers spend a fixed
+// time on each of them. The elastic pool is expected to follow the load. The
+// peak load needs two CPUs, so the pool may grow to max_threads_count
+// threads unless told otherwise, whatever the number of CPUs.
+
+const int producers_count = 4;
+const int workers_count = 8;
+const int64_t work_time = 50; // 50us
+const int max_threads_count = 4;
+
+std::atomic<int64_t> messages_per_second(0);
+std::atomic<int64_t> processed_count(0);
+
+class WorkMessage : public MessageBase {};
+
+class Worker;
+
+class Producer : public MessageProcessorBase {
+public:
+    Producer()
+    : last_time(0)
+    , budget(0)
+    , wake_up_timer_id(0)
+    , has_wake_up_timer(false)
+    {}
+
+    template <typename Sender>
+    bool Ping(const Sender& sender) {
+        int64_t current_time = GetMonotonicTime();
+        int64_t rate = messages_per_second.load(std::memory_order_relaxed) / producers_count;
+        if (last_time != 0) {
+            budget = std::min(budget + (current_time - last_time) * rate / 1e6, max_budget);
+        }
+        last_time = current_time;
+        bool was_sent = false;
+        while (budget >= 1) {
+            auto message = std::make_unique<WorkMessage>();
+            if (!sender.template TrySend<Worker>(message)) {
+                break;
+            }
+            budget -= 1;
+            was_sent = true;
+        }
+        if (rate > 0 && (!has_wake_up_timer || !sender.IsTimerPending(wake_up_timer_id))) {
+            wake_up_timer_id = sender.WakeUpAfter(std::max(int64_t(1e6) / rate, int64_t(1)));
+            has_wake_up_timer = true;
+        }
+        return was_sent;
+    }
+private:
+    int64_t last_time;
+    double budget;
+    uint64_t wake_up_timer_id;
+    bool has_wake_up_timer;
+    static constexpr double max_budget = 100;
+};
+
+class Worker : public MessageProcessorBase {
+public:
+    template <typename Sender>
+    bool Ping(const Sender& sender) {
+        return false;
+    }
+
+    template <typename Sender>
+    void Receive(const ReceivingFrom<Producer>&, const WorkMessage&, const Sender& sender) {
+        int64_t finish_time = GetMonotonicTime() + work_time;
+        while (GetMonotonicTime() < finish_time) {
+        }
+        processed_count.fetch_add(1, std::memory_order_relaxed);
+    }
+};
+
+int main(int argc, char** argv) {
+    SharderOptions options;
+    options.is_elastic = true;
+    options.threads_count = max_threads_count;
+    if (argc > 1) {
+        options.threads_count = std::stoi(argv[1]);
+    }
+    DynamicallyShardedMessagePassingPool<
+        Edge<Replicated<Producer, producers_count>, Replicated<Worker, workers_count>, WorkMessage, 1000>> pool(options);
+    std::thread runner([&pool]() { pool.Run(); });
+    const int64_t load_levels[] = {1000, 5000, 40000, 5000, 1000};
+    const int phase_seconds = 8;
+    std::ostringstream results;
+    for (int64_t load_level : load_levels) {
+        messages_per_second.store(load_level);
+        std::this_thread::sleep_for(std::chrono::seconds(phase_seconds / 2));
+        int64_t start_count = processed_count.load();
+        int64_t start_time = GetMonotonicTime();
+        int threads_sum = 0;
+        for (int i = 0; i < phase_seconds / 2; ++i) {
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+            threads_sum += pool.GetActiveThreadsCount();
+        }
+        double throughput = (processed_count.load() - start_count) * 1e6 / (GetMonotonicTime() - start_time);
+        double average_threads = static_cast<double>(threads_sum) / (phase_seconds / 2);
+        results << "Load = " << load_level << " msg/s, throughput = " << throughput << " msg/s, threads = "
+            << average_threads << ", per thread = " << throughput / average_threads << " msg/s" << std::endl;
+    }
+    pool.Stop();
+    runner.join();
+    std::cout << results.str();
+    return 0;
+}
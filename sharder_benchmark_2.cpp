@@ -0,0 +1,294 @@
+#include <sys/resource.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "message_passing_tree.h"
+#include "sharder.h"
+
+// Standard topologies run at full speed for a fixed time, then producers
+// stop and the pool is drained. Every delivery is a hop, its latency is the
+// time from sending to the start of receiving. Results are printed as JSON.
+
+const int replicas_count = 4;
+const int ring_tokens_count = 64;
+const int hot_key_percent = 80;
+const int64_t work_time = 5; // 5us
+
+std::atomic<bool> is_producing(false);
+size_t payload_size = 0;
+
+// Every thread counts its own deliveries, the counts are summed up once the
+// pool has returned from Run.
+struct ThreadStatistics {
+    uint64_t messages_count = 0;
+    uint64_t checksum = 0;
+    LatencyHistogram latencies;
+};
+
+std::mutex statistics_mutex;
+std::vector<std::unique_ptr<ThreadStatistics>> thread_statistics;
+std::atomic<uint64_t> run_number(0);
+
+ThreadStatistics& GetThreadStatistics() {
+    thread_local uint64_t statistics_run_number = 0;
+    thread_local ThreadStatistics* statistics = nullptr;
+    if (statistics == nullptr || statistics_run_number != run_number.load(std::memory_order_relaxed)) {
+        std::lock_guard<std::mutex> lock(statistics_mutex);
+        thread_statistics.push_back(std::make_unique<ThreadStatistics>());
+        statistics = thread_statistics.back().get();
+        statistics_run_number = run_number.load(std::memory_order_relaxed);
+    }
+    return *statistics;
+}
+
+class PayloadMessage : public MessageBase {
+public:
+    PayloadMessage(int key)
+    : sent_time(GetMonotonicTime())
+    , key(key)
+    , payload(payload_size, static_cast<char>(key))
+    {}
+
+    int GetRoutingKey() const noexcept {
+        return key;
+    }
+
+    int64_t sent_time;
+    int key;
+    std::vector<char> payload;
+};
+
+void ReceivePayload(const PayloadMessage& message) {
+    int64_t receive_time = GetMonotonicTime();
+    ThreadStatistics& statistics = GetThreadStatistics();
+    for (char symbol : message.payload) {
+        statistics.checksum += symbol;
+    }
+    while (GetMonotonicTime() < receive_time + work_time) {
+    }
+    if (is_producing.load(std::memory_order_relaxed)) {
+        ++statistics.messages_count;
+        statistics.latencies.Record(receive_time - message.sent_time);
+    }
+}
+
+// Sends as long as the edge to the receivers is not full.
+template <typename To>
+class Producer : public MessageProcessorBase {
+public:
+    Producer()
+    : sent_count(0)
+    {}
+
+    template <typename Sender>
+    bool Ping(const Sender& sender) {
+        bool was_sent = false;
+        while (is_producing.load(std::memory_order_relaxed)) {
+            int key = sent_count++ % 100 < hot_key_percent ? 0 : sent_count;
+            auto message = std::make_unique<PayloadMessage>(key);
+            if (!sender.template TrySend<To>(message)) {
+                break;
+            }
+            was_sent = true;
+        }
+        return was_sent;
+    }
+private:
+    int sent_count;
+};
+
+template <typename To>
+class Forwarder : public MessageProcessorBase {
+public:
+    template <typename Sender>
+    bool Ping(const Sender& sender) {
+        return false;
+    }
+
+    template <typename From, typename Sender>
+    void Receive(const ReceivingFrom<From>&, const PayloadMessage& message, const Sender& sender) {
+        ReceivePayload(message);
+        sender.template Send<To>(std::make_unique<PayloadMessage>(message.key));
+    }
+};
+
+class Consumer : public MessageProcessorBase {
+public:
+    template <typename Sender>
+    bool Ping(const Sender& sender) {
+        return false;
+    }
+
+    template <typename From, typename Sender>
+    void Receive(const ReceivingFrom<From>&, const PayloadMessage& message, const Sender& sender) {
+        ReceivePayload(message);
+    }
+};
+
+const int ring_size = 4;
+
+// Tokens injected by the first node go around until producing stops.
+template <int Index>
+class RingNode : public MessageProcessorBase {
+public:
+    using Next = RingNode<(Index + 1) % ring_size>;
+
+    RingNode()
+    : injected_count(0)
+    {}
+
+    template <typename Sender>
+    bool Ping(const Sender& sender) {
+        if (Index != 0 || injected_count == ring_tokens_count || !is_producing.load(std::memory_order_relaxed)) {
+            return false;
+        }
+        for (; injected_count < ring_tokens_count; ++injected_count) {
+            sender.template Send<Next>(std::make_unique<PayloadMessage>(injected_count));
+        }
+        return true;
+    }
+
+    template <typename From, typename Sender>
+    void Receive(const ReceivingFrom<From>&, const PayloadMessage& message, const Sender& sender) {
+        ReceivePayload(message);
+        if (is_producing.load(std::memory_order_relaxed)) {
+            sender.template Send<Next>(std::make_unique<PayloadMessage>(message.key));
+        }
+    }
+private:
+    int injected_count;
+};
+
+using Stage3 = Consumer;
+using Stage2 = Forwarder<Stage3>;
+using Stage1 = Forwarder<Stage2>;
+
+using PipelinePool = DynamicallyShardedMessagePassingPool<
+    Edge<Producer<Stage1>, Stage1, PayloadMessage, 100>,
+    Edge<Stage1, Stage2, PayloadMessage>,
+    Edge<Stage2, Stage3, PayloadMessage>>;
+
+using FanInPool = DynamicallyShardedMessagePassingPool<
+    Edge<Replicated<Producer<Consumer>, replicas_count>, Consumer, PayloadMessage, 100>>;
+
+using FanOutPool = DynamicallyShardedMessagePassingPool<
+    Edge<Producer<Consumer>, Replicated<Consumer, replicas_count>, PayloadMessage, 100>>;
+
+using RingPool = DynamicallyShardedMessagePassingPool<
+    Edge<RingNode<0>, RingNode<1>, PayloadMessage>,
+    Edge<RingNode<1>, RingNode<2>, PayloadMessage>,
+    Edge<RingNode<2>, RingNode<3>, PayloadMessage>,
+    Edge<RingNode<3>, RingNode<0>, PayloadMessage>>;
+
+using AllToAllPool = DynamicallyShardedMessagePassingPool<
+    Edge<Replicated<Producer<Consumer>, replicas_count>, Replicated<Consumer, replicas_count>, PayloadMessage, 100>>;
+
+using HotPool = DynamicallyShardedMessagePassingPool<
+    Edge<Replicated<Producer<Consumer>, replicas_count>, Replicated<Consumer, replicas_count, KeyHashRouting>,
+        PayloadMessage, 100>>;
+
+int64_t GetCpuTime() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * int64_t(1e6) + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+template <typename Pool>
+void RunTopology(const std::string& topology, int threads_count, size_t new_payload_size, int64_t duration,
+        std::ostream& results) {
+    SharderOptions options;
+    options.threads_count = threads_count;
+    payload_size = new_payload_size;
+    ++run_number;
+    thread_statistics.clear();
+    is_producing.store(true);
+    Pool pool(options);
+    int64_t start_time = GetMonotonicTime();
+    int64_t start_cpu_time = GetCpuTime();
+    std::thread runner([&pool]() { pool.Run(); });
+    std::this_thread::sleep_for(std::chrono::microseconds(duration));
+    is_producing.store(false);
+    int64_t finish_time = GetMonotonicTime();
+    int64_t finish_cpu_time = GetCpuTime();
+    pool.Drain();
+    runner.join();
+    int64_t drain_time = GetMonotonicTime() - finish_time;
+    ThreadStatistics total;
+    for (const auto& statistics : thread_statistics) {
+        total.messages_count += statistics->messages_count;
+        total.latencies.Merge(statistics->latencies);
+    }
+    results << "{\"topology\": \"" << topology << "\", \"threads\": " << threads_count
+        << ", \"payload_bytes\": " << new_payload_size
+        << ", \"messages_per_second\": " << total.messages_count * 1e6 / (finish_time - start_time)
+        << ", \"latency_us\": {\"p50\": " << total.latencies.GetP50()
+        << ", \"p99\": " << total.latencies.GetP99()
+        << ", \"p999\": " << total.latencies.GetP999()
+        << "}, \"cpu_utilization\": " << static_cast<double>(finish_cpu_time - start_cpu_time) /
+            (finish_time - start_time) / threads_count
+        << ", \"drain_us\": " << drain_time << "}";
+}
+
+int main(int argc, char** argv) {
+    int64_t duration = 2e6; // 2s
+    std::string output_path;
+    for (int i = 1; i < argc; ++i) {
+        std::string argument = argv[i];
+        if (argument.rfind("--duration=", 0) == 0) {
+            duration = std::stoll(argument.substr(std::string("--duration=").size()));
+        } else if (argument.rfind("--output=", 0) == 0) {
+            output_path = argument.substr(std::string("--output=").size());
+        }
+    }
+    const int threads_counts[] = {1, 2, 4};
+    const size_t payload_sizes[] = {16, 1024};
+    std::ostringstream results;
+    results << "[" << std::endl;
+    bool is_first = true;
+    for (int threads_count : threads_counts) {
+        for (size_t new_payload_size : payload_sizes) {
+            for (int topology = 0; topology < 6; ++topology) {
+                results << (is_first ? "  " : ",\n  ");
+                is_first = false;
+                switch (topology) {
+                    case 0:
+                        RunTopology<PipelinePool>("pipeline", threads_count, new_payload_size, duration, results);
+                        break;
+                    case 1:
+                        RunTopology<FanInPool>("fan_in", threads_count, new_payload_size, duration, results);
+                        break;
+                    case 2:
+                        RunTopology<FanOutPool>("fan_out", threads_count, new_payload_size, duration, results);
+                        break;
+                    case 3:
+                        RunTopology<RingPool>("ring", threads_count, new_payload_size, duration, results);
+                        break;
+                    case 4:
+                        RunTopology<AllToAllPool>("all_to_all", threads_count, new_payload_size, duration, results);
+                        break;
+                    case 5:
+                        RunTopology<HotPool>("hot_message_processor", threads_count, new_payload_size, duration, results);
+                        break;
+                }
+            }
+        }
+    }
+    results << std::endl << "]" << std::endl;
+    global_logger.Flush();
+    if (output_path.empty()) {
+        std::cout << results.str();
+    } else {
+        std::ofstream(output_path) << results.str();
+    }
+    return 0;
+}
@@ -1,7 +1,9 @@
 #include "message_passing_tree.h"
 #include "sharder.h"
-#include <thread>
-#include <chrono>
+#include "timers.h"
+#include <functional>
+#include <iostream>
+#include <memory>
 
 class IntMessage: public MessageBase {
 public:
@@ -11,13 +13,59 @@ public:
     int a;
 };
 
+class MessageProcessorC;
+
+// In an elastic simulation message processors work only in its middle third,
+// so the pool is expected to shrink, grow and shrink again. The active
+// threads count is sampled at the end of every third.
+bool is_load_phased = false;
+int64_t busy_phase_start = 0;
+int64_t busy_phase_finish = 0;
+std::function<int()> get_active_threads_count;
+int phase_threads_counts[3] = {0, 0, 0};
+
+// Weights of MessageProcessorA after the first reshardings, which see the
+// start of the pool. Its load is steady.
+std::function<double()> get_steady_load;
+double min_steady_load = 0;
+double max_steady_load = 0;
+int64_t steady_load_start = 0;
+
+bool IsWorking() noexcept {
+    int64_t time = GetMonotonicTime();
+    return !is_load_phased || (time >= busy_phase_start && time < busy_phase_finish);
+}
+
+void SampleSteadyLoad() {
+    if (!get_steady_load || GetMonotonicTime() < steady_load_start) {
+        return;
+    }
+    double load = get_steady_load();
+    min_steady_load = min_steady_load == 0 ? load : std::min(min_steady_load, load);
+    max_steady_load = std::max(max_steady_load, load);
+}
+
+void SampleActiveThreadsCount() {
+    if (!is_load_phased) {
+        return;
+    }
+    int64_t time = GetMonotonicTime();
+    int phase = time < busy_phase_start ? 0 : (time < busy_phase_finish ? 1 : 2);
+    phase_threads_counts[phase] = get_active_threads_count();
+}
+
 class MessageProcessorA : public MessageProcessorBase {
 public:
     using MessageProcessorBase::MessageProcessorBase;
 
     template <typename Sender>
     bool Ping(const Sender& sender) {
-        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        if (!IsWorking()) {
+            return false;
+        }
+        SpendTime(1000);
+        auto message = std::make_unique<IntMessage>(1);
+        sender.template TrySend<MessageProcessorC>(message);
         return true;
     }
 };
@@ -28,7 +76,12 @@ public:
 
     template <typename Sender>
     bool Ping(const Sender& sender) {
-        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        SampleActiveThreadsCount();
+        SampleSteadyLoad();
+        if (!IsWorking()) {
+            return false;
+        }
+        SpendTime(1000);
         return true;
     }
 };
@@ -39,7 +92,10 @@ public:
 
     template <typename Sender>
     bool Ping(const Sender& sender) {
-        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        if (!IsWorking()) {
+            return false;
+        }
+        SpendTime(2000);
         return true;
     }
 
@@ -52,11 +108,164 @@ public:
     }
 };
 
-int main() {
+class MessageProcessorCriticalConsumer;
+class MessageProcessorBulkConsumer;
+
+// Sends the same bursts to a critical and to a bulk consumer, which take
+// equally long per message. A burst is longer than a delivered batch, so
+// critical messages stay pending and bulk ones wait for max_bulk_delay. Critical messages are expected to overtake bulk
+// ones on a shared thread.
+class MessageProcessorMixedProducer : public MessageProcessorBase {
+public:
+    using MessageProcessorBase::MessageProcessorBase;
+
+    template <typename Sender>
+    bool Ping(const Sender& sender) {
+        SpendTime(10);
+        for (int i = 0; i < 96; ++i) {
+            auto critical_message = std::make_unique<IntMessage>(1);
+            sender.template TrySend<MessageProcessorCriticalConsumer>(critical_message);
+            auto bulk_message = std::make_unique<IntMessage>(1);
+            sender.template TrySend<MessageProcessorBulkConsumer>(bulk_message);
+        }
+        return true;
+    }
+};
+
+class MessageProcessorCriticalConsumer : public MessageProcessorBase {
+public:
+    using MessageProcessorBase::MessageProcessorBase;
+    static constexpr MessageProcessorPriority priority = MessageProcessorPriority::Critical;
+
+    template <typename Sender>
+    void Receive(const ReceivingFrom<MessageProcessorMixedProducer>&, const IntMessage&, const Sender&) {
+        SpendTime(1);
+    }
+};
+
+class MessageProcessorBulkConsumer : public MessageProcessorBase {
+public:
+    using MessageProcessorBase::MessageProcessorBase;
+    static constexpr MessageProcessorPriority priority = MessageProcessorPriority::Bulk;
+
+    template <typename Sender>
+    void Receive(const ReceivingFrom<MessageProcessorMixedProducer>&, const IntMessage&, const Sender&) {
+        SpendTime(1);
+    }
+};
+
+// Work stealing turns inline delivery off, so messages wait in the queues
+// even on one thread.
+void TestPriorities(SharderOptions options) {
+    options.threads_count = 1;
+    options.is_work_stealing_enabled = true;
     DynamicallyShardedMessagePassingPool<
-        Edge<MessageProcessorA, MessageProcessorC, IntMessage>,
-        Edge<MessageProcessorB, MessageProcessorC, IntMessage>> dsmpp;
+        Edge<MessageProcessorMixedProducer, MessageProcessorCriticalConsumer, IntMessage, 1000>,
+        Edge<MessageProcessorMixedProducer, MessageProcessorBulkConsumer, IntMessage, 1000>> dsmpp(options);
     dsmpp.Run();
+    int64_t critical_queueing_delay = 0;
+    int64_t bulk_queueing_delay = 0;
+    uint64_t critical_messages_count = 0;
+    uint64_t bulk_messages_count = 0;
+    for (const auto& edge : dsmpp.GetEdgeStatistics()) {
+        int64_t queueing_delay = edge.messages_count != 0 ? edge.queueing_delay_sum / static_cast<int64_t>(edge.messages_count) : 0;
+        std::cout << edge.from << " -> " << edge.to << " : " << edge.messages_count << " messages, mean queueing delay "
+            << queueing_delay << "us" << std::endl;
+        bool is_critical = edge.to == "MessageProcessorCriticalConsumer";
+        (is_critical ? critical_queueing_delay : bulk_queueing_delay) = queueing_delay;
+        (is_critical ? critical_messages_count : bulk_messages_count) = edge.messages_count;
+    }
+    std::cout << "Critical messages overtake bulk ones = " << (critical_queueing_delay < bulk_queueing_delay) << std::endl;
+    std::cout << "Bulk messages take at least 10% = " <<
+        (bulk_messages_count * 10 >= critical_messages_count + bulk_messages_count) << std::endl;
+}
+
+int main(int argc, char** argv) {
+    SharderOptions options;
+    bool is_priority_test = false;
+    std::unique_ptr<VirtualClock> clock;
+    std::unique_ptr<Clock> timer_clock;
+    for (int i = 1; i < argc; ++i) {
+        std::string argument = argv[i];
+        if (argument == "--work-stealing") {
+            options.threads_count = 2;
+            options.is_work_stealing_enabled = true;
+        } else if (argument == "--priorities") {
+            is_priority_test = true;
+        } else if (argument == "--elastic") {
+            options.is_elastic = true;
+        } else if (argument == "--pin") {
+            options.is_pinning_enabled = true;
+        } else if (argument.rfind("--topology=", 0) == 0) {
+            options.simulated_topology = argument.substr(std::string("--topology=").size());
+        } else if (argument.rfind("--metrics=", 0) == 0) {
+            options.metrics_export_target = argument.substr(std::string("--metrics=").size());
+        } else if (argument.rfind("--threads=", 0) == 0) {
+            options.threads_count = std::stoi(argument.substr(std::string("--threads=").size()));
+        } else if (argument == "--simulate" || argument.rfind("--simulate=", 0) == 0) {
+            options.is_simulated = true;
+            if (argument != "--simulate") {
+                options.simulation_seed = std::stoull(argument.substr(std::string("--simulate=").size()));
+            }
+        } else if (argument == "--timer-clock=tsc") {
+            timer_clock = std::make_unique<TscClock>();
+        } else if (argument == "--timer-clock=coarse") {
+            timer_clock = std::make_unique<CoarseMonotonicClock>();
+        } else if (argument.rfind("--balanced-quantile=", 0) == 0) {
+            options.balanced_latency_quantile = std::stod(argument.substr(std::string("--balanced-quantile=").size()));
+        } else if (argument.rfind("--load-half-life=", 0) == 0) {
+            options.load_half_life = std::stoll(argument.substr(std::string("--load-half-life=").size()));
+        } else if (argument.rfind("--duration=", 0) == 0) {
+            options.simulated_duration = std::stoll(argument.substr(std::string("--duration=").size()));
+        }
+    }
+    if (options.is_simulated) {
+        clock = std::make_unique<VirtualClock>();
+        SetClock(clock.get());
+        is_load_phased = options.is_elastic;
+        busy_phase_start = GetMonotonicTime() + options.simulated_duration / 3;
+        busy_phase_finish = GetMonotonicTime() + options.simulated_duration * 2 / 3;
+    }
+    SetTimerClock(timer_clock.get());
+    if (is_priority_test && options.is_simulated) {
+        TestPriorities(options);
+        global_logger.Flush();
+        SetClock(nullptr);
+        SetTimerClock(nullptr);
+        return 0;
+    }
+    DynamicallyShardedMessagePassingPool<
+        Edge<MessageProcessorA, Replicated<MessageProcessorC, 2>, IntMessage, 100>,
+        Edge<MessageProcessorB, Replicated<MessageProcessorC, 2>, IntMessage>> dsmpp(options);
+    get_active_threads_count = [&dsmpp]() { return dsmpp.GetActiveThreadsCount(); };
+    if (options.is_simulated && !options.is_elastic) {
+        steady_load_start = GetMonotonicTime() + 3000000;
+        get_steady_load = [&dsmpp]() { return dsmpp.template GetLoad<MessageProcessorA>(); };
+    }
+    dsmpp.Run();
+    if (options.is_simulated) {
+        global_logger.Flush();
+        for (const auto& edge : dsmpp.GetEdgeStatistics()) {
+            std::cout << edge.from << " -> " << edge.to << " : " << edge.messages_count << " messages, "
+                << edge.messages_count * 1e6 / options.simulated_duration << " msg/s, mean latency "
+                << (edge.messages_count != 0 ? edge.latency_sum / static_cast<int64_t>(edge.messages_count) : 0)
+                << "us, max latency " << edge.max_latency << "us, mean queueing delay "
+                << (edge.messages_count != 0 ? edge.queueing_delay_sum / static_cast<int64_t>(edge.messages_count) : 0)
+                << "us" << std::endl;
+        }
+        if (get_steady_load) {
+            std::cout << "Weight of MessageProcessorA from " << min_steady_load << " to " << max_steady_load
+                << ", stays within 10% = " << (min_steady_load > 0 && max_steady_load < min_steady_load * 1.1) << std::endl;
+        }
+        if (is_load_phased) {
+            std::cout << "Active threads when idle, busy and idle again: " << phase_threads_counts[0] << ", "
+                << phase_threads_counts[1] << ", " << phase_threads_counts[2] << std::endl;
+            std::cout << "Threads shrank, grew and shrank = " << (phase_threads_counts[0] < phase_threads_counts[1] &&
+                    phase_threads_counts[2] < phase_threads_counts[1]) << std::endl;
+        }
+        SetClock(nullptr);
+    }
+    SetTimerClock(nullptr);
     return 0;
 }
 
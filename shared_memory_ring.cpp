@@ -0,0 +1,250 @@
+#include <cstring>
+#include <new>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "shared_memory_ring.h"
+#include "timers.h"
+
+const int64_t SharedMemoryRing::max_push_wait_time = 1e6; // 1s
+const int64_t RemoteEdgeReceiver::max_wait_time = 1e5; // 100ms
+
+namespace {
+
+struct RingRecordHeader {
+    // skip_edge_index marks the unused end of the segment.
+    int32_t edge_index;
+    uint32_t payload_size;
+};
+
+const int32_t skip_edge_index = -1;
+
+size_t GetRecordSize(const size_t payload_size) noexcept {
+    return (sizeof(RingRecordHeader) + payload_size + 7) / 8 * 8;
+}
+
+void ThrowSystemError(const std::string& what) {
+    throw std::system_error(errno, std::generic_category(), what);
+}
+
+}
+
+// Positions only grow, records start at their position modulo the capacity.
+// The waiting flag and the positions are accessed in sequentially consistent
+// order, so either the writer sees the reader waiting or the reader sees the
+// new record.
+struct SharedMemoryRing::Header {
+    alignas(64) std::atomic<uint64_t> head;
+    alignas(64) std::atomic<uint64_t> tail;
+    alignas(64) std::atomic<uint32_t> is_reader_waiting;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "Shared positions must be lock-free");
+
+SharedMemoryRing::SharedMemoryRing(const size_t capacity)
+    : memory_descriptor(-1),
+      event_descriptor(-1),
+      header(nullptr),
+      capacity((capacity + 7) / 8 * 8),
+      push_mutex(),
+      front_size(0),
+      dropped_count(0)
+{
+    memory_descriptor = syscall(SYS_memfd_create, "rast_ring", 0);
+    if (memory_descriptor == -1) {
+        ThrowSystemError("Cannot create ring segment");
+    }
+    if (ftruncate(memory_descriptor, sizeof(Header) + this->capacity) == -1) {
+        close(memory_descriptor);
+        ThrowSystemError("Cannot resize ring segment");
+    }
+    event_descriptor = eventfd(0, 0);
+    if (event_descriptor == -1) {
+        close(memory_descriptor);
+        ThrowSystemError("Cannot create ring eventfd");
+    }
+    try {
+        Map();
+    } catch (...) {
+        close(memory_descriptor);
+        close(event_descriptor);
+        throw;
+    }
+    new (header) Header();
+    header->head.store(0);
+    header->tail.store(0);
+    header->is_reader_waiting.store(0);
+}
+
+SharedMemoryRing::SharedMemoryRing(const int memory_descriptor, const int event_descriptor)
+    : memory_descriptor(memory_descriptor),
+      event_descriptor(event_descriptor),
+      header(nullptr),
+      capacity(0),
+      push_mutex(),
+      front_size(0),
+      dropped_count(0)
+{
+    struct stat segment_stat;
+    if (fstat(memory_descriptor, &segment_stat) == -1) {
+        ThrowSystemError("Cannot read ring segment");
+    }
+    capacity = segment_stat.st_size - sizeof(Header);
+    Map();
+}
+
+SharedMemoryRing::~SharedMemoryRing() {
+    munmap(header, sizeof(Header) + capacity);
+    close(memory_descriptor);
+    close(event_descriptor);
+}
+
+void SharedMemoryRing::Map() {
+    void* mapped_data = mmap(nullptr, sizeof(Header) + capacity, PROT_READ | PROT_WRITE, MAP_SHARED, memory_descriptor, 0);
+    if (mapped_data == MAP_FAILED) {
+        ThrowSystemError("Cannot map ring segment");
+    }
+    header = static_cast<Header*>(mapped_data);
+}
+
+char* SharedMemoryRing::GetRecords() const noexcept {
+    return reinterpret_cast<char*>(header) + sizeof(Header);
+}
+
+bool SharedMemoryRing::Push(const int edge_index, const std::string& payload, const int64_t wait_time) noexcept {
+    size_t record_size = GetRecordSize(payload.size());
+    if (record_size > capacity) {
+        return false;
+    }
+    int64_t deadline = wait_time > 0 ? GetMonotonicTime() + wait_time : 0;
+    std::unique_lock<std::mutex> lock(push_mutex);
+    uint64_t tail;
+    size_t skipped_size;
+    while (true) {
+        tail = header->tail.load(std::memory_order_relaxed);
+        size_t space_till_end = capacity - tail % capacity;
+        skipped_size = space_till_end < record_size ? space_till_end : 0;
+        if (tail + skipped_size + record_size - header->head.load(std::memory_order_acquire) <= capacity) {
+            break;
+        }
+        if (wait_time <= 0 || GetMonotonicTime() >= deadline) {
+            return false;
+        }
+        // Other writers go on meanwhile, their records may fit already.
+        lock.unlock();
+        std::this_thread::yield();
+        lock.lock();
+    }
+    if (skipped_size != 0) {
+        RingRecordHeader skip_header{skip_edge_index, 0};
+        std::memcpy(GetRecords() + tail % capacity, &skip_header, sizeof(skip_header));
+        tail += skipped_size;
+    }
+    RingRecordHeader record_header{edge_index, static_cast<uint32_t>(payload.size())};
+    char* record = GetRecords() + tail % capacity;
+    std::memcpy(record, &record_header, sizeof(record_header));
+    std::memcpy(record + sizeof(record_header), payload.data(), payload.size());
+    header->tail.store(tail + record_size);
+    if (header->is_reader_waiting.load()) {
+        Notify();
+    }
+    return true;
+}
+
+bool SharedMemoryRing::Send(const int edge_index, const std::string& payload) noexcept {
+    if (!Push(edge_index, payload, max_push_wait_time)) {
+        dropped_count.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+bool SharedMemoryRing::TrySend(const int edge_index, const std::string& payload) noexcept {
+    return Push(edge_index, payload, 0);
+}
+
+bool SharedMemoryRing::Front(TrafficRecord& record) noexcept {
+    uint64_t head = header->head.load(std::memory_order_relaxed);
+    while (head != header->tail.load(std::memory_order_acquire)) {
+        RingRecordHeader record_header;
+        const char* data = GetRecords() + head % capacity;
+        std::memcpy(&record_header, data, sizeof(record_header));
+        if (record_header.edge_index == skip_edge_index) {
+            head += capacity - head % capacity;
+            header->head.store(head, std::memory_order_release);
+            continue;
+        }
+        record.edge_index = record_header.edge_index;
+        record.timestamp = 0;
+        record.payload = data + sizeof(record_header);
+        record.payload_size = record_header.payload_size;
+        front_size = GetRecordSize(record_header.payload_size);
+        return true;
+    }
+    return false;
+}
+
+void SharedMemoryRing::Pop() noexcept {
+    header->head.store(header->head.load(std::memory_order_relaxed) + front_size, std::memory_order_release);
+}
+
+void SharedMemoryRing::WaitForRecords(const int64_t wait_time) noexcept {
+    header->is_reader_waiting.store(1);
+    if (header->head.load() == header->tail.load()) {
+        pollfd event_poll{event_descriptor, POLLIN, 0};
+        if (poll(&event_poll, 1, (wait_time + 999) / 1000) > 0) {
+            uint64_t events_count;
+            ssize_t read_size = read(event_descriptor, &events_count, sizeof(events_count));
+            static_cast<void>(read_size);
+        }
+    }
+    header->is_reader_waiting.store(0);
+}
+
+void SharedMemoryRing::Notify() noexcept {
+    // Fails only if the counter would overflow, the reader is woken up then.
+    uint64_t event = 1;
+    ssize_t written_size = write(event_descriptor, &event, sizeof(event));
+    static_cast<void>(written_size);
+}
+
+int SharedMemoryRing::GetMemoryDescriptor() const noexcept {
+    return memory_descriptor;
+}
+
+int SharedMemoryRing::GetEventDescriptor() const noexcept {
+    return event_descriptor;
+}
+
+uint64_t SharedMemoryRing::GetDroppedCount() const noexcept {
+    return dropped_count.load(std::memory_order_relaxed);
+}
+
+RemoteEdgeReceiver::RemoteEdgeReceiver(SharedMemoryRing& ring, std::function<void(const TrafficRecord&)> on_record)
+    : ring(ring),
+      on_record(std::move(on_record)),
+      is_stopped(false),
+      receive_thread(&RemoteEdgeReceiver::ReceiveAction, this)
+{
+}
+
+RemoteEdgeReceiver::~RemoteEdgeReceiver() {
+    is_stopped.store(true);
+    ring.Notify();
+    receive_thread.join();
+}
+
+void RemoteEdgeReceiver::ReceiveAction() noexcept {
+    TrafficRecord record;
+    while (!is_stopped.load()) {
+        while (ring.Front(record)) {
+            on_record(record);
+            ring.Pop();
+        }
+        ring.WaitForRecords(max_wait_time);
+    }
+}
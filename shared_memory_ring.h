@@ -0,0 +1,79 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+
+#include "message_passing_tree.h"
+#include "traffic_recorder.h"
+
+// Ring of serialized messages in a memory segment shared by two processes,
+// one process writes and the other one reads. The segment and the eventfd
+// waking the reader are inherited by fork or passed to the other process by
+// their descriptors. Threads of the writing process take turns on a mutex,
+// the processes themselves do not lock anything.
+class SharedMemoryRing : public RemoteChannel {
+public:
+    // Throws std::system_error if the segment can not be created.
+    explicit SharedMemoryRing(const size_t capacity);
+    // Maps a ring created by another process.
+    SharedMemoryRing(const int memory_descriptor, const int event_descriptor);
+    SharedMemoryRing(const SharedMemoryRing&) = delete;
+    SharedMemoryRing& operator=(const SharedMemoryRing&) = delete;
+    ~SharedMemoryRing();
+
+    // Waits up to wait_time while the ring is full, so a reader which has
+    // died does not block the writer forever. Returns false if the record is
+    // larger than the ring or the reader does not make space for it in time.
+    bool Push(const int edge_index, const std::string& payload, const int64_t wait_time) noexcept;
+    // Waits up to max_push_wait_time, records which are not pushed are
+    // dropped and counted.
+    virtual bool Send(const int edge_index, const std::string& payload) noexcept;
+    virtual bool TrySend(const int edge_index, const std::string& payload) noexcept;
+    // Returns false if the ring is empty. The payload stays valid until Pop.
+    bool Front(TrafficRecord& record) noexcept;
+    void Pop() noexcept;
+    // Returns once a record is pushed, Notify is called or the time is over.
+    void WaitForRecords(const int64_t wait_time) noexcept;
+    void Notify() noexcept;
+
+    int GetMemoryDescriptor() const noexcept;
+    int GetEventDescriptor() const noexcept;
+    uint64_t GetDroppedCount() const noexcept;
+private:
+    struct Header;
+
+    void Map();
+    char* GetRecords() const noexcept;
+
+    static const int64_t max_push_wait_time;
+    int memory_descriptor;
+    int event_descriptor;
+    Header* header;
+    size_t capacity;
+    std::mutex push_mutex;
+    size_t front_size;
+    std::atomic<uint64_t> dropped_count;
+};
+
+// Reads records of a ring on a thread of its own and hands them to the
+// callback, which is expected to push them into the local queues.
+class RemoteEdgeReceiver {
+public:
+    RemoteEdgeReceiver(SharedMemoryRing& ring, std::function<void(const TrafficRecord&)> on_record);
+    RemoteEdgeReceiver(const RemoteEdgeReceiver&) = delete;
+    RemoteEdgeReceiver& operator=(const RemoteEdgeReceiver&) = delete;
+    ~RemoteEdgeReceiver();
+private:
+    void ReceiveAction() noexcept;
+
+    static const int64_t max_wait_time;
+    SharedMemoryRing& ring;
+    std::function<void(const TrafficRecord&)> on_record;
+    std::atomic<bool> is_stopped;
+    std::thread receive_thread;
+};
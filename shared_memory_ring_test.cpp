@@ -0,0 +1,236 @@
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "shared_memory_ring.h"
+#include "sharder.h"
+
+const int messages_count = 1000;
+
+class CounterMessage : public MessageBase {
+public:
+    CounterMessage(const int value)
+    : value(value)
+    {}
+
+    void Serialize(std::string& output) const {
+        output.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    static std::unique_ptr<CounterMessage> Deserialize(const char* data, const size_t size) {
+        int value = 0;
+        std::memcpy(&value, data, std::min(size, sizeof(value)));
+        return std::make_unique<CounterMessage>(value);
+    }
+
+    int value;
+};
+
+std::atomic<int> acknowledged_count{0};
+std::atomic<int> received_count{0};
+std::atomic<int> out_of_order_count{0};
+
+class MessageProcessorConsumer;
+
+class MessageProcessorProducer : public MessageProcessorBase {
+public:
+    using MessageProcessorBase::MessageProcessorBase;
+
+    template <typename Sender>
+    bool Ping(const Sender& sender) {
+        if (next_value == messages_count) {
+            return false;
+        }
+        sender.template Send<MessageProcessorConsumer>(std::make_unique<CounterMessage>(next_value++));
+        return true;
+    }
+
+    template <typename Sender>
+    void Receive(const ReceivingFrom<MessageProcessorConsumer>&, const CounterMessage& message, const Sender&) {
+        if (message.value != acknowledged_count.load()) {
+            out_of_order_count.fetch_add(1);
+        }
+        acknowledged_count.fetch_add(1);
+    }
+private:
+    int next_value = 0;
+};
+
+class MessageProcessorConsumer : public MessageProcessorBase {
+public:
+    using MessageProcessorBase::MessageProcessorBase;
+
+    template <typename Sender>
+    bool Ping(const Sender&) {
+        return false;
+    }
+
+    template <typename Sender>
+    void Receive(const ReceivingFrom<MessageProcessorProducer>&, const CounterMessage& message, const Sender& sender) {
+        if (message.value != received_count.load()) {
+            out_of_order_count.fetch_add(1);
+        }
+        received_count.fetch_add(1);
+        sender.template Send<MessageProcessorProducer>(std::make_unique<CounterMessage>(message.value));
+    }
+};
+
+std::atomic<int> tried_count{0};
+std::atomic<bool> is_rejected_kept{false};
+
+class MessageProcessorSink : public MessageProcessorBase {
+public:
+    using MessageProcessorBase::MessageProcessorBase;
+
+    template <typename Sender>
+    bool Ping(const Sender&) {
+        return false;
+    }
+
+    template <typename From, typename Sender>
+    void Receive(const ReceivingFrom<From>&, const CounterMessage&, const Sender&) {
+    }
+};
+
+// Tries sending until the remote edge rejects a message.
+class MessageProcessorTryingProducer : public MessageProcessorBase {
+public:
+    using MessageProcessorBase::MessageProcessorBase;
+
+    template <typename Sender>
+    bool Ping(const Sender& sender) {
+        if (is_rejected_kept.load()) {
+            return false;
+        }
+        auto message = std::make_unique<CounterMessage>(tried_count.load());
+        if (!sender.template TrySend<MessageProcessorSink>(message)) {
+            is_rejected_kept.store(message != nullptr);
+            return false;
+        }
+        tried_count.fetch_add(1);
+        return true;
+    }
+};
+
+using TestPool = DynamicallyShardedMessagePassingPool<
+    Edge<MessageProcessorProducer, MessageProcessorConsumer, CounterMessage>,
+    Edge<MessageProcessorConsumer, MessageProcessorProducer, CounterMessage>>;
+
+using TryingPool = DynamicallyShardedMessagePassingPool<
+    Edge<MessageProcessorTryingProducer, MessageProcessorSink, CounterMessage>>;
+
+// Stops the pool once the counter reaches the messages count or after 10s.
+void RunUntil(TestPool& pool, const std::atomic<int>& counter) {
+    std::thread stopper([&pool, &counter] {
+        for (int i = 0; i < 10000 && counter.load() < messages_count; ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        pool.Stop();
+    });
+    pool.Run();
+    stopper.join();
+}
+
+void TestWraparound() {
+    SharedMemoryRing ring(64);
+    TrafficRecord record;
+    int popped_count = 0;
+    bool is_intact = true;
+    for (int i = 0; i < 20; ++i) {
+        std::string payload(i % 5 * 4, 'a' + i);
+        ring.Push(i, payload, 0);
+        is_intact &= ring.Front(record) && record.edge_index == i &&
+            std::string(record.payload, record.payload_size) == payload;
+        ring.Pop();
+        ++popped_count;
+    }
+    std::cout << "Popped = " << popped_count << ", intact = " << is_intact << ", empty = " << !ring.Front(record) <<
+        ", too large pushed = " << ring.Push(0, std::string(64, 'a'), 0) << std::endl;
+}
+
+void TestForkedRing() {
+    SharedMemoryRing ring(256);
+    pid_t child = fork();
+    if (child == 0) {
+        for (int i = 0; i < messages_count; ++i) {
+            ring.Send(i % 3, std::string(reinterpret_cast<const char*>(&i), sizeof(i)));
+        }
+        _exit(0);
+    }
+    int records_count = 0;
+    int wrong_records_count = 0;
+    {
+        RemoteEdgeReceiver receiver(ring, [&records_count, &wrong_records_count](const TrafficRecord& record) {
+            int value = 0;
+            std::memcpy(&value, record.payload, sizeof(value));
+            if (value != records_count || record.edge_index != value % 3) {
+                ++wrong_records_count;
+            }
+            ++records_count;
+        });
+        waitpid(child, nullptr, 0);
+        for (int i = 0; i < 10000 && records_count < messages_count; ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    std::cout << "Records from child = " << records_count << ", wrong = " << wrong_records_count << std::endl;
+}
+
+void TestRemotePool() {
+    SharedMemoryRing to_consumer(4096);
+    SharedMemoryRing to_producer(4096);
+    pid_t child = fork();
+    if (child == 0) {
+        {
+            TestPool pool;
+            pool.ConnectRemoteProcess<MessageProcessorProducer>(to_producer, to_consumer);
+            RunUntil(pool, received_count);
+        }
+        _exit(received_count.load() == messages_count && out_of_order_count.load() == 0 ? 0 : 1);
+    }
+    {
+        TestPool pool;
+        pool.ConnectRemoteProcess<MessageProcessorConsumer>(to_consumer, to_producer);
+        RunUntil(pool, acknowledged_count);
+    }
+    int child_status = 0;
+    waitpid(child, &child_status, 0);
+    std::cout << "Acknowledged = " << acknowledged_count.load() << ", out of order = " << out_of_order_count.load() <<
+        ", consumer process exit code = " << WEXITSTATUS(child_status) << std::endl;
+}
+
+// Nobody reads the ring, as if the other process has died.
+void TestFullRing() {
+    SharedMemoryRing to_sink(256);
+    SharedMemoryRing from_sink(256);
+    {
+        TryingPool pool;
+        pool.ConnectRemoteProcess<MessageProcessorSink>(to_sink, from_sink);
+        std::thread stopper([&pool] {
+            for (int i = 0; i < 10000 && !is_rejected_kept.load(); ++i) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            pool.Stop();
+        });
+        pool.Run();
+        stopper.join();
+    }
+    std::string payload(sizeof(int), 'a');
+    int64_t start_time = GetMonotonicTime();
+    bool is_pushed = to_sink.Push(0, payload, 10000);
+    bool is_waited = GetMonotonicTime() - start_time >= 10000;
+    std::cout << "Tried before the ring was full = " << tried_count.load() << ", rejected message kept = " <<
+        is_rejected_kept.load() << ", pushed to a full ring = " << is_pushed << ", waited = " << is_waited <<
+        ", sent to a full ring = " << to_sink.Send(0, payload) << ", dropped = " << to_sink.GetDroppedCount() << std::endl;
+}
+
+int main() {
+    TestWraparound();
+    TestForkedRing();
+    TestFullRing();
+    TestRemotePool();
+    return 0;
+}
@@ -1,11 +1,176 @@
 #include <chrono>
+#include <cmath>
 #include <algorithm>
+#include <thread>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
 
 #include "timers.h"
 
 const int64_t PeriodicTimer::min_system_click_call_period = 1000; // 1 ms
 const int64_t PeriodicTimer::max_wind_up_steps = 10000;
 const int64_t PeriodicTimer::min_measured_time = 1; // 1 ns
+const int64_t TscClock::default_calibration_time = 10000; // 10ms
+const int LatencyHistogram::sub_bucket_bits = 4;
+const int LatencyHistogram::max_value_bits = 40;
+const int64_t LatencyHistogram::sub_buckets_count = int64_t(1) << LatencyHistogram::sub_bucket_bits;
+
+namespace {
+
+std::atomic<Clock*> current_clock(nullptr);
+std::atomic<Clock*> timer_clock(nullptr);
+
+int64_t GetClockTime(const clockid_t clock_id) noexcept {
+    timespec time;
+    clock_gettime(clock_id, &time);
+    return static_cast<int64_t>(time.tv_sec) * 1000000000 + time.tv_nsec;
+}
+
+uint64_t ReadTimeStampCounter() noexcept {
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int processor_id;
+    return __rdtscp(&processor_id);
+#else
+    return 0;
+#endif
+}
+
+// A virtual clock set by SetClock takes over timers too.
+Clock& GetActiveTimerClock() noexcept {
+    Clock* clock = current_clock.load(std::memory_order_relaxed);
+    if (clock == nullptr) {
+        clock = timer_clock.load(std::memory_order_relaxed);
+    }
+    if (clock != nullptr) {
+        return *clock;
+    }
+    static SteadyClock steady_clock;
+    return steady_clock;
+}
+
+}
+
+int64_t Clock::GetPreciseTime() noexcept {
+    return GetTime() * 1000;
+}
+
+bool Clock::IsPerCallCheap() const noexcept {
+    return false;
+}
+
+int64_t SteadyClock::GetTime() noexcept {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int64_t SteadyClock::GetPreciseTime() noexcept {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int64_t CoarseMonotonicClock::GetTime() noexcept {
+    return GetClockTime(CLOCK_MONOTONIC_COARSE) / 1000;
+}
+
+// The counter is taken between two CLOCK_MONOTONIC readings at both ends of
+// a busy wait, so preemption spoils at most the edges of the interval.
+TscClock::TscClock(const int64_t calibration_time) noexcept
+    : is_supported(IsSupported()),
+      start_ticks(0),
+      start_time(0),
+      nanoseconds_per_tick(0)
+{
+    if (!is_supported) {
+        return;
+    }
+    start_time = GetClockTime(CLOCK_MONOTONIC);
+    start_ticks = ReadTimeStampCounter();
+    int64_t finish_time = start_time;
+    while (finish_time - start_time < calibration_time * 1000) {
+        finish_time = GetClockTime(CLOCK_MONOTONIC);
+    }
+    uint64_t finish_ticks = ReadTimeStampCounter();
+    nanoseconds_per_tick = static_cast<double>(finish_time - start_time) / (finish_ticks - start_ticks);
+}
+
+int64_t TscClock::GetTime() noexcept {
+    return GetPreciseTime() / 1000;
+}
+
+int64_t TscClock::GetPreciseTime() noexcept {
+    if (!is_supported) {
+        return GetClockTime(CLOCK_MONOTONIC);
+    }
+    return start_time + static_cast<int64_t>((ReadTimeStampCounter() - start_ticks) * nanoseconds_per_tick);
+}
+
+bool TscClock::IsPerCallCheap() const noexcept {
+    return is_supported;
+}
+
+bool TscClock::IsSupported() noexcept {
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) || eax < 0x80000007) {
+        return false;
+    }
+    __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+    return (edx & (1u << 8)) != 0;
+#else
+    return false;
+#endif
+}
+
+int64_t GetMonotonicTime() noexcept {
+    Clock* clock = current_clock.load(std::memory_order_relaxed);
+    if (clock != nullptr) {
+        return clock->GetTime();
+    }
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+VirtualClock::VirtualClock(const int64_t start_time) noexcept
+    : time(start_time)
+{
+}
+
+int64_t VirtualClock::GetTime() noexcept {
+    return time.load(std::memory_order_relaxed);
+}
+
+void VirtualClock::Advance(const int64_t duration) noexcept {
+    time.fetch_add(std::max(duration, int64_t(0)), std::memory_order_relaxed);
+}
+
+void VirtualClock::SetTime(const int64_t new_time) noexcept {
+    time.store(new_time, std::memory_order_relaxed);
+}
+
+void SetClock(Clock* clock) noexcept {
+    current_clock.store(clock, std::memory_order_relaxed);
+}
+
+Clock* GetClock() noexcept {
+    return current_clock.load(std::memory_order_relaxed);
+}
+
+void SetTimerClock(Clock* clock) noexcept {
+    timer_clock.store(clock, std::memory_order_relaxed);
+}
+
+Clock* GetTimerClock() noexcept {
+    return timer_clock.load(std::memory_order_relaxed);
+}
+
+void SpendTime(const int64_t duration) noexcept {
+    VirtualClock* virtual_clock = dynamic_cast<VirtualClock*>(GetClock());
+    if (virtual_clock != nullptr) {
+        virtual_clock->Advance(duration);
+    } else {
+        std::this_thread::sleep_for(std::chrono::microseconds(duration));
+    }
+}
 
 PeriodicTimer::PeriodicTimer() noexcept
     : wind_up_counter(1),
@@ -16,7 +181,7 @@ PeriodicTimer::PeriodicTimer() noexcept
 }
 
 void PeriodicTimer::WindUp() noexcept {
-    int64_t system_time = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    int64_t system_time = GetActiveTimerClock().GetTime();
     int64_t time_passed = system_time - last_system_time;
     int64_t new_wind_up_counter = time_passed > 0 ? std::max(1l, std::min(
             min_system_click_call_period / time_passed * last_wind_up_counter,
@@ -45,20 +210,124 @@ void PeriodicTimer::Reset() noexcept {
     last_system_time = 0;
 }
 
-StartFinishTimer::StartFinishTimer() noexcept
+LatencyHistogram::LatencyHistogram()
+    : buckets((max_value_bits - sub_bucket_bits + 1) * sub_buckets_count, 0),
+      count(0),
+      max_value(0)
+{
+}
+
+size_t LatencyHistogram::GetBucketIndex(const int64_t value) noexcept {
+    int64_t clamped_value = std::min(std::max(value, int64_t(0)), (int64_t(1) << max_value_bits) - 1);
+    if (clamped_value < 2 * sub_buckets_count) {
+        return clamped_value;
+    }
+    int shift = 63 - __builtin_clzll(clamped_value) - sub_bucket_bits;
+    return shift * sub_buckets_count + (clamped_value >> shift);
+}
+
+int64_t LatencyHistogram::GetBucketUpperBound(const size_t bucket_index) noexcept {
+    if (static_cast<int64_t>(bucket_index) < 2 * sub_buckets_count) {
+        return bucket_index;
+    }
+    int shift = bucket_index / sub_buckets_count - 1;
+    int64_t sub_bucket = bucket_index % sub_buckets_count + sub_buckets_count;
+    return ((sub_bucket + 1) << shift) - 1;
+}
+
+void LatencyHistogram::Record(const int64_t value) noexcept {
+    ++buckets[GetBucketIndex(value)];
+    ++count;
+    max_value = std::max(max_value, value);
+}
+
+void LatencyHistogram::Merge(const LatencyHistogram& other) noexcept {
+    for (size_t i = 0; i < buckets.size(); ++i) {
+        buckets[i] += other.buckets[i];
+    }
+    count += other.count;
+    max_value = std::max(max_value, other.max_value);
+}
+
+uint64_t LatencyHistogram::GetCount() const noexcept {
+    return count;
+}
+
+int64_t LatencyHistogram::GetMaxValue() const noexcept {
+    return max_value;
+}
+
+int64_t LatencyHistogram::GetValueAtQuantile(const double quantile) const noexcept {
+    if (count == 0) {
+        return 0;
+    }
+    uint64_t rank = std::max(uint64_t(1), static_cast<uint64_t>(std::ceil(std::min(std::max(quantile, 0.0), 1.0) * count)));
+    uint64_t counted = 0;
+    for (size_t i = 0; i < buckets.size(); ++i) {
+        counted += buckets[i];
+        if (counted >= rank) {
+            return std::min(GetBucketUpperBound(i), max_value);
+        }
+    }
+    return max_value;
+}
+
+int64_t LatencyHistogram::GetP50() const noexcept {
+    return GetValueAtQuantile(0.5);
+}
+
+int64_t LatencyHistogram::GetP99() const noexcept {
+    return GetValueAtQuantile(0.99);
+}
+
+int64_t LatencyHistogram::GetP999() const noexcept {
+    return GetValueAtQuantile(0.999);
+}
+
+void LatencyHistogram::Reset() noexcept {
+    std::fill(buckets.begin(), buckets.end(), 0);
+    count = 0;
+    max_value = 0;
+}
+
+StartFinishTimer::StartFinishTimer(const bool is_histogram_enabled)
     : start_timer(),
       finish_timer(),
+      per_call_clock(is_histogram_enabled || GetActiveTimerClock().IsPerCallCheap() ? &GetActiveTimerClock() : nullptr),
+      histogram(),
+      start_time(0),
+      precise_duration_sum(0),
       measurements_counter(0),
       last_duration(0),
       duration_sum(0)
 {
+    if (is_histogram_enabled) {
+        histogram.emplace();
+    }
 }
 
 void StartFinishTimer::Start() noexcept {
+    if (per_call_clock != nullptr) {
+        start_time = per_call_clock->GetPreciseTime();
+        return;
+    }
     last_duration -= start_timer.GetPassedTime();
 }
 
+// Measured nanoseconds are summed up before rounding, so short calls are not
+// rounded down to nothing.
 void StartFinishTimer::Finish() noexcept {
+    if (per_call_clock != nullptr) {
+        int64_t precise_duration = per_call_clock->GetPreciseTime() - start_time;
+        precise_duration_sum += precise_duration;
+        last_duration = precise_duration / 1000;
+        duration_sum = precise_duration_sum / 1000;
+        ++measurements_counter;
+        if (histogram) {
+            histogram->Record(precise_duration);
+        }
+        return;
+    }
     last_duration += finish_timer.GetPassedTime();
     duration_sum += last_duration;
     ++measurements_counter;
@@ -80,14 +349,49 @@ int64_t StartFinishTimer::GetAverageDuration() noexcept {
     }
 }
 
+const LatencyHistogram* StartFinishTimer::GetHistogram() const noexcept {
+    return histogram ? &*histogram : nullptr;
+}
+
 void StartFinishTimer::Reset() noexcept {
+    if (histogram) {
+        histogram->Reset();
+    }
     start_timer.Reset();
     finish_timer.Reset();
+    start_time = 0;
+    precise_duration_sum = 0;
     measurements_counter = 0;
     last_duration = 0;
     duration_sum = 0;
 }
 
+DecayedRate::DecayedRate(const int64_t half_life, const int64_t start_time) noexcept
+    : half_life(half_life),
+      last_time(start_time),
+      is_updated(false),
+      rate(0)
+{
+}
+
+// The first interval sets the rate as is, so the estimate does not start
+// from zero.
+void DecayedRate::AddInterval(const int64_t amount, const int64_t time) noexcept {
+    int64_t interval = time - last_time;
+    if (interval <= 0) {
+        return;
+    }
+    double interval_rate = static_cast<double>(amount) * 1e6 / interval;
+    double interval_weight = is_updated ? 1 - std::exp2(-static_cast<double>(interval) / half_life) : 1;
+    rate += (interval_rate - rate) * interval_weight;
+    last_time = time;
+    is_updated = true;
+}
+
+double DecayedRate::GetRate() const noexcept {
+    return rate;
+}
+
 WaitingTimer::WaitingTimer(const uint64_t time_period) noexcept
     : time_period(time_period),
       time_elapsed(0),
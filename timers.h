@@ -1,6 +1,82 @@
 #pragma once
 
+#include <atomic>
 #include <cstdint>
+#include <optional>
+#include <vector>
+
+// Microseconds since an unspecified point, never going backwards.
+int64_t GetMonotonicTime() noexcept;
+
+// Source of time for GetMonotonicTime and for approximate timers.
+class Clock {
+public:
+    virtual int64_t GetTime() noexcept = 0;
+    // Nanoseconds, at least as precise as GetTime.
+    virtual int64_t GetPreciseTime() noexcept;
+    // Whether GetPreciseTime is cheap and precise enough to be called around
+    // every measured call.
+    virtual bool IsPerCallCheap() const noexcept;
+    virtual ~Clock() noexcept {}
+};
+
+// CLOCK_MONOTONIC through std::chrono::steady_clock.
+class SteadyClock : public Clock {
+public:
+    virtual int64_t GetTime() noexcept;
+    virtual int64_t GetPreciseTime() noexcept;
+};
+
+// CLOCK_MONOTONIC_COARSE: cheaper than CLOCK_MONOTONIC, but it moves only
+// once in a scheduler tick.
+class CoarseMonotonicClock : public Clock {
+public:
+    virtual int64_t GetTime() noexcept;
+};
+
+// Time stamp counter scaled by a rate measured against CLOCK_MONOTONIC on
+// construction. Falls back to CLOCK_MONOTONIC where the counter is not
+// invariant, so it ticks at a different rate on different cores or states.
+class TscClock : public Clock {
+public:
+    explicit TscClock(const int64_t calibration_time = default_calibration_time) noexcept;
+    virtual int64_t GetTime() noexcept;
+    virtual int64_t GetPreciseTime() noexcept;
+    virtual bool IsPerCallCheap() const noexcept;
+    static bool IsSupported() noexcept;
+private:
+    static const int64_t default_calibration_time;
+    bool is_supported;
+    uint64_t start_ticks;
+    int64_t start_time;
+    double nanoseconds_per_tick;
+};
+
+// Time moves only when it is advanced, so runs driven by it are
+// reproducible.
+class VirtualClock : public Clock {
+public:
+    explicit VirtualClock(const int64_t start_time = 0) noexcept;
+    virtual int64_t GetTime() noexcept;
+    void Advance(const int64_t duration) noexcept;
+    void SetTime(const int64_t new_time) noexcept;
+private:
+    std::atomic<int64_t> time;
+};
+
+// Passing nullptr restores the system clocks. The clock must outlive its use
+// and is better set before any timer is created.
+void SetClock(Clock* clock) noexcept;
+Clock* GetClock() noexcept;
+
+// Backend of PeriodicTimer and StartFinishTimer while no clock is set by
+// SetClock. Passing nullptr restores SteadyClock. Timers created after the
+// call measure every call if the backend is cheap enough for that.
+void SetTimerClock(Clock* clock) noexcept;
+Clock* GetTimerClock() noexcept;
+
+// Synthetic cost of work: advances a virtual clock, sleeps otherwise.
+void SpendTime(const int64_t duration) noexcept;
 
 class PeriodicTimer {
 private:
@@ -21,23 +97,81 @@ private:
     int64_t approx_time_step;
 };
 
+// Log-linear histogram of durations in the HDR style: values below
+// 2 * sub_buckets_count have buckets of their own, every further power of two
+// is split into sub_buckets_count buckets, so a value is reported at most
+// 1 / sub_buckets_count above itself. Buckets are allocated on construction,
+// values of max_value_bits and more go to the last one.
+class LatencyHistogram {
+public:
+    LatencyHistogram();
+    void Record(const int64_t value) noexcept;
+    // Histograms of different timers are added up by the planner.
+    void Merge(const LatencyHistogram& other) noexcept;
+    uint64_t GetCount() const noexcept;
+    int64_t GetMaxValue() const noexcept;
+    // Upper bound of the bucket of the quantile, not above the maximum
+    // recorded value. Zero if nothing is recorded.
+    int64_t GetValueAtQuantile(const double quantile) const noexcept;
+    int64_t GetP50() const noexcept;
+    int64_t GetP99() const noexcept;
+    int64_t GetP999() const noexcept;
+    void Reset() noexcept;
+private:
+    static size_t GetBucketIndex(const int64_t value) noexcept;
+    static int64_t GetBucketUpperBound(const size_t bucket_index) noexcept;
+    static const int sub_bucket_bits;
+    static const int max_value_bits;
+    static const int64_t sub_buckets_count;
+    std::vector<uint64_t> buckets;
+    uint64_t count;
+    int64_t max_value;
+};
+
 class StartFinishTimer {
 public:
-    StartFinishTimer() noexcept;
+    // With a histogram every call is measured, whatever the timer clock is.
+    explicit StartFinishTimer(const bool is_histogram_enabled = false);
     void Start() noexcept;
     void Finish() noexcept;
     uint64_t GetCount() noexcept;
     int64_t GetDurationSum() noexcept;
     int64_t GetAverageDuration() noexcept;
+    // Durations of calls in nanoseconds, nullptr if the histogram is not
+    // enabled.
+    const LatencyHistogram* GetHistogram() const noexcept;
     void Reset() noexcept;
 private:
     PeriodicTimer start_timer;
     PeriodicTimer finish_timer;
+    // Set if every call is measured, the wind-up timers are not used then.
+    Clock* per_call_clock;
+    std::optional<LatencyHistogram> histogram;
+    int64_t start_time;
+    int64_t precise_duration_sum;
     uint64_t measurements_counter;
     int64_t last_duration;
     int64_t duration_sum;
 };
 
+// Exponentially decayed rate of an amount, like the duration sum of a
+// StartFinishTimer. It is fed with the amount of every interval, counted
+// since the previous one, and the rate of an interval loses half of its
+// weight with every half-life after it.
+class DecayedRate {
+public:
+    DecayedRate(const int64_t half_life, const int64_t start_time) noexcept;
+    // The interval lasts from the previous call, or from the start, to time.
+    void AddInterval(const int64_t amount, const int64_t time) noexcept;
+    // Amount per second, zero before the first interval.
+    double GetRate() const noexcept;
+private:
+    int64_t half_life;
+    int64_t last_time;
+    bool is_updated;
+    double rate;
+};
+
 class WaitingTimer {
 public:
     explicit WaitingTimer(const uint64_t time_period) noexcept;
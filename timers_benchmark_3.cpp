@@ -0,0 +1,28 @@
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "timers.h"
+
+// Cost of measuring a call with every timer clock backend.
+int main(int argc, char** argv) {
+    std::string backend = argc > 1 ? argv[1] : "steady";
+    std::unique_ptr<Clock> clock;
+    if (backend == "tsc") {
+        clock = std::make_unique<TscClock>();
+        std::cout << "Invariant TSC = " << TscClock::IsSupported() << std::endl;
+    } else if (backend == "coarse") {
+        clock = std::make_unique<CoarseMonotonicClock>();
+    }
+    SetTimerClock(clock.get());
+    StartFinishTimer timer;
+    int64_t start_time = GetMonotonicTime();
+    for (int i = 0; i < 1000000; ++i) {
+        timer.Start();
+        timer.Finish();
+    }
+    std::cout << backend << ": " << (GetMonotonicTime() - start_time) * 1000 / 1000000 << "ns per measurement, measured "
+        << timer.GetDurationSum() << "us" << std::endl;
+    SetTimerClock(nullptr);
+    return 0;
+}
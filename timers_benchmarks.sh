@@ -1,6 +1,6 @@
 #!/bin/bash
 
-for bn in {1..2}; do
+for bn in {1..3}; do
     make timers_benchmark_$bn
     echo > timers_benchmark_$bn.txt && for i in {1..100}; do (time ./timers_benchmark_$bn) 1>> /dev/null 2>> timers_benchmark_$bn.txt ;done
     echo "benchmark $bn"
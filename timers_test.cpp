@@ -1,4 +1,5 @@
 #include "timers.h"
+#include <cstdlib>
 #include <iostream>
 #include <thread>
 #include <chrono>
@@ -75,12 +76,93 @@ void TestPeriodicClockFast() {
     std::cout << "Total time lapse = " << last_time - first_time << std::endl;
 }
 
+void TestVirtualClock() {
+    VirtualClock virtual_clock(1000);
+    SetClock(&virtual_clock);
+    WaitingTimer waiting_timer(5000);
+    int64_t start_time = GetMonotonicTime();
+    for (int i = 0; i < 3; ++i) {
+        SpendTime(2000);
+        std::cout << "Virtual time = " << GetMonotonicTime() - start_time
+            << ", WaitingTimer::CheckTime = " << waiting_timer.CheckTime() << std::endl;
+    }
+    SetClock(nullptr);
+}
+
+void TestClockBackends() {
+    TscClock tsc_clock;
+    CoarseMonotonicClock coarse_clock;
+    SteadyClock steady_clock;
+    int64_t steady_time = steady_clock.GetTime();
+    std::cout << "TSC is per call cheap = " << (tsc_clock.IsPerCallCheap() == TscClock::IsSupported())
+        << ", TSC is close to steady = " << (std::abs(tsc_clock.GetTime() - steady_time) < 1000)
+        << ", coarse is close to steady = " << (std::abs(coarse_clock.GetTime() - steady_time) < 20000) << std::endl;
+    SetTimerClock(&tsc_clock);
+    StartFinishTimer start_finish_timer;
+    for (int i = 0; i < 10; ++i) {
+        start_finish_timer.Start();
+        std::this_thread::sleep_for(2ms);
+        start_finish_timer.Finish();
+    }
+    SetTimerClock(nullptr);
+    std::cout << "StartFinishTimer with TSC::GetAverageDuration is about 2ms = "
+        << (start_finish_timer.GetAverageDuration() >= 2000 && start_finish_timer.GetAverageDuration() < 4000) << std::endl;
+}
+
+void TestLatencyHistogram() {
+    LatencyHistogram histogram;
+    for (int i = 0; i < 1000; ++i) {
+        histogram.Record(i < 990 ? 1000 : 50000000);
+    }
+    LatencyHistogram other_histogram;
+    other_histogram.Record(7);
+    histogram.Merge(other_histogram);
+    std::cout << "Histogram count = " << histogram.GetCount() << ", p50 is about 1us = "
+        << (histogram.GetP50() >= 1000 && histogram.GetP50() < 1000 * 17 / 16)
+        << ", p99 is about 1us = " << (histogram.GetP99() >= 1000 && histogram.GetP99() < 1000 * 17 / 16)
+        << ", p999 = " << histogram.GetP999() << ", min = " << histogram.GetValueAtQuantile(0) << std::endl;
+    VirtualClock clock;
+    SetClock(&clock);
+    StartFinishTimer start_finish_timer(true);
+    for (int i = 0; i < 1000; ++i) {
+        start_finish_timer.Start();
+        clock.Advance(i % 100 == 0 ? 50000 : 1);
+        start_finish_timer.Finish();
+    }
+    SetClock(nullptr);
+    const LatencyHistogram* timer_histogram = start_finish_timer.GetHistogram();
+    std::cout << "StartFinishTimer with histogram: average = " << start_finish_timer.GetAverageDuration()
+        << "us, p50 = " << timer_histogram->GetP50() << "ns, p99 = " << timer_histogram->GetP99()
+        << "ns, without histogram = " << (StartFinishTimer().GetHistogram() == nullptr) << std::endl;
+}
+
+void TestDecayedRate() {
+    DecayedRate rate(1000000, 0);
+    for (int64_t time = 1000000; time <= 10000000; time += 1000000) {
+        rate.AddInterval(100, time);
+    }
+    std::cout << "DecayedRate at a steady load = " << rate.GetRate();
+    rate.AddInterval(0, 11000000);
+    std::cout << ", one half-life after the load is gone = " << rate.GetRate() << std::endl;
+    DecayedRate steady_rate(1000000, 0);
+    steady_rate.AddInterval(500, 500000);
+    double first_rate = steady_rate.GetRate();
+    for (int64_t time = 1000000; time <= 5000000; time += 500000) {
+        steady_rate.AddInterval(500, time);
+    }
+    std::cout << "Equal intervals keep the rate = " << (steady_rate.GetRate() == first_rate) << std::endl;
+}
+
 int main() {
     TestPeriodicTimer();
     TestStartFinishTimer();
     TestWaitingTimer();
     TestPeriodicClock();
     TestPeriodicClockFast();
+    TestVirtualClock();
+    TestClockBackends();
+    TestLatencyHistogram();
+    TestDecayedRate();
     return 0;
 }
 
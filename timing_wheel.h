@@ -0,0 +1,203 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+// Hierarchical timing wheel: four levels of 64 slots each. Deadlines further
+// than the last level are parked in the last level and re-cascaded. The wheel
+// of a shard moves between threads with the shard, so it stays off the
+// thread-local allocator.
+template <typename T>
+class TimingWheel {
+private:
+    static constexpr int levels_count = 4;
+    static constexpr int slot_bits = 6;
+    static constexpr int slots_count = 1 << slot_bits;
+    static constexpr int64_t slot_mask = slots_count - 1;
+
+    struct Node {
+        int64_t deadline_tick;
+        T value;
+        int prev;
+        int next;
+        int slot;
+        uint32_t generation;
+        bool is_used;
+    };
+
+    int GetSlotIndex(const int level, const int64_t tick) const noexcept {
+        return level * slots_count + ((tick >> (level * slot_bits)) & slot_mask);
+    }
+
+    void Attach(const int node_index) noexcept {
+        Node& node = nodes[node_index];
+        int64_t slot_tick = std::max(node.deadline_tick, current_tick);
+        int64_t delta = slot_tick - current_tick;
+        int level = 0;
+        while (level + 1 < levels_count && delta >= (int64_t(1) << ((level + 1) * slot_bits))) {
+            ++level;
+        }
+        if (delta >= (int64_t(1) << (levels_count * slot_bits))) {
+            slot_tick = current_tick + (int64_t(1) << (levels_count * slot_bits)) - 1;
+        }
+        node.slot = GetSlotIndex(level, slot_tick);
+        int& head = slots[node.slot];
+        node.prev = -1;
+        node.next = head;
+        if (head != -1) {
+            nodes[head].prev = node_index;
+        }
+        head = node_index;
+    }
+
+    void Detach(const int node_index) noexcept {
+        Node& node = nodes[node_index];
+        if (node.prev != -1) {
+            nodes[node.prev].next = node.next;
+        } else if (node.slot != -1) {
+            slots[node.slot] = node.next;
+        }
+        if (node.next != -1) {
+            nodes[node.next].prev = node.prev;
+        }
+    }
+
+    void Free(const int node_index) noexcept {
+        nodes[node_index].is_used = false;
+        ++nodes[node_index].generation;
+        nodes[node_index].next = free_head;
+        free_head = node_index;
+        --size;
+    }
+
+    int TakeSlot(const int level, const int64_t tick) noexcept {
+        int& head = slots[GetSlotIndex(level, tick)];
+        int list = head;
+        head = -1;
+        return list;
+    }
+
+    void Cascade(const int level) noexcept {
+        int node_index = TakeSlot(level, current_tick);
+        while (node_index != -1) {
+            int next = nodes[node_index].next;
+            Attach(node_index);
+            node_index = next;
+        }
+    }
+public:
+    TimingWheel(const int64_t tick_duration, const int64_t start_time) noexcept
+        : tick_duration(tick_duration),
+          current_tick(start_time / tick_duration),
+          free_head(-1),
+          size(0),
+          nodes(),
+          slots(levels_count * slots_count, -1),
+          expired_nodes()
+    {
+    }
+
+    uint64_t Schedule(const int64_t deadline, T&& value) {
+        int node_index = free_head;
+        if (node_index == -1) {
+            node_index = nodes.size();
+            nodes.push_back(Node{0, T(), -1, -1, -1, 0, false});
+        } else {
+            free_head = nodes[node_index].next;
+        }
+        Node& node = nodes[node_index];
+        // Rounded up, so a timer never fires before its deadline.
+        node.deadline_tick = std::max((deadline + tick_duration - 1) / tick_duration, current_tick);
+        node.value = std::move(value);
+        node.is_used = true;
+        ++size;
+        Attach(node_index);
+        return (static_cast<uint64_t>(node.generation) << 32) | static_cast<uint64_t>(node_index);
+    }
+
+    bool Cancel(const uint64_t timer_id) noexcept {
+        if (!IsScheduled(timer_id)) {
+            return false;
+        }
+        int node_index = static_cast<int>(timer_id & 0xffffffff);
+        Detach(node_index);
+        nodes[node_index].value = T();
+        Free(node_index);
+        return true;
+    }
+
+    bool IsScheduled(const uint64_t timer_id) const noexcept {
+        int node_index = static_cast<int>(timer_id & 0xffffffff);
+        uint32_t generation = static_cast<uint32_t>(timer_id >> 32);
+        return node_index < static_cast<int>(nodes.size()) && nodes[node_index].is_used &&
+            nodes[node_index].generation == generation;
+    }
+
+    template <typename Callback>
+    bool Advance(const int64_t current_time, Callback callback) {
+        int64_t target_tick = current_time / tick_duration;
+        bool was_fired = false;
+        while (current_tick <= target_tick) {
+            if (size == 0) {
+                current_tick = target_tick + 1;
+                break;
+            }
+            for (int node_index = TakeSlot(0, current_tick); node_index != -1; node_index = nodes[node_index].next) {
+                nodes[node_index].slot = -1;
+                nodes[node_index].prev = -1;
+                expired_nodes.push_back(std::make_pair(node_index, nodes[node_index].generation));
+            }
+            ++current_tick;
+            for (int level = levels_count - 1; level > 0; --level) {
+                if ((current_tick & ((int64_t(1) << (level * slot_bits)) - 1)) == 0) {
+                    for (int cascade_level = level; cascade_level > 0; --cascade_level) {
+                        Cascade(cascade_level);
+                    }
+                    break;
+                }
+            }
+            for (size_t i = 0; i < expired_nodes.size(); ++i) {
+                int node_index = expired_nodes[i].first;
+                if (nodes[node_index].is_used && nodes[node_index].generation == expired_nodes[i].second) {
+                    T value = std::move(nodes[node_index].value);
+                    Free(node_index);
+                    callback(std::move(value));
+                    was_fired = true;
+                }
+            }
+            expired_nodes.clear();
+        }
+        return was_fired;
+    }
+
+    int64_t GetNextDeadline() noexcept {
+        if (size == 0) {
+            return std::numeric_limits<int64_t>::max();
+        }
+        for (int level = 0; level < levels_count; ++level) {
+            int64_t level_tick = current_tick >> (level * slot_bits);
+            int64_t first_slot = level == 0 ? 0 : 1;
+            for (int64_t i = first_slot; i < first_slot + slots_count; ++i) {
+                if (slots[GetSlotIndex(level, (level_tick + i) << (level * slot_bits))] != -1) {
+                    return std::max(current_tick, (level_tick + i) << (level * slot_bits)) * tick_duration;
+                }
+            }
+        }
+        return current_tick * tick_duration;
+    }
+
+    size_t GetSize() const noexcept {
+        return size;
+    }
+private:
+    int64_t tick_duration;
+    int64_t current_tick;
+    int free_head;
+    size_t size;
+    std::vector<Node> nodes;
+    std::vector<int> slots;
+    std::vector<std::pair<int, uint32_t>> expired_nodes;
+};
@@ -0,0 +1,65 @@
+#include <iostream>
+#include <cstdlib>
+#include <algorithm>
+
+#include "timing_wheel.h"
+#include "types.h"
+
+void TestFiringTimes() {
+    const int64_t tick_duration = 100;
+    TimingWheel<int64_t> timing_wheel(tick_duration, 0);
+    Vector<int64_t> deadlines = {0, 50, 100, 6399, 6400, 6401, 250000, 409600, 26214400, 2000000000};
+    for (int64_t deadline : deadlines) {
+        timing_wheel.Schedule(deadline, int64_t(deadline));
+    }
+    uint64_t cancelled_id = timing_wheel.Schedule(300000, -1);
+    std::cout << "Cancel = " << timing_wheel.Cancel(cancelled_id) << ", second cancel = " << timing_wheel.Cancel(cancelled_id) << std::endl;
+    size_t fired_count = 0;
+    bool is_in_time = true;
+    int64_t current_time = 0;
+    while (timing_wheel.GetSize() > 0) {
+        int64_t next_deadline = timing_wheel.GetNextDeadline();
+        current_time = std::min(current_time + std::rand() % 100000, next_deadline);
+        timing_wheel.Advance(current_time, [&](int64_t deadline) {
+            ++fired_count;
+            if (deadline < 0 || current_time < deadline || (deadline + tick_duration - 1) / tick_duration != current_time / tick_duration) {
+                is_in_time = false;
+            }
+        });
+    }
+    std::cout << "Fired " << fired_count << " of " << deadlines.size() << ", in time = " << is_in_time << std::endl;
+}
+
+void TestRescheduleFromCallback() {
+    TimingWheel<int> timing_wheel(10, 1000);
+    timing_wheel.Schedule(1010, 0);
+    int fired_count = 0;
+    for (int64_t current_time = 1000; current_time <= 2000; current_time += 10) {
+        timing_wheel.Advance(current_time, [&](int generation) {
+            ++fired_count;
+            if (generation < 9) {
+                timing_wheel.Schedule(current_time, generation + 1);
+            }
+        });
+    }
+    std::cout << "Rescheduled timers fired " << fired_count << " times" << std::endl;
+}
+
+void TestUnalignedDeadline() {
+    TimingWheel<int> timing_wheel(100, 0);
+    timing_wheel.Schedule(150, 0);
+    int64_t next_deadline = timing_wheel.GetNextDeadline();
+    int fired_count = 0;
+    timing_wheel.Advance(199, [&](int) { ++fired_count; });
+    int early_count = fired_count;
+    timing_wheel.Advance(200, [&](int) { ++fired_count; });
+    std::cout << "Unaligned deadline fired early = " << early_count << ", next deadline = " << next_deadline <<
+        ", fired at it = " << fired_count << std::endl;
+}
+
+int main() {
+    TestFiringTimes();
+    TestRescheduleFromCallback();
+    TestUnalignedDeadline();
+    return 0;
+}
@@ -0,0 +1,156 @@
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "traffic_recorder.h"
+
+namespace {
+
+const char traffic_log_magic[8] = {'R', 'A', 'S', 'T', 'T', 'R', 'F', '2'};
+
+struct TrafficLogHeader {
+    char magic[8];
+    uint64_t edges_count;
+};
+
+struct TrafficRecordHeader {
+    // Stored last, so the reader stops at a record which is not fully written
+    // and at the zero-filled tail.
+    uint32_t is_committed;
+    int32_t edge_index;
+    uint32_t payload_size;
+    uint32_t reserved;
+    int64_t timestamp;
+};
+
+size_t GetRecordSize(const size_t payload_size) noexcept {
+    return (sizeof(TrafficRecordHeader) + payload_size + 7) / 8 * 8;
+}
+
+void ThrowSystemError(const std::string& what) {
+    throw std::system_error(errno, std::generic_category(), what);
+}
+
+}
+
+TrafficRecorder::TrafficRecorder(const std::string& file_name, const size_t edges_count, const size_t max_size)
+    : max_size(max_size),
+      size(sizeof(TrafficLogHeader)),
+      dropped_count(0)
+{
+    file_descriptor = open(file_name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (file_descriptor == -1) {
+        ThrowSystemError("Cannot open traffic log " + file_name);
+    }
+    if (ftruncate(file_descriptor, max_size) == -1) {
+        close(file_descriptor);
+        ThrowSystemError("Cannot resize traffic log " + file_name);
+    }
+    void* mapped_data = mmap(nullptr, max_size, PROT_READ | PROT_WRITE, MAP_SHARED, file_descriptor, 0);
+    if (mapped_data == MAP_FAILED) {
+        close(file_descriptor);
+        ThrowSystemError("Cannot map traffic log " + file_name);
+    }
+    data = static_cast<char*>(mapped_data);
+    TrafficLogHeader header;
+    std::memcpy(header.magic, traffic_log_magic, sizeof(header.magic));
+    header.edges_count = edges_count;
+    std::memcpy(data, &header, sizeof(header));
+}
+
+TrafficRecorder::~TrafficRecorder() {
+    size_t final_size = size.load();
+    msync(data, final_size, MS_SYNC);
+    munmap(data, max_size);
+    if (ftruncate(file_descriptor, final_size) == -1) {
+        // The log is still readable: the tail is zero-filled and skipped by the reader.
+    }
+    close(file_descriptor);
+}
+
+void TrafficRecorder::Record(const int edge_index, const int64_t timestamp, const std::string& payload) noexcept {
+    size_t record_size = GetRecordSize(payload.size());
+    size_t offset = size.load(std::memory_order_relaxed);
+    do {
+        if (offset + record_size > max_size) {
+            dropped_count.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+    } while (!size.compare_exchange_weak(offset, offset + record_size, std::memory_order_relaxed));
+    TrafficRecordHeader header{0, edge_index, static_cast<uint32_t>(payload.size()), 0, timestamp};
+    std::memcpy(data + offset, &header, sizeof(header));
+    std::memcpy(data + offset + sizeof(header), payload.data(), payload.size());
+    __atomic_store_n(&reinterpret_cast<TrafficRecordHeader*>(data + offset)->is_committed, 1, __ATOMIC_RELEASE);
+}
+
+uint64_t TrafficRecorder::GetDroppedCount() const noexcept {
+    return dropped_count.load(std::memory_order_relaxed);
+}
+
+TrafficLog::TrafficLog(const std::string& file_name)
+    : offset(sizeof(TrafficLogHeader))
+{
+    file_descriptor = open(file_name.c_str(), O_RDONLY);
+    if (file_descriptor == -1) {
+        ThrowSystemError("Cannot open traffic log " + file_name);
+    }
+    struct stat file_stat;
+    if (fstat(file_descriptor, &file_stat) == -1) {
+        close(file_descriptor);
+        ThrowSystemError("Cannot stat traffic log " + file_name);
+    }
+    size = file_stat.st_size;
+    if (size < sizeof(TrafficLogHeader)) {
+        close(file_descriptor);
+        throw std::system_error(std::make_error_code(std::errc::invalid_argument), "Truncated traffic log " + file_name);
+    }
+    void* mapped_data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file_descriptor, 0);
+    if (mapped_data == MAP_FAILED) {
+        close(file_descriptor);
+        ThrowSystemError("Cannot map traffic log " + file_name);
+    }
+    data = static_cast<const char*>(mapped_data);
+    if (std::memcmp(data, traffic_log_magic, sizeof(traffic_log_magic)) != 0) {
+        munmap(const_cast<char*>(data), size);
+        close(file_descriptor);
+        throw std::system_error(std::make_error_code(std::errc::invalid_argument), "Not a traffic log " + file_name);
+    }
+}
+
+TrafficLog::~TrafficLog() {
+    munmap(const_cast<char*>(data), size);
+    close(file_descriptor);
+}
+
+size_t TrafficLog::GetEdgesCount() const noexcept {
+    TrafficLogHeader header;
+    std::memcpy(&header, data, sizeof(header));
+    return header.edges_count;
+}
+
+bool TrafficLog::Next(TrafficRecord& record) noexcept {
+    if (offset + sizeof(TrafficRecordHeader) > size) {
+        return false;
+    }
+    const TrafficRecordHeader* committed_header = reinterpret_cast<const TrafficRecordHeader*>(data + offset);
+    if (__atomic_load_n(&committed_header->is_committed, __ATOMIC_ACQUIRE) == 0) {
+        return false;
+    }
+    TrafficRecordHeader header;
+    std::memcpy(&header, data + offset, sizeof(header));
+    if (offset + GetRecordSize(header.payload_size) > size) {
+        return false;
+    }
+    record.edge_index = header.edge_index;
+    record.timestamp = header.timestamp;
+    record.payload = data + offset + sizeof(header);
+    record.payload_size = header.payload_size;
+    offset += GetRecordSize(header.payload_size);
+    return true;
+}
+
+void TrafficLog::Rewind() noexcept {
+    offset = sizeof(TrafficLogHeader);
+}
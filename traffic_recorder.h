@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <system_error>
+#include <thread>
+
+// Binary log of sent messages, written through a memory-mapped file by any
+// number of threads. Records which do not fit into max_size are dropped.
+class TrafficRecorder {
+public:
+    TrafficRecorder(const std::string& file_name, const size_t edges_count, const size_t max_size);
+    TrafficRecorder(const TrafficRecorder&) = delete;
+    TrafficRecorder& operator=(const TrafficRecorder&) = delete;
+    ~TrafficRecorder();
+
+    void Record(const int edge_index, const int64_t timestamp, const std::string& payload) noexcept;
+    uint64_t GetDroppedCount() const noexcept;
+private:
+    int file_descriptor;
+    char* data;
+    size_t max_size;
+    std::atomic<size_t> size;
+    std::atomic<uint64_t> dropped_count;
+};
+
+struct TrafficRecord {
+    int edge_index;
+    int64_t timestamp;
+    const char* payload;
+    size_t payload_size;
+};
+
+class TrafficLog {
+public:
+    explicit TrafficLog(const std::string& file_name);
+    TrafficLog(const TrafficLog&) = delete;
+    TrafficLog& operator=(const TrafficLog&) = delete;
+    ~TrafficLog();
+
+    size_t GetEdgesCount() const noexcept;
+    bool Next(TrafficRecord& record) noexcept;
+    void Rewind() noexcept;
+private:
+    int file_descriptor;
+    const char* data;
+    size_t size;
+    size_t offset;
+};
+
+// Feeds recorded messages into the queues of a topology of the same shape,
+// either keeping the original gaps between sends or as fast as possible.
+template <typename MessagePassingTree>
+size_t ReplayTraffic(TrafficLog& traffic_log, MessagePassingTree& message_passing_tree, const bool keep_original_speed) {
+    if (traffic_log.GetEdgesCount() != message_passing_tree.GetEdgesCount()) {
+        throw std::system_error(std::make_error_code(std::errc::invalid_argument), "Traffic log was recorded for another topology");
+    }
+    size_t replayed_count = 0;
+    TrafficRecord record;
+    auto start_time = std::chrono::steady_clock::now();
+    int64_t first_timestamp = -1;
+    while (traffic_log.Next(record)) {
+        if (keep_original_speed) {
+            if (first_timestamp == -1) {
+                first_timestamp = record.timestamp;
+            }
+            std::this_thread::sleep_until(start_time + std::chrono::microseconds(record.timestamp - first_timestamp));
+        }
+        if (message_passing_tree.ReplayMessage(record)) {
+            ++replayed_count;
+        }
+    }
+    return replayed_count;
+}
@@ -0,0 +1,117 @@
+#include <iostream>
+#include <cstring>
+#include <filesystem>
+
+#include "message_passing_tree.h"
+#include "traffic_recorder.h"
+
+class RecordedMessage : public MessageBase {
+public:
+    RecordedMessage(const int value)
+    : value(value)
+    {}
+
+    void Serialize(std::string& output) const {
+        output.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    static std::unique_ptr<RecordedMessage> Deserialize(const char* data, const size_t size) {
+        int value = 0;
+        std::memcpy(&value, data, std::min(size, sizeof(value)));
+        return std::make_unique<RecordedMessage>(value);
+    }
+
+    int value;
+};
+
+class UnrecordedMessage : public MessageBase {};
+
+class MessageProcessorConsumer;
+
+class MessageProcessorProducer : public MessageProcessorBase {
+public:
+    template <typename Sender>
+    bool Ping(const Sender& sender) {
+        sender.template Send<MessageProcessorConsumer>(std::make_unique<RecordedMessage>(next_value++));
+        sender.template Send<MessageProcessorConsumer>(std::make_unique<UnrecordedMessage>());
+        return true;
+    }
+private:
+    int next_value = 0;
+};
+
+class MessageProcessorConsumer : public MessageProcessorBase {
+public:
+    template <typename Sender>
+    void Receive(const ReceivingFrom<MessageProcessorProducer>&, const RecordedMessage& message, const Sender&) {
+        std::cout << "MessageProcessorConsumer: got recorded value " << message.value << std::endl;
+    }
+
+    template <typename Sender>
+    void Receive(const ReceivingFrom<MessageProcessorProducer>&, const UnrecordedMessage&, const Sender&) {
+        std::cout << "MessageProcessorConsumer: got unrecorded message" << std::endl;
+    }
+};
+
+using TestTree = MessagePassingTree<
+    Edge<MessageProcessorProducer, MessageProcessorConsumer, RecordedMessage>,
+    Edge<MessageProcessorProducer, MessageProcessorConsumer, UnrecordedMessage>>;
+
+void TestRecordAndReplay() {
+    std::string path = std::filesystem::temp_directory_path() / "traffic_recorder_test.log";
+    {
+        TestTree message_passing_tree;
+        TrafficRecorder recorder(path, message_passing_tree.GetEdgesCount(), 1 << 20);
+        message_passing_tree.SetTrafficRecorder(&recorder);
+        int producer_index = message_passing_tree.GetMessageProcessorIndexImpl(TypeSpecifier<MessageProcessorProducer>());
+        for (int i = 0; i < 3; ++i) {
+            message_passing_tree.GetMessageProcessorProxy(producer_index)->Ping();
+        }
+        message_passing_tree.SetTrafficRecorder(nullptr);
+        std::cout << "Dropped while recording: " << recorder.GetDroppedCount() << std::endl;
+    }
+    TestTree message_passing_tree;
+    TrafficLog traffic_log(path);
+    std::cout << "Replayed " << ReplayTraffic(traffic_log, message_passing_tree, false) << " messages" << std::endl;
+    traffic_log.Rewind();
+    std::cout << "Replayed at original speed " << ReplayTraffic(traffic_log, message_passing_tree, true) << " messages" << std::endl;
+    for (size_t i = 0; i < message_passing_tree.GetEdgesCount(); ++i) {
+        while (message_passing_tree.GetEdgeProxy(i)->NotifyAboutMessage()) {}
+    }
+    std::filesystem::remove(path);
+}
+
+void TestDroppedRecords() {
+    std::string path = std::filesystem::temp_directory_path() / "traffic_recorder_test_small.log";
+    TrafficRecorder recorder(path, 1, 64);
+    for (int i = 0; i < 4; ++i) {
+        recorder.Record(0, i + 1, "payload");
+    }
+    std::cout << "Dropped when full: " << recorder.GetDroppedCount() << std::endl;
+    std::filesystem::remove(path);
+}
+
+void TestZeroTimestamps() {
+    std::string path = std::filesystem::temp_directory_path() / "traffic_recorder_test_zero.log";
+    {
+        TrafficRecorder recorder(path, 1, 1 << 10);
+        for (int i = 0; i < 3; ++i) {
+            recorder.Record(0, 0, "payload");
+        }
+    }
+    TrafficLog traffic_log(path);
+    TrafficRecord record;
+    int records_count = 0;
+    while (traffic_log.Next(record)) {
+        ++records_count;
+    }
+    std::cout << "Read records with zero timestamps: " << records_count << std::endl;
+    std::filesystem::remove(path);
+}
+
+int main() {
+    TestRecordAndReplay();
+    TestZeroTimestamps();
+    TestDroppedRecords();
+    return 0;
+}
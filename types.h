@@ -18,3 +18,40 @@ using UnorderedMap=std::unordered_map<TKey, TValue, THash, std::equal_to<TKey>,
 
 template <typename T>
 using Set=std::set<T, std::less<T>, std::allocator<T>>;
+
+// Non-owning view of a contiguous range.
+template <typename T>
+class Span {
+public:
+    Span(T* elements, const size_t elements_count) noexcept
+        : elements(elements),
+          elements_count(elements_count)
+    {}
+
+    T* begin() const noexcept {
+        return elements;
+    }
+
+    T* end() const noexcept {
+        return elements + elements_count;
+    }
+
+    T& operator[](const size_t index) const noexcept {
+        return elements[index];
+    }
+
+    T* data() const noexcept {
+        return elements;
+    }
+
+    size_t size() const noexcept {
+        return elements_count;
+    }
+
+    bool empty() const noexcept {
+        return elements_count == 0;
+    }
+private:
+    T* elements;
+    size_t elements_count;
+};